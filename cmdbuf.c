@@ -0,0 +1,37 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/gl.h>
+#include "logging.h"
+#include "grow.h"
+#include "renderqueue.h"
+#include "cmdbuf.h"
+
+/* empty the buffer but keep its memory for the next frame */
+void cmdbuf_reset(struct cmdbuf *cb)
+{
+	cb->num_items = 0;
+}
+
+/* returns a cleared command at the end of the buffer, or NULL on error. */
+struct rq_item *cmdbuf_add(struct cmdbuf *cb)
+{
+	if (grow(&cb->items, &cb->max_items, cb->num_items + 1,
+		sizeof(*cb->items))) {
+		error("Unable to allocate command buffer item!\n");
+		return NULL;
+	}
+	struct rq_item *item = &cb->items[cb->num_items++];
+	memset(item, 0, sizeof(*item));
+	return item;
+}
+
+void cmdbuf_free(struct cmdbuf *cb)
+{
+	free(cb->items);
+	memset(cb, 0, sizeof(*cb));
+}
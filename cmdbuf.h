@@ -0,0 +1,17 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef CMDBUF_H
+#define CMDBUF_H
+
+/* draw commands recorded by one thread, to be replayed on the GL thread
+ * through a render queue. nothing in here touches GL. */
+struct cmdbuf {
+	struct rq_item *items;
+	unsigned num_items, max_items;
+};
+
+void cmdbuf_reset(struct cmdbuf *cb);
+struct rq_item *cmdbuf_add(struct cmdbuf *cb);
+void cmdbuf_free(struct cmdbuf *cb);
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+/* moves a circle through the map, sliding along the walls it runs into.
+ * only the walls of the sector it is in and the sectors next to it are
+ * tested, so the cost doesn't depend on the size of the map. */
+#include <math.h>
+#include <stdbool.h>
+#include "map.h"
+#include "collide.h"
+
+/* a move is split into steps no longer than this many radiuses, so the
+ * walls of the sectors next to the current one are all it can reach */
+#define STEP_RADIUSES 0.5f
+/* times to slide along a wall in one step, corners take two */
+#define MAX_SLIDES 3
+/* portals one step can go through */
+#define MAX_HOPS 4
+/* kept between the body and a wall it stopped at */
+#define SKIN 0.001f
+
+struct hit {
+	float t; /* fraction of the move */
+	float nx, ny; /* pushes away from what was hit */
+};
+
+/* true if body can go from sector from into sector to */
+static bool passable(const struct map_sector *from,
+	const struct map_sector *to, const struct collide_body *body)
+{
+	if (!to)
+		return false;
+	float floor = fmaxf(from->floor_height, to->floor_height);
+	float ceil = fminf(from->ceil_height, to->ceil_height);
+	return to->floor_height - from->floor_height <= body->step &&
+		ceil - floor >= body->height;
+}
+
+/* circle at x,y moving by dx,dy against the corner at cx,cy */
+static void sweep_point(float x, float y, float dx, float dy, float r,
+	float cx, float cy, struct hit *hit)
+{
+	float px = x - cx, py = y - cy;
+	float a = dx * dx + dy * dy, b = px * dx + py * dy;
+	float c = px * px + py * py - r * r;
+
+	if (b >= 0.0f || a <= 0.0f)
+		return; /* moving away */
+	float t;
+	if (c <= 0.0f) {
+		t = 0.0f; /* already touching */
+	} else {
+		float disc = b * b - a * c;
+		if (disc < 0.0f)
+			return;
+		t = (-b - sqrtf(disc)) / a;
+	}
+	if (t >= hit->t)
+		return;
+	float nx = px + dx * t, ny = py + dy * t;
+	float len = sqrtf(nx * nx + ny * ny);
+	if (len <= 0.0f)
+		return;
+	*hit = (struct hit){ t, nx / len, ny / len };
+}
+
+/* circle at x,y moving by dx,dy against the wall from a to b */
+static void sweep_wall(float x, float y, float dx, float dy, float r,
+	const struct map_vertex *a, const struct map_vertex *b,
+	struct hit *hit)
+{
+	float ex = b->x - a->x, ey = b->y - a->y;
+	float len = sqrtf(ex * ex + ey * ey);
+
+	if (len <= 0.0f)
+		return;
+	float nx = -ey / len, ny = ex / len;
+	float dist = (x - a->x) * nx + (y - a->y) * ny;
+	if (dist < 0.0f) {
+		/* face the side the circle is on */
+		nx = -nx;
+		ny = -ny;
+		dist = -dist;
+	}
+	float speed = dx * nx + dy * ny;
+	if (speed < 0.0f) {
+		float t = dist > r ? (dist - r) / -speed : 0.0f;
+		/* where along the wall the circle touches it */
+		float cx = x + dx * t - a->x, cy = y + dy * t - a->y;
+		float along = (cx * ex + cy * ey) / len;
+		if (t < hit->t && along >= 0.0f && along <= len) {
+			*hit = (struct hit){ t, nx, ny };
+			return;
+		}
+	}
+	sweep_point(x, y, dx, dy, r, a->x, a->y, hit);
+	sweep_point(x, y, dx, dy, r, b->x, b->y, hit);
+}
+
+/* walls of sec that stop body, except the ones into skip */
+static void sweep_sector(const struct map *m, const struct map_sector *sec,
+	unsigned skip, const struct collide_body *body, float x, float y,
+	float dx, float dy, struct hit *hit)
+{
+	const struct map_vertex *a = map_wall_vertex(m, sec, sec->num_walls - 1);
+	unsigned i;
+
+	for (i = 0; i < sec->num_walls; i++) {
+		const struct map_vertex *b = map_wall_vertex(m, sec, i);
+		unsigned portal = map_wall_portal(m, sec, i);
+		if (portal == MAP_NONE || (portal != skip &&
+			!passable(sec, map_sector(m, portal), body)))
+			sweep_wall(x, y, dx, dy, body->radius, a, b, hit);
+		a = b;
+	}
+}
+
+/* the earliest wall hit going by dx,dy from sector n and its neighbours */
+static struct hit sweep(const struct map *m, unsigned n,
+	const struct collide_body *body, float x, float y, float dx, float dy)
+{
+	const struct map_sector *sec = map_sector(m, n);
+	struct hit hit = { 1.0f, 0.0f, 0.0f };
+	unsigned i;
+
+	if (!sec || !sec->num_walls)
+		return hit;
+	sweep_sector(m, sec, MAP_NONE, body, x, y, dx, dy, &hit);
+	for (i = 0; i < sec->num_walls; i++) {
+		unsigned portal = map_wall_portal(m, sec, i);
+		const struct map_sector *next = map_sector(m, portal);
+		if (next && next->num_walls && passable(sec, next, body))
+			sweep_sector(m, next, n, body, x, y, dx, dy, &hit);
+	}
+	return hit;
+}
+
+/* the sector reached by going from x,y to x + dx,y + dy in sector n,
+ * following every portal the line goes through */
+static unsigned cross(const struct map *m, unsigned n,
+	const struct collide_body *body, float x, float y, float dx, float dy)
+{
+	const struct map_vertex *a, *b;
+	unsigned from = MAP_NONE, hops, i;
+
+	for (hops = 0; hops < MAX_HOPS; hops++) {
+		const struct map_sector *sec = map_sector(m, n);
+		if (!sec || !sec->num_walls)
+			return n;
+		unsigned next = MAP_NONE;
+		a = map_wall_vertex(m, sec, sec->num_walls - 1);
+		for (i = 0; i < sec->num_walls; i++, a = b) {
+			b = map_wall_vertex(m, sec, i);
+			unsigned portal = map_wall_portal(m, sec, i);
+			if (portal == MAP_NONE || portal == from)
+				continue;
+			float ex = b->x - a->x, ey = b->y - a->y;
+			/* only walls the line leaves through, the sector is on
+			 * their right */
+			float den = dx * ey - dy * ex;
+			if (den >= 0.0f)
+				continue;
+			float qx = a->x - x, qy = a->y - y;
+			float t = (qx * ey - qy * ex) / den;
+			float u = (qx * dy - qy * dx) / den;
+			if (t >= 0.0f && t <= 1.0f && u >= 0.0f && u <= 1.0f &&
+				passable(sec, map_sector(m, portal), body)) {
+				next = portal;
+				break;
+			}
+		}
+		if (next == MAP_NONE)
+			return n;
+		from = n;
+		n = next;
+	}
+	return n;
+}
+
+/* move body at x,y in sector by dx,dy, stopping at walls and sliding
+ * along them. x and y are updated and the sector they end up in is
+ * returned. */
+unsigned collide_move(const struct map *m, unsigned sector,
+	const struct collide_body *body, float *x, float *y, float dx, float dy)
+{
+	float len = sqrtf(dx * dx + dy * dy);
+	float max_step = body->radius * STEP_RADIUSES;
+	unsigned steps = 1, i, j;
+
+	if (max_step > 0.0f && len > max_step)
+		steps = ceilf(len / max_step);
+	dx /= steps;
+	dy /= steps;
+	for (i = 0; i < steps; i++) {
+		float sx = dx, sy = dy;
+		for (j = 0; j < MAX_SLIDES && (sx != 0.0f || sy != 0.0f); j++) {
+			struct hit hit = sweep(m, sector, body, *x, *y, sx, sy);
+			/* stop just short of the wall */
+			float t = hit.t;
+			if (t < 1.0f) {
+				float back = SKIN / sqrtf(sx * sx + sy * sy);
+				t = t > back ? t - back : 0.0f;
+			}
+			sector = cross(m, sector, body, *x, *y, sx * t, sy * t);
+			*x += sx * t;
+			*y += sy * t;
+			if (hit.t >= 1.0f)
+				break;
+			/* slide: whatever is left, less the part into the wall */
+			sx *= 1.0f - hit.t;
+			sy *= 1.0f - hit.t;
+			float into = sx * hit.nx + sy * hit.ny;
+			sx -= hit.nx * into;
+			sy -= hit.ny * into;
+		}
+	}
+	return sector;
+}
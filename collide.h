@@ -0,0 +1,18 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef COLLIDE_H
+#define COLLIDE_H
+
+struct map;
+
+/* something that walks on the floor, seen from above as a circle */
+struct collide_body {
+	float radius;
+	float height; /* headroom it needs */
+	float step; /* highest floor it can step up onto */
+};
+
+unsigned collide_move(const struct map *m, unsigned sector,
+	const struct collide_body *body, float *x, float *y, float dx, float dy);
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "dxt.h"
+
+/* a range fit encoder: the endpoints are the corners of the bounding box of
+ * the block's colors, pulled in slightly, then each pixel takes the nearest
+ * point on the line. it is fast and good enough for photographic textures,
+ * see "Real-Time DXT Compression" (J.M.P. van Waveren). */
+
+#define INSET_SHIFT 4 /* pull each end in by 1/16 of the range */
+
+static uint16_t rgb565(const unsigned char *c)
+{
+	return (c[0] >> 3) << 11 | (c[1] >> 2) << 5 | c[2] >> 3;
+}
+
+/* expand a 5:6:5 color the same way the hardware does */
+static void rgb888(uint16_t v, int *c)
+{
+	int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+
+	c[0] = r << 3 | r >> 2;
+	c[1] = g << 2 | g >> 4;
+	c[2] = b << 3 | b >> 2;
+}
+
+static void put16(unsigned char *out, unsigned v)
+{
+	out[0] = v;
+	out[1] = v >> 8;
+}
+
+/* 4-color mode DXT1 block from 16 RGBA pixels */
+static void color_block(unsigned char *out, const unsigned char *block)
+{
+	unsigned char lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+	int i, c;
+
+	for (i = 0; i < 16; i++) {
+		for (c = 0; c < 3; c++) {
+			unsigned char v = block[i * 4 + c];
+			if (v < lo[c])
+				lo[c] = v;
+			if (v > hi[c])
+				hi[c] = v;
+		}
+	}
+	for (c = 0; c < 3; c++) {
+		int inset = (hi[c] - lo[c]) >> INSET_SHIFT;
+		lo[c] += inset;
+		hi[c] -= inset;
+	}
+
+	uint16_t c0 = rgb565(hi), c1 = rgb565(lo);
+	uint32_t indices = 0;
+	if (c0 < c1) {
+		uint16_t swap = c0;
+		c0 = c1;
+		c1 = swap;
+	}
+	/* with c0 == c1 every pixel is index 0 */
+	if (c0 != c1) {
+		int pal[4][3];
+		rgb888(c0, pal[0]);
+		rgb888(c1, pal[1]);
+		for (c = 0; c < 3; c++) {
+			pal[2][c] = (2 * pal[0][c] + pal[1][c]) / 3;
+			pal[3][c] = (pal[0][c] + 2 * pal[1][c]) / 3;
+		}
+		for (i = 0; i < 16; i++) {
+			const unsigned char *p = &block[i * 4];
+			int best = 0, best_dist = INT32_MAX, k;
+			for (k = 0; k < 4; k++) {
+				int dr = p[0] - pal[k][0], dg = p[1] - pal[k][1],
+					db = p[2] - pal[k][2];
+				int dist = dr * dr + dg * dg + db * db;
+				if (dist < best_dist) {
+					best_dist = dist;
+					best = k;
+				}
+			}
+			indices |= (uint32_t)best << (2 * i);
+		}
+	}
+	put16(out, c0);
+	put16(out + 2, c1);
+	put16(out + 4, indices);
+	put16(out + 6, indices >> 16);
+}
+
+/* 8-alpha mode DXT5 alpha block */
+static void alpha_block(unsigned char *out, const unsigned char *block)
+{
+	int lo = 255, hi = 0, i;
+
+	for (i = 0; i < 16; i++) {
+		int a = block[i * 4 + 3];
+		if (a < lo)
+			lo = a;
+		if (a > hi)
+			hi = a;
+	}
+
+	uint64_t indices = 0;
+	if (hi != lo) {
+		int pal[8], k;
+		pal[0] = hi;
+		pal[1] = lo;
+		for (k = 1; k < 7; k++)
+			pal[k + 1] = ((7 - k) * hi + k * lo) / 7;
+		for (i = 0; i < 16; i++) {
+			int a = block[i * 4 + 3], best = 0, best_dist = 256;
+			for (k = 0; k < 8; k++) {
+				int dist = a > pal[k] ? a - pal[k] : pal[k] - a;
+				if (dist < best_dist) {
+					best_dist = dist;
+					best = k;
+				}
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+	}
+	out[0] = hi;
+	out[1] = lo;
+	for (i = 0; i < 6; i++)
+		out[2 + i] = indices >> (8 * i);
+}
+
+/* bytes needed for an image, blocks at the edges are padded */
+size_t dxt_size(int width, int height, bool alpha)
+{
+	size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+	return blocks * (alpha ? DXT5_BLOCK_SIZE : DXT1_BLOCK_SIZE);
+}
+
+/* compress one row of 4x4 blocks, row counts blocks from the top. out
+ * points to where the row starts in the dxt_size() output. rows are
+ * independent so they can be split between threads. */
+void dxt_compress_row(unsigned char *out, const unsigned char *rgba,
+	int width, int height, int row, bool alpha)
+{
+	unsigned char block[16 * 4];
+	int bx, x, y;
+
+	for (bx = 0; bx < (width + 3) / 4; bx++) {
+		/* repeat the last row and column to fill partial blocks */
+		for (y = 0; y < 4; y++) {
+			int sy = row * 4 + y;
+			if (sy >= height)
+				sy = height - 1;
+			for (x = 0; x < 4; x++) {
+				int sx = bx * 4 + x;
+				if (sx >= width)
+					sx = width - 1;
+				memcpy(&block[(y * 4 + x) * 4],
+					&rgba[((size_t)sy * width + sx) * 4], 4);
+			}
+		}
+		if (alpha) {
+			alpha_block(out, block);
+			out += 8;
+		}
+		color_block(out, block);
+		out += 8;
+	}
+}
@@ -0,0 +1,17 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef DXT_H
+#define DXT_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* S3TC block compression of RGBA images. DXT1 keeps 4 bits per pixel and
+ * no alpha, DXT5 keeps 8 bits per pixel with interpolated alpha. */
+#define DXT1_BLOCK_SIZE 8
+#define DXT5_BLOCK_SIZE 16
+
+size_t dxt_size(int width, int height, bool alpha);
+void dxt_compress_row(unsigned char *out, const unsigned char *rgba,
+	int width, int height, int row, bool alpha);
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "frustum.h"
+
+/* clip = proj * modelview (column-major, as GL uses) */
+void frustum_clip_matrix(float clip[16], const float proj[16],
+	const float modelview[16])
+{
+	unsigned i, j;
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			clip[i * 4 + j] =
+				modelview[i * 4 + 0] * proj[0 * 4 + j] +
+				modelview[i * 4 + 1] * proj[1 * 4 + j] +
+				modelview[i * 4 + 2] * proj[2 * 4 + j] +
+				modelview[i * 4 + 3] * proj[3 * 4 + j];
+		}
+	}
+}
+
+/* extract the clip planes of proj * modelview (column-major, as GL uses).
+ * the planes are in the coordinate space that modelview transforms from. */
+void frustum_extract(struct frustum *f, const float proj[16],
+	const float modelview[16])
+{
+	float clip[16];
+	unsigned i, j;
+
+	frustum_clip_matrix(clip, proj, modelview);
+
+	/* plane = row 3 +/- row n, where row n is (clip[n], clip[4+n], ...) */
+	for (i = 0; i < 6; i++) {
+		unsigned row = i / 2;
+		float sign = (i % 2) ? -1.0f : 1.0f;
+		float *p = f->plane[i];
+		for (j = 0; j < 4; j++)
+			p[j] = clip[j * 4 + 3] + sign * clip[j * 4 + row];
+		float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		if (len > 0.0f) {
+			for (j = 0; j < 4; j++)
+				p[j] /= len;
+		}
+	}
+}
+
+/* extract the frustum from the current GL projection and modelview.
+ * clip gets proj * modelview if it isn't NULL. */
+void frustum_from_gl(struct frustum *f, float clip[16])
+{
+	GLfloat proj[16], modelview[16];
+
+	glGetFloatv(GL_PROJECTION_MATRIX, proj);
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	frustum_extract(f, proj, modelview);
+	if (clip)
+		frustum_clip_matrix(clip, proj, modelview);
+}
+
+/* move the planes of src into the space that m transforms from.
+ * ex: src in world space and m is a model's matrix, dst is in model space. */
+void frustum_transform(struct frustum *dst, const struct frustum *src,
+	const float m[16])
+{
+	struct frustum tmp;
+	unsigned i, j;
+
+	for (i = 0; i < 6; i++) {
+		const float *p = src->plane[i];
+		for (j = 0; j < 4; j++) {
+			tmp.plane[i][j] = p[0] * m[j * 4 + 0] +
+				p[1] * m[j * 4 + 1] + p[2] * m[j * 4 + 2] +
+				p[3] * m[j * 4 + 3];
+		}
+	}
+	*dst = tmp;
+}
+
+/* test the box corner furthest along each plane's normal. */
+bool frustum_test_aabb(const struct frustum *f, const float min[3],
+	const float max[3])
+{
+	unsigned i;
+
+	if (min[0] > max[0] || min[1] > max[1] || min[2] > max[2])
+		return true; /* empty or unknown bounds - don't cull */
+
+	for (i = 0; i < 6; i++) {
+		const float *p = f->plane[i];
+		float x = p[0] >= 0.0f ? max[0] : min[0];
+		float y = p[1] >= 0.0f ? max[1] : min[1];
+		float z = p[2] >= 0.0f ? max[2] : min[2];
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+/* cull n spheres stored as separate x, y, z and radius arrays.
+ * planes must be normalized (as frustum_extract() leaves them).
+ * sets visible[i] to 0 or 1, returns the number of visible spheres. */
+unsigned frustum_cull_spheres(const struct frustum *f, unsigned n,
+	const float *x, const float *y, const float *z, const float *r,
+	unsigned char *visible, struct cull_stats *stats)
+{
+	unsigned i = 0, j, count = 0;
+
+#if defined(__SSE__)
+	/* four spheres per iteration, one plane at a time */
+	for (; i + 4 <= n; i += 4) {
+		__m128 sx = _mm_loadu_ps(x + i);
+		__m128 sy = _mm_loadu_ps(y + i);
+		__m128 sz = _mm_loadu_ps(z + i);
+		__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+		__m128 outside = _mm_setzero_ps();
+		for (j = 0; j < 6; j++) {
+			const float *p = f->plane[j];
+			__m128 d = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(p[0])),
+					_mm_mul_ps(sy, _mm_set1_ps(p[1]))),
+				_mm_add_ps(_mm_mul_ps(sz, _mm_set1_ps(p[2])),
+					_mm_set1_ps(p[3])));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(d, neg_r));
+		}
+		int mask = _mm_movemask_ps(outside);
+		for (j = 0; j < 4; j++) {
+			visible[i + j] = !(mask & (1 << j));
+			count += visible[i + j];
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		visible[i] = 1;
+		for (j = 0; j < 6; j++) {
+			const float *p = f->plane[j];
+			float d = p[0] * x[i] + p[1] * y[i] + p[2] * z[i] + p[3];
+			if (d < -r[i]) {
+				visible[i] = 0;
+				break;
+			}
+		}
+		count += visible[i];
+	}
+
+	if (stats) {
+		stats->tested += n;
+		stats->culled_sphere += n - count;
+	}
+	return count;
+}
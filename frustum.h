@@ -0,0 +1,37 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+#include <stdbool.h>
+
+/* six clip planes (a, b, c, d): left, right, bottom, top, near, far.
+ * a point is inside when a*x + b*y + c*z + d >= 0 for every plane. */
+struct frustum {
+	float plane[6][4];
+};
+
+/* counters updated by the culling routines, reset by the caller. */
+struct cull_stats {
+	unsigned tested; /* sprites considered */
+	unsigned culled_sphere; /* rejected by the bounding sphere pass */
+	unsigned culled_box; /* rejected by the model's bounding box */
+	unsigned visible; /* passed the frustum tests */
+	unsigned occluded; /* inside the frustum but hidden by an occlusion query */
+	/* objects of the visible sprites, each tested against its own box */
+	unsigned objects_tested, objects_culled;
+};
+
+void frustum_clip_matrix(float clip[16], const float proj[16],
+	const float modelview[16]);
+void frustum_extract(struct frustum *f, const float proj[16],
+	const float modelview[16]);
+void frustum_from_gl(struct frustum *f, float clip[16]);
+void frustum_transform(struct frustum *dst, const struct frustum *src,
+	const float m[16]);
+bool frustum_test_aabb(const struct frustum *f, const float min[3],
+	const float max[3]);
+unsigned frustum_cull_spheres(const struct frustum *f, unsigned n,
+	const float *x, const float *y, const float *z, const float *r,
+	unsigned char *visible, struct cull_stats *stats);
+#endif
@@ -0,0 +1,28 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <SDL.h>
+#include <GL/gl.h>
+#include "glcaps.h"
+
+/* true if the current context is at least version major.minor */
+bool gl_has_version(int major, int minor)
+{
+	static int cur_major = -1, cur_minor;
+
+	if (cur_major < 0) {
+		const char *version = (const char*)glGetString(GL_VERSION);
+		if (!version || sscanf(version, "%d.%d", &cur_major, &cur_minor) != 2) {
+			cur_major = 0;
+			cur_minor = 0;
+		}
+	}
+	return cur_major > major || (cur_major == major && cur_minor >= minor);
+}
+
+bool gl_has_extension(const char *name)
+{
+	return SDL_GL_ExtensionSupported(name);
+}
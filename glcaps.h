@@ -0,0 +1,9 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef GLCAPS_H
+#define GLCAPS_H
+#include <stdbool.h>
+bool gl_has_version(int major, int minor);
+bool gl_has_extension(const char *name);
+#endif
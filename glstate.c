@@ -0,0 +1,319 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "glstate.h"
+#include "material.h"
+
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof *(a))
+
+#define MAX_UNITS 2 /* texture units we track bindings for */
+#define UNKNOWN (-1)
+
+/* a cached vector, only trusted when valid is set */
+struct cached4 {
+	bool valid;
+	GLfloat v[4];
+};
+
+struct cached1 {
+	bool valid;
+	GLfloat v;
+};
+
+enum material_param {
+	MAT_AMBIENT, MAT_DIFFUSE, MAT_SPECULAR, MAT_EMISSION, MAT_MAX
+};
+
+enum light_param {
+	LIGHT_AMBIENT, LIGHT_DIFFUSE, LIGHT_SPECULAR, LIGHT_VECTOR_MAX
+};
+
+/* capabilities we track, anything else is passed straight through */
+static const GLenum caps[] = {
+	GL_TEXTURE_2D, GL_LIGHTING, GL_DEPTH_TEST, GL_CULL_FACE, GL_NORMALIZE,
+	GL_SCISSOR_TEST, GL_STENCIL_TEST, GL_BLEND,
+	GL_LIGHT0, GL_LIGHT1, GL_LIGHT2, GL_LIGHT3,
+	GL_LIGHT4, GL_LIGHT5, GL_LIGHT6, GL_LIGHT7,
+};
+
+/* texture targets we track */
+static const GLenum targets[] = {
+	GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY_EXT,
+};
+
+static struct {
+	signed char enabled[ARRAY_SIZE(caps)]; /* 0, 1 or UNKNOWN */
+	GLint texture[MAX_UNITS][ARRAY_SIZE(targets)]; /* UNKNOWN or name */
+	GLint active_texture; /* UNKNOWN or unit number */
+	GLint matrix_mode, depth_func, cull_face, shade_model, program;
+	struct cached4 color;
+	struct cached4 material[2][MAT_MAX]; /* front and back */
+	struct cached1 shininess[2];
+	struct cached4 light[MAX_LIGHTS][LIGHT_VECTOR_MAX];
+	struct glstate_stats stats;
+} cur;
+
+/* forget everything, the next call of each kind always reaches GL. */
+void glstate_reset(void)
+{
+	struct glstate_stats stats = cur.stats;
+	unsigned i, j;
+
+	memset(&cur, 0, sizeof(cur));
+	for (i = 0; i < ARRAY_SIZE(cur.enabled); i++)
+		cur.enabled[i] = UNKNOWN;
+	for (i = 0; i < MAX_UNITS; i++)
+		for (j = 0; j < ARRAY_SIZE(targets); j++)
+			cur.texture[i][j] = UNKNOWN;
+	cur.active_texture = UNKNOWN;
+	cur.matrix_mode = UNKNOWN;
+	cur.depth_func = UNKNOWN;
+	cur.cull_face = UNKNOWN;
+	cur.shade_model = UNKNOWN;
+	cur.program = UNKNOWN;
+	cur.stats = stats;
+}
+
+static int cap_index(GLenum cap)
+{
+	unsigned i;
+	for (i = 0; i < ARRAY_SIZE(caps); i++)
+		if (caps[i] == cap)
+			return i;
+	return -1;
+}
+
+/* returns true if the call should be forwarded, and updates the counters */
+static inline bool changed(bool differs)
+{
+	if (differs)
+		cur.stats.issued++;
+	else
+		cur.stats.elided++;
+	return differs;
+}
+
+static bool set_enabled(GLenum cap, signed char on)
+{
+	int i = cap_index(cap);
+	if (i < 0)
+		return changed(true);
+	if (!changed(cur.enabled[i] != on))
+		return false;
+	cur.enabled[i] = on;
+	return true;
+}
+
+void glstate_enable(GLenum cap)
+{
+	if (set_enabled(cap, 1))
+		glEnable(cap);
+}
+
+void glstate_disable(GLenum cap)
+{
+	if (set_enabled(cap, 0))
+		glDisable(cap);
+}
+
+/* unit is GL_TEXTURE0 + n */
+void glstate_active_texture(GLenum unit)
+{
+	if (!changed(cur.active_texture != (GLint)(unit - GL_TEXTURE0)))
+		return;
+	cur.active_texture = unit - GL_TEXTURE0;
+	glActiveTexture(unit);
+}
+
+/* binds to the active unit, which is assumed to be unit 0 until
+ * glstate_active_texture() says otherwise. */
+void glstate_bind_texture(GLenum target, GLuint texture)
+{
+	unsigned unit = cur.active_texture == UNKNOWN ? 0 : cur.active_texture;
+	unsigned i;
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		if (targets[i] == target)
+			break;
+	}
+	if (i < ARRAY_SIZE(targets) && unit < MAX_UNITS) {
+		if (!changed(cur.texture[unit][i] != (GLint)texture))
+			return;
+		cur.texture[unit][i] = texture;
+	} else {
+		changed(true);
+	}
+	glBindTexture(target, texture);
+}
+
+static bool set_enum(GLint *slot, GLenum value)
+{
+	if (!changed(*slot != (GLint)value))
+		return false;
+	*slot = value;
+	return true;
+}
+
+void glstate_matrix_mode(GLenum mode)
+{
+	if (set_enum(&cur.matrix_mode, mode))
+		glMatrixMode(mode);
+}
+
+void glstate_use_program(GLuint program)
+{
+	if (set_enum(&cur.program, program))
+		glUseProgram(program);
+}
+
+void glstate_depth_func(GLenum func)
+{
+	if (set_enum(&cur.depth_func, func))
+		glDepthFunc(func);
+}
+
+void glstate_cull_face(GLenum mode)
+{
+	if (set_enum(&cur.cull_face, mode))
+		glCullFace(mode);
+}
+
+void glstate_shade_model(GLenum mode)
+{
+	if (set_enum(&cur.shade_model, mode))
+		glShadeModel(mode);
+}
+
+static bool set4(struct cached4 *c, const GLfloat *v)
+{
+	if (!changed(!c->valid || memcmp(c->v, v, sizeof(c->v))))
+		return false;
+	c->valid = true;
+	memcpy(c->v, v, sizeof(c->v));
+	return true;
+}
+
+void glstate_color4fv(const GLfloat *c)
+{
+	if (set4(&cur.color, c))
+		glColor4fv(c);
+}
+
+static int material_index(GLenum pname)
+{
+	switch (pname) {
+	case GL_AMBIENT: return MAT_AMBIENT;
+	case GL_DIFFUSE: return MAT_DIFFUSE;
+	case GL_SPECULAR: return MAT_SPECULAR;
+	case GL_EMISSION: return MAT_EMISSION;
+	}
+	return -1;
+}
+
+/* update the cache for one face, true if it was different */
+static bool material_face(unsigned face, GLenum pname, const GLfloat *params)
+{
+	struct cached4 *c = cur.material[face];
+	int i = material_index(pname);
+	if (i >= 0)
+		return !c[i].valid || memcmp(c[i].v, params, sizeof(c[i].v));
+	/* GL_AMBIENT_AND_DIFFUSE or something we don't cache */
+	return true;
+}
+
+static void material_store(unsigned face, GLenum pname, const GLfloat *params)
+{
+	struct cached4 *c = cur.material[face];
+	int i = material_index(pname);
+	if (i >= 0) {
+		c[i].valid = true;
+		memcpy(c[i].v, params, sizeof(c[i].v));
+	} else if (pname == GL_AMBIENT_AND_DIFFUSE) {
+		material_store(face, GL_AMBIENT, params);
+		material_store(face, GL_DIFFUSE, params);
+	}
+}
+
+void glstate_materialfv(GLenum face, GLenum pname, const GLfloat *params)
+{
+	bool front = face == GL_FRONT || face == GL_FRONT_AND_BACK;
+	bool back = face == GL_BACK || face == GL_FRONT_AND_BACK;
+	bool differs = false;
+
+	if (pname == GL_SHININESS) {
+		glstate_materialf(face, pname, params[0]);
+		return;
+	}
+	if (front)
+		differs |= material_face(0, pname, params);
+	if (back)
+		differs |= material_face(1, pname, params);
+	if (!changed(differs))
+		return;
+	if (front)
+		material_store(0, pname, params);
+	if (back)
+		material_store(1, pname, params);
+	glMaterialfv(face, pname, params);
+}
+
+void glstate_materialf(GLenum face, GLenum pname, GLfloat param)
+{
+	bool front = face == GL_FRONT || face == GL_FRONT_AND_BACK;
+	bool back = face == GL_BACK || face == GL_FRONT_AND_BACK;
+
+	if (pname != GL_SHININESS) {
+		changed(true);
+		glMaterialf(face, pname, param);
+		return;
+	}
+	bool differs =
+		(front && (!cur.shininess[0].valid || cur.shininess[0].v != param)) ||
+		(back && (!cur.shininess[1].valid || cur.shininess[1].v != param));
+	if (!changed(differs))
+		return;
+	if (front) {
+		cur.shininess[0].valid = true;
+		cur.shininess[0].v = param;
+	}
+	if (back) {
+		cur.shininess[1].valid = true;
+		cur.shininess[1].v = param;
+	}
+	glMaterialf(face, pname, param);
+}
+
+/* GL_POSITION and GL_SPOT_DIRECTION are transformed by the modelview
+ * matrix when they are set, so they are always forwarded. */
+void glstate_lightfv(GLenum light, GLenum pname, const GLfloat *params)
+{
+	unsigned n = light - GL_LIGHT0;
+	int i = -1;
+
+	switch (pname) {
+	case GL_AMBIENT: i = LIGHT_AMBIENT; break;
+	case GL_DIFFUSE: i = LIGHT_DIFFUSE; break;
+	case GL_SPECULAR: i = LIGHT_SPECULAR; break;
+	}
+	if (n >= MAX_LIGHTS || i < 0) {
+		changed(true);
+		glLightfv(light, pname, params);
+		return;
+	}
+	if (set4(&cur.light[n][i], params))
+		glLightfv(light, pname, params);
+}
+
+const struct glstate_stats *glstate_stats(void)
+{
+	return &cur.stats;
+}
+
+void glstate_stats_reset(void)
+{
+	memset(&cur.stats, 0, sizeof(cur.stats));
+}
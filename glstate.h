@@ -0,0 +1,33 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+/* shadow copy of GL state, calls that would not change anything are
+ * dropped instead of being sent to the driver.
+ * must not be used while compiling a display list, and glstate_reset()
+ * must be called after anything changes GL state behind its back. */
+
+struct glstate_stats {
+	unsigned issued; /* calls forwarded to GL */
+	unsigned elided; /* calls dropped because nothing changed */
+};
+
+void glstate_reset(void);
+void glstate_enable(GLenum cap);
+void glstate_disable(GLenum cap);
+void glstate_active_texture(GLenum unit);
+void glstate_bind_texture(GLenum target, GLuint texture);
+void glstate_matrix_mode(GLenum mode);
+void glstate_use_program(GLuint program);
+void glstate_color4fv(const GLfloat *c);
+void glstate_materialfv(GLenum face, GLenum pname, const GLfloat *params);
+void glstate_materialf(GLenum face, GLenum pname, GLfloat param);
+void glstate_lightfv(GLenum light, GLenum pname, const GLfloat *params);
+void glstate_depth_func(GLenum func);
+void glstate_cull_face(GLenum mode);
+void glstate_shade_model(GLenum mode);
+const struct glstate_stats *glstate_stats(void);
+void glstate_stats_reset(void);
+#endif
@@ -0,0 +1,220 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <SDL.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "glcaps.h"
+#include "gputimer.h"
+
+/* queries in flight per pass. a pass is skipped for a frame rather than
+ * waiting on a query that is still in use. */
+#define GPUTIMER_RING 4
+/* results kept per pass for the statistics */
+#define GPUTIMER_HISTORY 128
+
+static const char *pass_names[GPU_PASS_MAX] = {
+	[GPU_PASS_CLEAR] = "clear",
+	[GPU_PASS_SECTORS] = "sectors",
+	[GPU_PASS_MODELS] = "models",
+	[GPU_PASS_SWAP] = "swap",
+};
+
+struct pass_timer {
+	GLuint ids[GPUTIMER_RING];
+	bool pending[GPUTIMER_RING];
+	unsigned head; /* next slot to use */
+	unsigned dropped; /* scopes skipped because the ring was full */
+	bool warm; /* the first result is thrown away */
+	uint64_t history[GPUTIMER_HISTORY]; /* nanoseconds */
+	unsigned num_history, next_history;
+};
+
+static struct {
+	bool supported;
+	int active; /* pass with a query running, or -1 */
+	/* ARB_timer_query and EXT_timer_query name this differently */
+	PFNGLGETQUERYOBJECTUI64VPROC get_result;
+	struct pass_timer pass[GPU_PASS_MAX];
+} timer = { .active = -1 };
+
+/* returns false if timer queries are not available, the other calls are
+ * then harmless no-ops. */
+bool gputimer_init(void)
+{
+	unsigned i;
+
+	memset(&timer, 0, sizeof(timer));
+	timer.active = -1;
+	if (gl_has_version(3, 3) || gl_has_extension("GL_ARB_timer_query")) {
+		timer.get_result = (PFNGLGETQUERYOBJECTUI64VPROC)
+			SDL_GL_GetProcAddress("glGetQueryObjectui64v");
+	} else if (gl_has_extension("GL_EXT_timer_query")) {
+		timer.get_result = (PFNGLGETQUERYOBJECTUI64VPROC)
+			SDL_GL_GetProcAddress("glGetQueryObjectui64vEXT");
+	}
+	if (!timer.get_result || !gl_has_version(1, 5)) {
+		warn("GPU timer queries are not supported\n");
+		return false;
+	}
+	for (i = 0; i < GPU_PASS_MAX; i++)
+		glGenQueries(GPUTIMER_RING, timer.pass[i].ids);
+	timer.supported = true;
+	return true;
+}
+
+void gputimer_free(void)
+{
+	unsigned i;
+
+	if (!timer.supported)
+		return;
+	for (i = 0; i < GPU_PASS_MAX; i++)
+		glDeleteQueries(GPUTIMER_RING, timer.pass[i].ids);
+	memset(&timer, 0, sizeof(timer));
+	timer.active = -1;
+}
+
+/* start timing a pass. only one pass can be timed at a time. */
+void gputimer_begin(enum gpu_pass pass)
+{
+	if (!timer.supported || timer.active >= 0 || pass >= GPU_PASS_MAX)
+		return;
+	struct pass_timer *p = &timer.pass[pass];
+	if (p->pending[p->head]) {
+		p->dropped++;
+		return;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, p->ids[p->head]);
+	timer.active = pass;
+}
+
+void gputimer_end(enum gpu_pass pass)
+{
+	if (timer.active != (int)pass)
+		return;
+	struct pass_timer *p = &timer.pass[pass];
+	glEndQuery(GL_TIME_ELAPSED);
+	p->pending[p->head] = true;
+	p->head = (p->head + 1) % GPUTIMER_RING;
+	timer.active = -1;
+}
+
+/* pick up every finished query without waiting, call once per frame. */
+void gputimer_collect(void)
+{
+	unsigned i, j;
+
+	if (!timer.supported)
+		return;
+	for (i = 0; i < GPU_PASS_MAX; i++) {
+		struct pass_timer *p = &timer.pass[i];
+		/* oldest first, so history stays in order */
+		for (j = 0; j < GPUTIMER_RING; j++) {
+			unsigned slot = (p->head + j) % GPUTIMER_RING;
+			if (!p->pending[slot])
+				continue;
+			GLuint available = 0;
+			glGetQueryObjectuiv(p->ids[slot],
+				GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break; /* later ones can't be done either */
+			GLuint64 ns = 0;
+			timer.get_result(p->ids[slot], GL_QUERY_RESULT, &ns);
+			p->pending[slot] = false;
+			/* the first frame pays for driver warm up (and some
+			 * drivers report nonsense for it) */
+			if (!p->warm) {
+				p->warm = true;
+				continue;
+			}
+			p->history[p->next_history] = ns;
+			p->next_history = (p->next_history + 1) % GPUTIMER_HISTORY;
+			if (p->num_history < GPUTIMER_HISTORY)
+				p->num_history++;
+		}
+	}
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* false if there are no results for this pass yet */
+bool gputimer_stats(enum gpu_pass pass, struct gputimer_stats *out)
+{
+	uint64_t sorted[GPUTIMER_HISTORY];
+	unsigned i;
+
+	memset(out, 0, sizeof(*out));
+	if (pass >= GPU_PASS_MAX)
+		return false;
+	const struct pass_timer *p = &timer.pass[pass];
+	unsigned n = p->num_history;
+	if (!n)
+		return false;
+	memcpy(sorted, p->history, n * sizeof(*sorted));
+	qsort(sorted, n, sizeof(*sorted), compare_u64);
+	uint64_t total = 0;
+	for (i = 0; i < n; i++)
+		total += sorted[i];
+	out->samples = n;
+	out->min = sorted[0] / 1e6;
+	out->avg = total / (double)n / 1e6;
+	out->p99 = sorted[(n * 99 + 99) / 100 - 1] / 1e6;
+	return true;
+}
+
+/* one line summary for an overlay: "pass avg/p99 ..." in milliseconds.
+ * returns the length snprintf() would have written. */
+int gputimer_format(char *buf, size_t len)
+{
+	struct gputimer_stats s;
+	unsigned i;
+	int total = 0;
+
+	if (len)
+		buf[0] = 0;
+	if (!timer.supported)
+		return snprintf(buf, len, "GPU timing unavailable");
+	for (i = 0; i < GPU_PASS_MAX; i++) {
+		if (!gputimer_stats(i, &s))
+			continue;
+		size_t used = (size_t)total < len ? (size_t)total : len;
+		total += snprintf(buf + used, len - used, "%s%s %.2f/%.2f",
+			total ? " " : "", pass_names[i], s.avg, s.p99);
+	}
+	if (total) {
+		size_t used = (size_t)total < len ? (size_t)total : len;
+		total += snprintf(buf + used, len - used, " ms");
+	}
+	return total;
+}
+
+/* log min/avg/p99 of every pass */
+void gputimer_dump(void)
+{
+	struct gputimer_stats s;
+	unsigned i;
+
+	if (!timer.supported)
+		return;
+	for (i = 0; i < GPU_PASS_MAX; i++) {
+		if (!gputimer_stats(i, &s)) {
+			info("gpu %-8s no results\n", pass_names[i]);
+			continue;
+		}
+		info("gpu %-8s min=%.3f avg=%.3f p99=%.3f ms samples=%u dropped=%u\n",
+			pass_names[i], s.min, s.avg, s.p99, s.samples,
+			timer.pass[i].dropped);
+	}
+}
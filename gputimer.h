@@ -0,0 +1,32 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* GPU time spent in each stage of a frame, measured with timer queries. */
+enum gpu_pass {
+	GPU_PASS_CLEAR,
+	GPU_PASS_SECTORS,
+	GPU_PASS_MODELS,
+	GPU_PASS_SWAP,
+	GPU_PASS_MAX
+};
+
+/* in milliseconds, over the last GPUTIMER_HISTORY results */
+struct gputimer_stats {
+	unsigned samples;
+	double min, avg, p99;
+};
+
+bool gputimer_init(void);
+void gputimer_free(void);
+void gputimer_begin(enum gpu_pass pass);
+void gputimer_end(enum gpu_pass pass);
+void gputimer_collect(void);
+bool gputimer_stats(enum gpu_pass pass, struct gputimer_stats *out);
+int gputimer_format(char *buf, size_t len);
+void gputimer_dump(void);
+#endif
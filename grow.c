@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "grow.h"
+
+/* ptr must be a pointer to a pointer. void**, int**, etc. */
+int grow(void *ptr, unsigned *max, unsigned min, size_t elem)
+{
+	/* the formula below can't handle large min. */
+	if (min > INT_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t old_size = *max * elem;
+	size_t new_size = min * elem;
+
+	/* round up to next power of 2 (limited to 32-bits) */
+	new_size--;
+	new_size |= new_size >> 1;
+	new_size |= new_size >> 2;
+	new_size |= new_size >> 4;
+	new_size |= new_size >> 8;
+	new_size |= new_size >> 16;
+	new_size++;
+
+	unsigned tmpmax = new_size / elem;
+	new_size = tmpmax * elem;
+	if (new_size <= old_size)
+		return 0; /* no need to grow this one */
+
+	void *p = realloc(*(void**)ptr, new_size);
+	if (!p)
+		return -1;
+	memset((char*)p + old_size, 0, new_size - old_size);
+	*max = tmpmax;
+	*(void**)ptr = p;
+	return 0;
+}
+
+/* path with its extension replaced by ext, or ext added if it has none.
+ * "maps/e1.map" and ".hmap" gives "maps/e1.hmap". free() the result,
+ * NULL if out of memory. */
+char *replace_ext(const char *path, const char *ext)
+{
+	size_t len = strlen(path);
+	const char *dot = strrchr(path, '.');
+	if (dot && !strchr(dot, '/'))
+		len = dot - path;
+	char *name = malloc(len + strlen(ext) + 1);
+	if (!name)
+		return NULL;
+	memcpy(name, path, len);
+	strcpy(name + len, ext);
+	return name;
+}
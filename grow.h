@@ -0,0 +1,9 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef GROW_H
+#define GROW_H
+#include <stddef.h>
+int grow(void *ptr, unsigned *max, unsigned min, size_t elem);
+char *replace_ext(const char *path, const char *ext);
+#endif
@@ -0,0 +1,344 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+/* hero-mapc - compile a text map description into the binary map format
+ * that the game maps straight into memory.
+ *
+ * one command per line, # starts a comment:
+ *   texture path
+ *   start sector
+ *   sector floor_height ceil_height floor_texture ceil_texture
+ *   wall x y texture [portal]
+ * walls belong to the sector above them, clockwise on the map's x,y plane
+ * with the sector to the right of each wall. a wall is the side that ends
+ * at x,y, and portal is the sector on the other side.
+ * sectors and textures are numbered from 0 in the order they appear.
+ *
+ * the potentially visible set of every sector is built on all cores and
+ * stored with the map, unless -pvs-depth is 0. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "logging.h"
+#include "grow.h"
+#include "map.h"
+#include "pvs.h"
+#include "threadpool.h"
+
+static struct {
+	unsigned pvs_depth; /* portals to look through, 0 for no PVS */
+	unsigned threads; /* 0 for one per CPU */
+	const char *output; /* only with a single input */
+} config = {
+	.pvs_depth = 16,
+};
+
+struct builder {
+	struct map_header header;
+	struct map_sector *sectors;
+	unsigned max_sectors;
+	struct map_wall *walls;
+	unsigned max_walls;
+	struct map_vertex *vertices;
+	unsigned max_vertices;
+	struct map_texture *textures;
+	unsigned max_textures;
+	/* vertex indexes + 1 by position, so shared corners are stored once */
+	uint32_t *hash;
+	unsigned hash_size;
+};
+
+/* FNV-1a */
+static uint32_t vertex_hash(const struct map_vertex *v)
+{
+	const unsigned char *p = (const unsigned char*)v;
+	uint32_t h = 2166136261u;
+	unsigned i;
+
+	for (i = 0; i < sizeof(*v); i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int hash_grow(struct builder *b)
+{
+	unsigned size = b->hash_size ? b->hash_size * 2 : 256;
+	uint32_t *hash = calloc(size, sizeof(*hash));
+	unsigned i;
+
+	if (!hash)
+		return -1;
+	for (i = 0; i < b->header.num_vertices; i++) {
+		unsigned j = vertex_hash(&b->vertices[i]) & (size - 1);
+		while (hash[j])
+			j = (j + 1) & (size - 1);
+		hash[j] = i + 1;
+	}
+	free(b->hash);
+	b->hash = hash;
+	b->hash_size = size;
+	return 0;
+}
+
+/* index of the vertex at x,y, added if it is new. -1 on error. */
+static long vertex_add(struct builder *b, float x, float y)
+{
+	struct map_vertex v = { x, y };
+
+	if (b->header.num_vertices * 2 >= b->hash_size && hash_grow(b))
+		return -1;
+	unsigned mask = b->hash_size - 1, i = vertex_hash(&v) & mask;
+	for (; b->hash[i]; i = (i + 1) & mask) {
+		const struct map_vertex *o = &b->vertices[b->hash[i] - 1];
+		if (o->x == x && o->y == y)
+			return b->hash[i] - 1;
+	}
+	unsigned n = b->header.num_vertices;
+	if (grow(&b->vertices, &b->max_vertices, n + 1, sizeof(*b->vertices)))
+		return -1;
+	b->vertices[n] = v;
+	b->hash[i] = n + 1;
+	b->header.num_vertices = n + 1;
+	return n;
+}
+
+/* parse one line, -1 on error */
+static int command(struct builder *b, char *line)
+{
+	struct map_header *h = &b->header;
+	char path[MAP_PATH_MAX + 1];
+	float x, y, floor_height, ceil_height;
+	unsigned floor_texture, ceil_texture, texture, portal, n;
+	int end = 0;
+
+	line[strcspn(line, "#\r\n")] = 0;
+	line += strspn(line, " \t");
+	if (!*line)
+		return 0; /* blank */
+	if (sscanf(line, " texture %64s %n", path, &end) == 1 && !line[end]) {
+		n = h->num_textures;
+		if (strlen(path) >= MAP_PATH_MAX) {
+			error("texture path is longer than %d\n",
+				MAP_PATH_MAX - 1);
+			return -1;
+		}
+		if (grow(&b->textures, &b->max_textures, n + 1,
+			sizeof(*b->textures)))
+			return -1;
+		memset(&b->textures[n], 0, sizeof(b->textures[n]));
+		strcpy(b->textures[n].path, path);
+		h->num_textures = n + 1;
+		return 0;
+	}
+	if (sscanf(line, " start %u %n", &h->start_sector, &end) == 1 &&
+		!line[end])
+		return 0;
+	if (sscanf(line, " sector %f %f %u %u %n", &floor_height, &ceil_height,
+		&floor_texture, &ceil_texture, &end) == 4 && !line[end]) {
+		n = h->num_sectors;
+		if (floor_texture > UINT16_MAX || ceil_texture > UINT16_MAX)
+			return -1;
+		if (grow(&b->sectors, &b->max_sectors, n + 1,
+			sizeof(*b->sectors)))
+			return -1;
+		b->sectors[n] = (struct map_sector){
+			.first_wall = h->num_walls,
+			.floor_height = floor_height,
+			.ceil_height = ceil_height,
+			.floor_texture = floor_texture,
+			.ceil_texture = ceil_texture,
+		};
+		h->num_sectors = n + 1;
+		return 0;
+	}
+	portal = MAP_NONE;
+	int fields = sscanf(line, " wall %f %f %u %u %n", &x, &y, &texture,
+		&portal, &end);
+	if (fields == 3)
+		fields = sscanf(line, " wall %f %f %u %n", &x, &y, &texture,
+			&end);
+	if ((fields == 3 || fields == 4) && !line[end]) {
+		if (!h->num_sectors) {
+			error("wall before the first sector\n");
+			return -1;
+		}
+		if (texture > UINT16_MAX)
+			return -1;
+		long v = vertex_add(b, x, y);
+		n = h->num_walls;
+		if (v < 0 || grow(&b->walls, &b->max_walls, n + 1,
+			sizeof(*b->walls)))
+			return -1;
+		b->walls[n] = (struct map_wall){ v, portal, texture };
+		b->sectors[h->num_sectors - 1].num_walls++;
+		h->num_walls = n + 1;
+		return 0;
+	}
+	error("unknown command\n");
+	return -1;
+}
+
+/* twice the signed area of a sector on the map's x,y, negative when its
+ * walls are in the right order */
+static double area(const struct builder *b, const struct map_sector *sec)
+{
+	const struct map_vertex *a, *v;
+	double total = 0.0;
+	unsigned i;
+
+	a = &b->vertices[b->walls[sec->first_wall + sec->num_walls - 1].vertex];
+	for (i = 0; i < sec->num_walls; i++) {
+		v = &b->vertices[b->walls[sec->first_wall + i].vertex];
+		total += (double)a->x * v->y - (double)v->x * a->y;
+		a = v;
+	}
+	return total;
+}
+
+/* references are checked here so the game doesn't have to */
+static int check(const struct builder *b)
+{
+	const struct map_header *h = &b->header;
+	unsigned i;
+
+	if (h->start_sector >= h->num_sectors) {
+		error("start sector %u doesn't exist\n", h->start_sector);
+		return -1;
+	}
+	for (i = 0; i < h->num_sectors; i++) {
+		const struct map_sector *sec = &b->sectors[i];
+		if (sec->num_walls < 3)
+			warn("sector %u has %u walls\n", i, sec->num_walls);
+		else if (area(b, sec) > 0.0)
+			warn("sector %u has its walls in the wrong order\n", i);
+		if (sec->floor_texture >= h->num_textures ||
+			sec->ceil_texture >= h->num_textures) {
+			error("sector %u uses a missing texture\n", i);
+			return -1;
+		}
+	}
+	for (i = 0; i < h->num_walls; i++) {
+		const struct map_wall *wall = &b->walls[i];
+		if (wall->texture >= h->num_textures) {
+			error("wall %u uses a missing texture\n", i);
+			return -1;
+		}
+		if (wall->portal != MAP_NONE && wall->portal >= h->num_sectors) {
+			error("wall %u leads to missing sector %u\n", i,
+				wall->portal);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int compile(struct threadpool *pool, const char *input,
+	const char *output)
+{
+	struct builder b;
+	struct map_pvs pvs;
+	char line[256];
+	unsigned lineno = 0;
+	int ret = -1;
+
+	memset(&b, 0, sizeof(b));
+	memset(&pvs, 0, sizeof(pvs));
+	FILE *f = fopen(input, "r");
+	if (!f) {
+		error("%s:unable to open\n", input);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (command(&b, line)) {
+			error("%s:%u:bad line\n", input, lineno);
+			goto out;
+		}
+	}
+	if (ferror(f)) {
+		error("%s:read error\n", input);
+		goto out;
+	}
+	if (check(&b))
+		goto out;
+	if (config.pvs_depth && pvs_build(pool, &b.header, b.sectors, b.walls,
+		b.vertices, config.pvs_depth, &pvs))
+		goto out;
+	ret = map_write(&b.header, b.sectors, b.walls, b.vertices,
+		b.textures, config.pvs_depth ? &pvs : NULL, output);
+	if (!ret)
+		info("%s: %u sectors, %u walls, %u vertices, %u textures\n",
+			output, b.header.num_sectors, b.header.num_walls,
+			b.header.num_vertices, b.header.num_textures);
+out:
+	fclose(f);
+	free(b.sectors);
+	free(b.walls);
+	free(b.vertices);
+	free(b.textures);
+	free(b.hash);
+	pvs_free(&pvs);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "%s [-pvs-depth n] [-threads n] [-o output] map...\n",
+		argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int i, num_inputs = 0, ret = EXIT_SUCCESS;
+
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
+	for (i = 1; i < argc; ) {
+		const char *cur = argv[i++];
+
+		if (cur[0] != '-') {
+			argv[++num_inputs] = (char*)cur;
+			continue;
+		}
+		if (!strcmp(cur, "-help") || !strcmp(cur, "-h") || i >= argc)
+			usage(argv[0]);
+		const char *arg = argv[i++];
+		if (!strcmp(cur, "-pvs-depth")) {
+			if (sscanf(arg, "%u", &config.pvs_depth) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-threads")) {
+			if (sscanf(arg, "%u", &config.threads) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-o")) {
+			config.output = arg;
+		} else {
+			fprintf(stderr, "ERROR unknown option %s\n", cur);
+			usage(argv[0]);
+		}
+	}
+	if (!num_inputs || (config.output && num_inputs > 1))
+		usage(argv[0]);
+
+	/* the main thread does its share of the work, so 1 means no workers */
+	struct threadpool *pool = NULL;
+	if (config.threads != 1 && config.pvs_depth)
+		pool = threadpool_new(config.threads ? config.threads - 1 : 0);
+	for (i = 1; i <= num_inputs; i++) {
+		char *output = config.output ? strdup(config.output) :
+			replace_ext(argv[i], MAP_EXT);
+		if (!output || compile(pool, argv[i], output))
+			ret = EXIT_FAILURE;
+		free(output);
+	}
+	threadpool_free(pool);
+	return ret;
+}
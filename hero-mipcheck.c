@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+/* hero-mipcheck - checks that the SSE2 and AVX2 2x2 downsample in mipmap.c
+ * gives exactly the same bytes as the scalar box filter, on random images
+ * of many sizes, and that whole mip chains match one built with only the
+ * scalar filter.
+ *
+ * mipmap.c is included so its static filters can be called directly. the
+ * build makes a second copy with -mavx2 so both vector paths get checked,
+ * that one is skipped on CPUs without AVX2. */
+#include <stdio.h>
+#include <SDL.h>
+#include "mipmap.c"
+
+/* exit status for a check that can't run here, as automake and ctest take */
+#define SKIP 77
+
+/* even sizes for the 2x2 filter. outputs 1 to 11 pixels wide cover every
+ * mix of the AVX2 (4 pixel), SSE2 (2 pixel) and scalar loops. */
+static const int sizes_2x2[][2] = {
+	{ 2, 2 }, { 4, 2 }, { 6, 4 }, { 8, 8 }, { 10, 6 }, { 12, 2 },
+	{ 14, 14 }, { 16, 16 }, { 18, 4 }, { 20, 10 }, { 22, 2 },
+	{ 64, 64 }, { 750, 750 }, { 1000, 2 },
+};
+
+/* whole chains, with odd and 1 pixel sizes that use the generic filter
+ * for some or all of their levels */
+static const int sizes_chain[][2] = {
+	{ 1, 1 }, { 1, 64 }, { 64, 1 }, { 1, 75 }, { 3, 5 }, { 7, 7 },
+	{ 17, 6 }, { 30, 30 }, { 101, 64 }, { 256, 256 }, { 375, 1 },
+	{ 750, 750 }, { 751, 750 },
+};
+
+static uint32_t random_state = 1;
+
+/* xorshift, so every run checks the same images */
+static uint32_t random_next(void)
+{
+	uint32_t x = random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return random_state = x;
+}
+
+/* w x h random RGBA pixels, offset by up to 3 bytes so the loads aren't
+ * always aligned. free() base when done. */
+static unsigned char *random_image(int w, int h, unsigned char **base)
+{
+	size_t i, size = (size_t)w * h * 4;
+
+	*base = malloc(size + 3);
+	if (!*base)
+		die("Unable to allocate a %dx%d image!\n", w, h);
+	unsigned char *p = *base + size % 4;
+	for (i = 0; i < size; i++)
+		p[i] = random_next() >> 24;
+	/* the extremes, for rounding and saturation */
+	if (size >= 8) {
+		memset(p, 255, 4);
+		memset(p + size - 4, 0, 4);
+	}
+	return p;
+}
+
+/* the scalar filter, into a new dw x dh image */
+static unsigned char *scalar_downsample(const unsigned char *src, int sw,
+	int sh, int dw, int dh)
+{
+	unsigned char *dst = malloc((size_t)dw * dh * 4);
+	uint16_t *tmp = malloc((size_t)dw * sh * 4 * sizeof(*tmp));
+	struct taps *xt = malloc(dw * sizeof(*xt));
+	struct taps *yt = malloc(dh * sizeof(*yt));
+
+	if (!dst || !tmp || !xt || !yt)
+		die("Unable to allocate a %dx%d image!\n", dw, dh);
+	downsample_generic(src, sw, sh, dst, dw, dh, 4, tmp, xt, yt);
+	free(yt);
+	free(xt);
+	free(tmp);
+	return dst;
+}
+
+/* 0 if a and b are the same w x h image, else says where they differ */
+static int compare(const char *what, int sw, int sh, int w, int h,
+	const unsigned char *a, const unsigned char *b)
+{
+	size_t i, size = (size_t)w * h * 4;
+
+	for (i = 0; i < size; i++) {
+		if (a[i] != b[i]) {
+			warn("%s %dx%d: pixel %zu,%zu of %dx%d channel %zu is "
+				"%u, not %u\n", what, sw, sh, i / 4 % w,
+				i / 4 / w, w, h, i % 4, a[i], b[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int check_2x2(int w, int h)
+{
+	unsigned char *base;
+	unsigned char *src = random_image(w, h, &base);
+	int dw = w / 2, dh = h / 2;
+	unsigned char *dst = malloc((size_t)dw * dh * 4);
+
+	if (!dst)
+		die("Unable to allocate a %dx%d image!\n", dw, dh);
+	downsample_rgba_2x2(src, w, h, dst);
+	unsigned char *ref = scalar_downsample(src, w, h, dw, dh);
+	int ret = compare("2x2", w, h, dw, dh, dst, ref);
+	free(ref);
+	free(dst);
+	free(base);
+	return ret;
+}
+
+static int check_chain(int w, int h)
+{
+	struct mipmap mm;
+	unsigned char *base;
+	unsigned char *src = random_image(w, h, &base);
+	unsigned i;
+	int ret = 0;
+
+	if (mipmap_build(&mm, src, w, h, 4, true))
+		die("Unable to build mipmaps for %dx%d\n", w, h);
+	unsigned char *prev = src;
+	for (i = 1; !ret && i < mm.num_levels; i++) {
+		const struct mip_level *l = &mm.level[i];
+		unsigned char *ref = scalar_downsample(prev,
+			mm.level[i - 1].width, mm.level[i - 1].height,
+			l->width, l->height);
+		ret = compare("chain", w, h, l->width, l->height, l->data,
+			ref);
+		if (prev != src)
+			free(prev);
+		prev = ref;
+	}
+	if (prev != src)
+		free(prev);
+	mipmap_free(&mm);
+	free(base);
+	return ret;
+}
+
+int main(void)
+{
+	unsigned i, failed = 0;
+	const char *path = "scalar";
+
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
+#if defined(__AVX2__)
+	if (!__builtin_cpu_supports("avx2")) {
+		info("no AVX2 on this CPU, skipping\n");
+		return SKIP;
+	}
+	path = "AVX2";
+#elif defined(__SSE2__)
+	path = "SSE2";
+#endif
+	for (i = 0; i < sizeof(sizes_2x2) / sizeof(*sizes_2x2); i++)
+		if (check_2x2(sizes_2x2[i][0], sizes_2x2[i][1]))
+			failed++;
+	for (i = 0; i < sizeof(sizes_chain) / sizeof(*sizes_chain); i++)
+		if (check_chain(sizes_chain[i][0], sizes_chain[i][1]))
+			failed++;
+	info("%s 2x2 downsample: %u of %u sizes differ from the scalar "
+		"filter\n", path, failed, (unsigned)(sizeof(sizes_2x2) /
+		sizeof(*sizes_2x2) + sizeof(sizes_chain) / sizeof(*sizes_chain)));
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
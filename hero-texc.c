@@ -0,0 +1,180 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+/* hero-texc - compile images into textures with their mip chain built and
+ * block compressed, so the game only has to read and upload them. */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/gl.h>
+#include "logging.h"
+#include "dxt.h"
+#include "grow.h"
+#include "mipmap.h"
+#include "texfile.h"
+#include "threadpool.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+static struct {
+	int format; /* enum texfile_format, or -1 to pick from the image */
+	unsigned threads; /* 0 for one per CPU */
+	const char *output; /* only with a single input */
+} config = {
+	.format = -1,
+};
+
+/* one level being compressed, a job for each row of blocks */
+struct level_job {
+	const struct mip_level *src;
+	struct texfile_level *dst;
+	bool alpha;
+	size_t row_size; /* bytes in a row of blocks */
+};
+
+static void compress_row(void *arg, unsigned index)
+{
+	const struct level_job *job = arg;
+
+	dxt_compress_row(job->dst->data + index * job->row_size,
+		job->src->data, job->src->width, job->src->height, index,
+		job->alpha);
+}
+
+static int compile(struct threadpool *pool, const char *input,
+	const char *output)
+{
+	struct mipmap mm;
+	struct texfile tf;
+	int width, height, comps;
+	unsigned i;
+
+	unsigned char *data = stbi_load(input, &width, &height, &comps, 4);
+	if (!data) {
+		error("%s:error loading:%s\n", input, stbi_failure_reason());
+		return -1;
+	}
+	/* the game may run on a GL without NPOT textures, and power of two
+	 * sizes keep the blocks of every level aligned */
+	if (mipmap_build(&mm, data, width, height, 4, false)) {
+		stbi_image_free(data);
+		return -1;
+	}
+
+	memset(&tf, 0, sizeof(tf));
+	tf.format = config.format;
+	if (config.format < 0)
+		tf.format = comps == 2 || comps == 4 ? TEXFILE_DXT5 :
+			TEXFILE_DXT1;
+	tf.width = mm.level[0].width;
+	tf.height = mm.level[0].height;
+	tf.num_levels = mm.num_levels;
+	size_t total = 0;
+	for (i = 0; i < tf.num_levels; i++) {
+		tf.level[i].width = mm.level[i].width;
+		tf.level[i].height = mm.level[i].height;
+		tf.level[i].size = texfile_level_size(tf.format,
+			tf.level[i].width, tf.level[i].height);
+		total += tf.level[i].size;
+	}
+	int ret = -1;
+	if (tf.format == TEXFILE_RGBA8) {
+		for (i = 0; i < tf.num_levels; i++)
+			tf.level[i].data = mm.level[i].data;
+	} else {
+		tf.storage = malloc(total);
+		if (!tf.storage) {
+			error("%s:out of memory\n", input);
+			goto out;
+		}
+		unsigned char *p = tf.storage;
+		for (i = 0; i < tf.num_levels; i++) {
+			struct level_job job = {
+				.src = &mm.level[i],
+				.dst = &tf.level[i],
+				.alpha = tf.format == TEXFILE_DXT5,
+			};
+			tf.level[i].data = p;
+			p += tf.level[i].size;
+			unsigned rows = (job.src->height + 3) / 4;
+			job.row_size = tf.level[i].size / rows;
+			threadpool_run(pool, rows, compress_row, &job);
+		}
+	}
+
+	ret = texfile_write(&tf, output);
+	if (!ret)
+		info("%s: %dx%d %s, %u levels, %zu bytes\n", output, tf.width,
+			tf.height, texfile_format_name(tf.format), tf.num_levels,
+			total);
+out:
+	free(tf.storage);
+	mipmap_free(&mm);
+	stbi_image_free(data);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "%s [-format rgba|dxt1|dxt5] [-threads n] [-o output] "
+		"image...\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int i, num_inputs = 0, ret = EXIT_SUCCESS;
+
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
+	for (i = 1; i < argc; ) {
+		const char *cur = argv[i++];
+
+		if (cur[0] != '-') {
+			argv[++num_inputs] = (char*)cur;
+			continue;
+		}
+		if (!strcmp(cur, "-help") || !strcmp(cur, "-h") || i >= argc)
+			usage(argv[0]);
+		const char *arg = argv[i++];
+		if (!strcmp(cur, "-format")) {
+			for (config.format = 0; config.format < TEXFILE_FORMAT_MAX;
+				config.format++) {
+				if (!strcmp(arg, texfile_format_name(config.format)))
+					break;
+			}
+			if (config.format == TEXFILE_FORMAT_MAX) {
+				fprintf(stderr, "ERROR unknown format %s\n", arg);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-threads")) {
+			if (sscanf(arg, "%u", &config.threads) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-o")) {
+			config.output = arg;
+		} else {
+			fprintf(stderr, "ERROR unknown option %s\n", cur);
+			usage(argv[0]);
+		}
+	}
+	if (!num_inputs || (config.output && num_inputs > 1))
+		usage(argv[0]);
+
+	/* the main thread does its share of the work, so 1 means no workers */
+	struct threadpool *pool = NULL;
+	if (config.threads != 1)
+		pool = threadpool_new(config.threads ? config.threads - 1 : 0);
+	for (i = 1; i <= num_inputs; i++) {
+		char *output = config.output ? strdup(config.output) :
+			replace_ext(argv[i], TEXFILE_EXT);
+		if (!output || compile(pool, argv[i], output))
+			ret = EXIT_FAILURE;
+		free(output);
+	}
+	threadpool_free(pool);
+	return ret;
+}
@@ -0,0 +1,340 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+/* hero-walkcheck - walks a body around compiled maps at random, moving it
+ * with collide_move() and tracking its sector the way the game does, and
+ * checks after every move that:
+ *   it is still inside the map,
+ *   the sector it was moved into is the one it is in,
+ *   it is no closer to a wall than its radius.
+ *
+ * with no maps on the command line it walks assets/demo.hmap and grids of
+ * 64x64 and 320x320 square sectors with about a fifth of them walled off.
+ * exits with a failure if anything went wrong on any walk. */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "logging.h"
+#include "map.h"
+#include "collide.h"
+#include "sectorgrid.h"
+
+/* how many portals away walls can be near enough to touch */
+#define NEAR_DEPTH 2
+#define MAX_NEAR 32
+/* how far past the radius a body may be for rounding */
+#define TOLERANCE 0.01f
+/* failures of one kind reported for a walk, the rest are only counted */
+#define MAX_REPORTS 5
+
+static struct {
+	unsigned moves;
+	unsigned seed;
+} config = {
+	.moves = 200000,
+	.seed = 1,
+};
+
+/* the same body as the player */
+static const struct collide_body body = {
+	.radius = 0.25f,
+	.height = 1.25f,
+	.step = 0.5f,
+};
+
+static uint32_t random_state;
+
+/* xorshift, so a seed walks the same everywhere */
+static uint32_t random_next(void)
+{
+	uint32_t x = random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return random_state = x;
+}
+
+static float random_float(void)
+{
+	return (random_next() >> 8) / 16777216.0f;
+}
+
+/* an n x n grid of unit square sectors, with about a fifth of them closed
+ * off. -1 on error. */
+static int grid_write(const char *filename, unsigned n)
+{
+	struct map_header h = {
+		.num_sectors = n * n,
+		.num_walls = 4 * n * n,
+		.num_vertices = (n + 1) * (n + 1),
+		.num_textures = 1,
+		.start_sector = 0,
+	};
+	struct map_texture texture = { "assets/461223101.jpg" };
+	struct map_sector *sectors = calloc(h.num_sectors, sizeof(*sectors));
+	struct map_wall *walls = calloc(h.num_walls, sizeof(*walls));
+	struct map_vertex *vertices = calloc(h.num_vertices,
+		sizeof(*vertices));
+	bool *closed = calloc(h.num_sectors, sizeof(*closed));
+	unsigned i, x, y;
+	int ret = -1;
+
+	if (!sectors || !walls || !vertices || !closed) {
+		error("Unable to allocate a %ux%u grid!\n", n, n);
+		goto done;
+	}
+	for (i = 0; i < h.num_sectors / 5; i++)
+		closed[random_next() % h.num_sectors] = true;
+	closed[h.start_sector] = false;
+	for (y = 0; y <= n; y++) {
+		for (x = 0; x <= n; x++) {
+			vertices[y * (n + 1) + x].x = x;
+			vertices[y * (n + 1) + x].y = y;
+		}
+	}
+	for (y = 0; y < n; y++) {
+		for (x = 0; x < n; x++) {
+			unsigned sec = y * n + x;
+			/* left, top, right and bottom, clockwise */
+			const int side[4][4] = {
+				{ 0, 1, -1, 0 }, { 1, 1, 0, 1 },
+				{ 1, 0, 1, 0 }, { 0, 0, 0, -1 },
+			};
+			sectors[sec] = (struct map_sector){
+				.first_wall = 4 * sec,
+				.num_walls = 4,
+				.floor_height = 0.0f,
+				.ceil_height = 2.0f,
+			};
+			for (i = 0; i < 4; i++) {
+				struct map_wall *w = &walls[4 * sec + i];
+				unsigned nx = x + side[i][2], ny = y + side[i][3];
+				w->vertex = (y + side[i][1]) * (n + 1) + x +
+					side[i][0];
+				w->portal = MAP_NONE;
+				if (nx < n && ny < n && !closed[sec] &&
+					!closed[ny * n + nx])
+					w->portal = ny * n + nx;
+			}
+		}
+	}
+	ret = map_write(&h, sectors, walls, vertices, &texture, NULL,
+		filename);
+done:
+	free(closed);
+	free(vertices);
+	free(walls);
+	free(sectors);
+	return ret;
+}
+
+/* true if the body can't go from sector from through a portal to to */
+static bool blocks(const struct map_sector *from, const struct map_sector *to)
+{
+	if (!to)
+		return true;
+	float floor = fmaxf(from->floor_height, to->floor_height);
+	float ceil = fminf(from->ceil_height, to->ceil_height);
+	return to->floor_height - from->floor_height > body.step ||
+		ceil - floor < body.height;
+}
+
+static float wall_distance(const struct map_vertex *a,
+	const struct map_vertex *b, float x, float y)
+{
+	float ex = b->x - a->x, ey = b->y - a->y;
+	float len2 = ex * ex + ey * ey;
+	float t = len2 > 0.0f ? ((x - a->x) * ex + (y - a->y) * ey) / len2 :
+		0.0f;
+	t = fminf(fmaxf(t, 0.0f), 1.0f);
+	float dx = a->x + ex * t - x, dy = a->y + ey * t - y;
+	return sqrtf(dx * dx + dy * dy);
+}
+
+/* distance from x,y to the nearest wall the body can't pass, looking
+ * NEAR_DEPTH portals away from sector */
+static float nearest_wall(const struct map *m, unsigned sector, float x,
+	float y)
+{
+	unsigned near[MAX_NEAR], num_near = 1, first = 0, depth, i, j, k;
+	float best = INFINITY;
+
+	near[0] = sector;
+	for (depth = 0; depth <= NEAR_DEPTH; depth++) {
+		unsigned end = num_near;
+		for (i = first; i < end; i++) {
+			const struct map_sector *sec = map_sector(m, near[i]);
+			const struct map_vertex *a = map_wall_vertex(m, sec,
+				sec->num_walls - 1);
+			for (j = 0; j < sec->num_walls; j++) {
+				const struct map_vertex *b = map_wall_vertex(m,
+					sec, j);
+				unsigned portal = map_wall_portal(m, sec, j);
+				const struct map_sector *next = map_sector(m,
+					portal);
+				if (blocks(sec, next)) {
+					best = fminf(best,
+						wall_distance(a, b, x, y));
+				} else if (num_near < MAX_NEAR) {
+					for (k = 0; k < num_near; k++)
+						if (near[k] == portal)
+							break;
+					if (k == num_near)
+						near[num_near++] = portal;
+				}
+				a = b;
+			}
+		}
+		first = end;
+	}
+	return best;
+}
+
+/* walk a body around m from the middle of its start sector, 0 if nothing
+ * went wrong. */
+static int walk(const struct map *m, const char *name)
+{
+	struct sectorgrid grid;
+	unsigned outside = 0, wrong = 0, close = 0, changes = 0, i;
+	float dir = 0.0f;
+
+	if (sectorgrid_build(&grid, m))
+		return -1;
+	unsigned sector = m->header->start_sector;
+	const struct map_sector *start = map_sector(m, sector);
+	if (!start || !start->num_walls) {
+		warn("%s:no start sector\n", name);
+		sectorgrid_free(&grid);
+		return -1;
+	}
+	float x = 0.0f, y = 0.0f;
+	for (i = 0; i < start->num_walls; i++) {
+		x += map_wall_vertex(m, start, i)->x;
+		y += map_wall_vertex(m, start, i)->y;
+	}
+	x /= start->num_walls;
+	y /= start->num_walls;
+
+	random_state = config.seed;
+	Uint64 begin = SDL_GetPerformanceCounter();
+	for (i = 0; i < config.moves; i++) {
+		/* mostly short steps, with the odd long one to cross a few
+		 * sectors at once */
+		if (random_next() % 50 == 0)
+			dir = random_float() * 2.0f * (float)M_PI;
+		float len = random_next() % 10 == 0 ? 3.0f : 0.16f;
+		float px = x, py = y;
+		unsigned moved = collide_move(m, sector, &body, &x, &y,
+			cosf(dir) * len, sinf(dir) * len);
+
+		if (sectorgrid_find(&grid, m, x, y) == MAP_NONE) {
+			if (outside++ < MAX_REPORTS)
+				warn("%s:move %u from %g,%g left the map at "
+					"%g,%g\n", name, i, px, py, x, y);
+		} else if (!map_sector_contains(m, map_sector(m, moved), x,
+			y)) {
+			if (wrong++ < MAX_REPORTS)
+				warn("%s:move %u from %g,%g ended at %g,%g "
+					"outside of sector %u\n", name, i, px,
+					py, x, y, moved);
+		}
+		float d = nearest_wall(m, moved, x, y);
+		if (d < body.radius - TOLERANCE && close++ < MAX_REPORTS)
+			warn("%s:move %u from %g,%g ended %g from a wall\n",
+				name, i, px, py, d);
+
+		/* as the game does, the grid catches what the portals miss */
+		moved = sectorgrid_track(&grid, m, moved, x, y);
+		if (moved != sector)
+			changes++;
+		sector = moved;
+	}
+	double ms = (SDL_GetPerformanceCounter() - begin) * 1000.0 /
+		SDL_GetPerformanceFrequency();
+	info("%s:%u moves in %.1fms, %u sector changes, %u outside, "
+		"%u in the wrong sector, %u too close\n", name, config.moves,
+		ms, changes, outside, wrong, close);
+	sectorgrid_free(&grid);
+	return outside || wrong || close ? -1 : 0;
+}
+
+static int walk_file(const char *filename)
+{
+	struct map m;
+
+	if (map_open(&m, filename))
+		return -1;
+	int ret = walk(&m, filename);
+	map_close(&m);
+	return ret;
+}
+
+static int walk_grid(unsigned n)
+{
+	char filename[64];
+
+	snprintf(filename, sizeof(filename), "walkcheck-%ux%u%s", n, n,
+		MAP_EXT);
+	random_state = config.seed;
+	if (grid_write(filename, n))
+		return -1;
+	int ret = walk_file(filename);
+	remove(filename);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "%s [-moves n] [-seed n] [map...]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int i, num_inputs = 0, ret = EXIT_SUCCESS;
+
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
+	for (i = 1; i < argc; ) {
+		const char *cur = argv[i++];
+
+		if (cur[0] != '-') {
+			argv[++num_inputs] = (char*)cur;
+			continue;
+		}
+		if (!strcmp(cur, "-help") || !strcmp(cur, "-h") || i >= argc)
+			usage(argv[0]);
+		const char *arg = argv[i++];
+		if (!strcmp(cur, "-moves")) {
+			if (sscanf(arg, "%u", &config.moves) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-seed")) {
+			if (sscanf(arg, "%u", &config.seed) != 1 ||
+				!config.seed) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else {
+			fprintf(stderr, "ERROR unknown option %s\n", cur);
+			usage(argv[0]);
+		}
+	}
+
+	if (!num_inputs) {
+		if (walk_file("assets/demo.hmap"))
+			ret = EXIT_FAILURE;
+		if (walk_grid(64))
+			ret = EXIT_FAILURE;
+		if (walk_grid(320))
+			ret = EXIT_FAILURE;
+	}
+	for (i = 1; i <= num_inputs; i++)
+		if (walk_file(argv[i]))
+			ret = EXIT_FAILURE;
+	return ret;
+}
@@ -14,10 +14,29 @@
 #include <GL/glext.h>
 #include <GL/glu.h>
 #include "logging.h"
+#include "mipmap.h"
 #include "texture.h"
+#include "texfile.h"
 #include "model.h"
 #include "objloader.h"
 #include "modeldraw.h"
+#include "frustum.h"
+#include "grow.h"
+#include "renderqueue.h"
+#include "glstate.h"
+#include "shader.h"
+#include "occlusion.h"
+#include "gputimer.h"
+#include "threadpool.h"
+#include "cmdbuf.h"
+#include "streambuf.h"
+#include "texcache.h"
+#include "texarray.h"
+#include "map.h"
+#include "sectorgrid.h"
+#include "collide.h"
+#include "worldmesh.h"
+#include "worldcache.h"
 
 #define ARRAY_SIZE(a) (sizeof (a) / sizeof *(a))
 
@@ -28,12 +47,20 @@ struct config {
 	bool verbose; /* enable to turn on all logging */
 	bool debug; /* enable to turn on debug logging */
 	bool use_vsync;
+	bool use_glsl; /* try the GLSL backend before fixed-function */
+	unsigned threads; /* threads for loading and recording, 0 for one per CPU */
+	unsigned texture_budget; /* MiB of unused textures to keep around */
+	unsigned upload_budget; /* KiB of streamed textures per frame, 0 to load at start */
+	unsigned world_budget; /* MiB of world pages to keep around */
+	unsigned texture_scale; /* decode textures at 1/n size: 1, 2, 4 or 8 */
+	const char *map; /* compiled map made by hero-mapc */
 };
 
 struct game_state {
 	GLuint win_x, win_y, win_w, win_h; /* used to crop to preserve aspect */
 	GLdouble player_x, player_y; /* current player position */
 	GLdouble player_z; /* non-zero if we're flying, added to height */
+	GLdouble player_floor; /* floor of player_sector, height starts here */
 	GLdouble player_facing, player_height;
 	GLdouble player_tilt; /* for look up/down */
 	unsigned player_sector;
@@ -41,6 +68,14 @@ struct game_state {
 	bool text_input;
 	/** debug options **/
 	bool lighting;
+	bool use_shader; /* draw with world->shader if it is available */
+	bool culling; /* frustum cull sprites and model objects */
+	bool occlusion; /* skip sprites whose box was hidden last frame */
+	bool pvs; /* skip portals to sectors the map's PVS rules out */
+	bool scissor; /* only draw sectors where their portals are on screen */
+	struct cull_stats cull_stats; /* counts for the last frame */
+	bool show_timing; /* GPU pass timings in the window title */
+	Uint32 timing_tick; /* last time the timings were shown, 0 for never */
 	/** player input **/
 	struct act {
 		bool up, down, left, right;
@@ -57,6 +92,12 @@ static struct config config = {
 	.verbose = false,
 	.debug = false,
 	.use_vsync = false,
+	.use_glsl = true,
+	.texture_budget = 64,
+	.upload_budget = 1024,
+	.world_budget = 32,
+	.texture_scale = 1,
+	.map = "assets/demo.hmap",
 };
 
 static bool keep_going = true;
@@ -93,67 +134,141 @@ static void setup_gl(void)
 
 	// orange: glClearColor(1.0, 0.75, 0.0, 1.0);
 	glClearColor(0.0, 0.0, 0.0, 1.0);
+
+	/* nothing is known about the new context */
+	glstate_reset();
+	texture_init();
+	texfile_init();
+	unsigned shift = 0;
+	while ((1u << shift) < config.texture_scale)
+		shift++;
+	texture_set_scale(shift);
 }
 
 /** MVC: Model - represent the data */
 
-/* a sector is a convex 2D polygon. each side is a wall or portal. */
-#define MAX_SIDES 64
-struct sector_vertex {
-	GLfloat x, y;
+/* an entity that moves in the world */
+struct sprite {
+	GLdouble x, y, z; /* x,y on the map, z is the height */
+	// TODO: use a matrix so the model can have an orientation
+	GLfloat scale;
+	unsigned model_num;
+};
+
+/* per-frame bounding spheres of sprites, split up for SIMD culling */
+struct sprite_cull {
+	GLfloat *spheres; /* x[max], y[max], z[max] and r[max] */
+	unsigned max_spheres;
+	unsigned char *visible;
+	unsigned max_visible;
+};
+
+/* sprites are culled and recorded in batches of this many */
+#define SPRITE_BATCH 64
+
+/* how many portals deep the view goes */
+#define VIEW_DEPTH 10
+
+/* visible sectors are drawn in at most this many scissor boxes, on a grid
+ * of this many cells across the view */
+#define MAX_SCISSORS 8
+#define SCISSOR_GRID 16
+
+/* how many portals away world pages are loaded, past the view so they are
+ * ready before they can be seen */
+#define PAGE_REACH (2 * VIEW_DEPTH)
+
+/* the player's size for running into walls */
+static const struct collide_body player_body = {
+	.radius = 0.25f,
+	.height = 1.25f,
+	.step = 0.5f,
+};
+
+/* part of the screen in normalized device coordinates, -1 to 1 */
+struct screen_rect {
+	float x0, y0, x1, y1;
 };
 
-struct map_sector {
-	unsigned sector_number;
-	GLfloat floor_height, ceil_height;
-	unsigned num_sides;
-	/* must be in counter-clockwise order */
-	struct sector_vertex sides_xy[MAX_SIDES];
-	unsigned char color[MAX_SIDES];
-	unsigned short destination_sector[MAX_SIDES]; /* portal != 0xffff */
+struct sector_visit {
+	const struct map_sector *sec;
+	int ttl; /* portals left to go through */
+	struct screen_rect rect; /* what can be seen through the portals */
 };
 
-#define SECTOR_NONE (0xffff)
+/* the frame being recorded, shared with the worker threads */
+struct frame_jobs {
+	const struct game_state *state;
+	struct frustum view; /* world space */
+	float clip[16]; /* projection * modelview */
+	struct sector_visit *visits; /* visible sectors, in traversal order */
+	unsigned num_visits, max_visits;
+	/* sectors waiting to have their portals looked through */
+	struct sector_visit *queue;
+	unsigned max_queue;
+	/* scissor box of each group of sectors, 0 is the whole view */
+	GLint (*scissors)[4];
+	unsigned num_scissors, max_scissors;
+	unsigned num_batches; /* of sprites */
+	struct cmdbuf *bufs; /* one for each sprite batch */
+	unsigned max_bufs;
+	struct cull_stats *stats; /* one for each sprite batch */
+	unsigned max_stats;
+};
+
+struct world {
+	struct map map;
+	struct sectorgrid grid; /* finds the sector a point is in */
+	struct texcache textures;
+	unsigned num_textures;
+	int *tex_handles; /* texcache handles of the wall textures */
+	struct texarray walls; /* the same textures as layers, for the shader */
+	bool pack_walls; /* make walls once the textures are loaded */
+	bool walls_held; /* tex_handles are acquired */
+	Uint64 stream_start; /* when streaming began, 0 once it's done */
+	/* the surfaces of the sectors near the player, texture slots index
+	 * tex_handles and pick the layer of walls */
+	struct worldcache pages;
+	/* the last time each sector was visible, kept apart so finding the
+	 * visible sectors doesn't read the rest */
+	struct sector_mark {
+		unsigned frame; /* world->frame */
+		unsigned visit; /* index in jobs.visits that frame */
+	} *visited;
+	unsigned max_visited;
+	/* the PVS of pvs_sector expanded, NULL if the map has none that is
+	 * deep enough */
+	unsigned char *pvs;
+	unsigned pvs_sector;
+	/* models that can be referenced by sprites */
+	struct model **models;
+	unsigned max_models; /* allocated models */
+	/* entities in the world */
+	struct sprite *sprites;
+	unsigned max_sprites; /* allocated sprites */
+	unsigned num_sprites; /* sprites in use */
+	struct sprite_cull cull;
+	/* draw calls collected for the current frame */
+	struct render_queue queue;
+	/* lights in world coordinates */
+	struct light lights[MAX_LIGHTS];
+	unsigned num_lights;
+	/* GLSL backend, NULL if only fixed-function is available */
+	struct shader *shader;
+	/* occlusion queries, one per sprite */
+	struct occlusion occlusion;
+	/* per-frame geometry, buffer is 0 if unavailable */
+	struct streambuf stream;
+	/* multithreaded recording of draw commands */
+	unsigned frame; /* counts up every frame */
+	struct frame_jobs jobs;
+	struct threadpool *pool; /* NULL to do everything on the main thread */
+};
 
-const struct map_sector *sector_get(unsigned num)
+/* sector num of the map, NULL if there isn't one */
+static const struct map_sector *sector_get(unsigned num)
 {
-	static const struct map_sector dummy_sector0 = {
-		.sector_number = 0,
-		.floor_height = 0.0,
-		.ceil_height = 2.0,
-		.num_sides = 4,
-		.sides_xy = {
-			{ 1, 16, },
-			{ 5, 11, },
-			{ 5, 7, },
-			{ 1, 2, },
-		},
-		.destination_sector =
-			{ SECTOR_NONE, SECTOR_NONE, SECTOR_NONE, 1, },
-		.color = { 0, 1, 2, 3 },
-	};
-	static const struct map_sector dummy_sector1 = {
-		.sector_number = 1,
-		.floor_height = 0.0,
-		.ceil_height = 2.0,
-		.num_sides = 4,
-		.sides_xy = {
-			{ 8, 6, },
-			{ 10, 1, },
-			{ 1, 2, },
-			{ 5, 7, },
-		},
-		.destination_sector =
-			{ SECTOR_NONE, SECTOR_NONE, SECTOR_NONE, 0, },
-		.color = { 4, 5, 6, 7 },
-	};
-	switch (num) {
-	case 0:
-		return &dummy_sector0;
-	case 1:
-		return &dummy_sector1;
-	}
-	return NULL;
+	return map_sector(&world->map, num);
 }
 
 /* calculates the center of a sector through averaging every vertex. */
@@ -161,244 +276,351 @@ static void sector_find_center(const struct map_sector *sec, GLdouble *x, GLdoub
 {
 	unsigned i;
 	GLdouble total_x = 0.0, total_y = 0.0;
-	for (i = 0; i < sec->num_sides; i++) {
-		const struct sector_vertex *cur = &sec->sides_xy[i];
+	for (i = 0; i < sec->num_walls; i++) {
+		const struct map_vertex *cur = map_wall_vertex(&world->map,
+			sec, i);
 		total_x += cur->x;
 		total_y += cur->y;
 	}
 	if (x)
-		*x = total_x / sec->num_sides;
+		*x = total_x / sec->num_walls;
 	if (y)
-		*y = total_y / sec->num_sides;
+		*y = total_y / sec->num_walls;
 }
 
-/* compiled world sector */
-struct wsector {
-	GLuint display_list;
-	char pad[64];
+/* materials used by render queue items */
+enum {
+	MATERIAL_WORLD,
+	MATERIAL_TEAPOT,
 };
 
-/* an entity that moves in the world */
-struct sprite {
-	GLdouble x, y, z;
-	// TODO: use a matrix so the model can have an orientation
-	unsigned model_num;
+static const struct material materials[] = {
+	[MATERIAL_WORLD] = {
+		.ambient = { 0.3, 0.3, 0.3, 1.0 },
+		.diffuse = { 0.8, 0.8, 0.8, 1.0 },
+		.specular = { 1.0, 1.0, 1.0, 1.0 },
+		.emission = { 0.0, 0.0, 0.0, 0.0 },
+		.shininess = 50.0,
+		.color = { 1.0, 1.0, 1.0, 0.0 },
+	},
+	[MATERIAL_TEAPOT] = {
+		.ambient = { 0.9, 0.9, 0.2, 1.0 },
+		.diffuse = { 0.9, 0.9, 0.2, 1.0 },
+		.specular = { 1.0, 1.0, 1.0, 1.0 },
+		.emission = { 0.0, 0.0, 0.0, 1.0 },
+		.shininess = 50.0,
+		.color = { 1.0, 1.0, 0.0, 1.0 },
+	},
 };
 
-struct world {
-	unsigned num_textures;
-	GLuint *tex_ids;
-	/* compiled sectors */
-	struct wsector *sectors;
-	unsigned max_sectors; /* allocated sectors */
-	/* models that can be referenced by sprites */
-	struct model **models;
-	unsigned max_models; /* allocated models */
-	/* entities in the world */
-	struct sprite *sprites;
-	unsigned max_sprites; /* allocated sprites */
-};
+#define STREAM_SIZE (1 << 20) /* bytes of dynamic geometry in flight */
 
-struct world *world_new(void)
+/* put the wall textures in one array so a sector draws with one bind */
+static void world_textures_pack(struct world *world)
 {
-	// TODO: don't hard code these filenames
-	const char *texfiles[] = {
-		"assets/461223101.jpg",
-		"assets/461223102.jpg",
-		"assets/461223103.jpg",
-		"assets/461223104.jpg",
-		"assets/461223105.jpg",
-	};
-	const char tex_max = ARRAY_SIZE(texfiles);
-
-	struct world *world = calloc(1, sizeof(*world));
-	world->num_textures = tex_max;
-	world->tex_ids = calloc(tex_max, sizeof(*world->tex_ids));
+	GLuint *ids = calloc(world->num_textures, sizeof(*ids));
+	const char **names = calloc(world->num_textures, sizeof(*names));
+	unsigned i;
 
-	glGenTextures(tex_max, world->tex_ids);
-	debug("%s():%d:error=%#x\n", __func__, __LINE__, glGetError());
-	int i;
-	for (i = 0; i < tex_max; i++) {
-		debug("Binding texture %d\n", world->tex_ids[i]);
-		glBindTexture(GL_TEXTURE_2D, world->tex_ids[i]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		int width, height;
-		int e = texture_load(texfiles[i], -1, GL_RGBA, &width, &height, 0, false);
-		assert(e == 0);
-		verbose("%s:texture=%dx%d\n", texfiles[i], width, height);
+	if (!ids || !names) {
+		free(ids);
+		free(names);
+		return;
 	}
+	for (i = 0; i < world->num_textures; i++) {
+		ids[i] = texcache_id(&world->textures, world->tex_handles[i]);
+		names[i] = map_texture(&world->map, i);
+	}
+	if (texarray_pack(&world->walls, ids, names, world->num_textures))
+		info("Wall textures not packed, binding them one at a time\n");
+	else
+		texcache_reserve(&world->textures, world->walls.bytes);
+	free(names);
+	free(ids);
+}
 
-	return world;
+/* true when the walls are drawn from world->walls by the shader */
+static bool walls_layered(const struct game_state *state)
+{
+	return world->walls.id && state->use_shader && world->shader;
 }
 
-/* draw one sector
- * set ttl=0 to only draw this sector */
-static void sector_gen_visible(const struct map_sector *sec, int ttl)
+/* hold the wall textures while the walls aren't drawn from world->walls.
+ * once they aren't needed the cache can evict them, they are loaded again
+ * if the fixed-function path is turned back on. */
+static void world_walls_hold(struct world *world, bool hold)
 {
-	/* limit our depth */
-	if (ttl < 0)
+	unsigned i;
+
+	if (hold == world->walls_held)
 		return;
-	if (!sec)
-		return; /* TODO: maybe draw some empty void? */
+	world->walls_held = hold;
+	for (i = 0; i < world->num_textures; i++) {
+		if (hold)
+			world->tex_handles[i] = texcache_acquire(
+				&world->textures, map_texture(&world->map, i));
+		else
+			texcache_release(&world->textures,
+				world->tex_handles[i]);
+	}
+	if (hold && texcache_load(&world->textures))
+		warn("Unable to reload the wall textures\n");
+}
+
+/* upload this frame's share of streamed textures, and pack the walls once
+ * every texture has arrived. */
+static void world_textures_update(struct world *world)
+{
+	texcache_update(&world->textures);
+	if (texcache_busy(&world->textures))
+		return;
+	if (world->stream_start) {
+		info("Streamed %u textures (%zu KiB) in %.1fms\n",
+			world->num_textures, world->textures.bytes >> 10,
+			(SDL_GetPerformanceCounter() - world->stream_start) *
+			1000.0 / SDL_GetPerformanceFrequency());
+		world->stream_start = 0;
+	}
+	if (world->pack_walls) {
+		world->pack_walls = false;
+		world_textures_pack(world);
+	}
+}
+
+/* texture slot of a map texture, a bad index from the map gives slot 0 */
+static unsigned texture_slot(const struct world *world, unsigned texture)
+{
+	return texture < world->num_textures ? texture : 0;
+}
+
+/* add a vertex of a surface using texture slot, which is also its layer of
+ * world->walls. returns its index or -1 on error. */
+static long sector_vertex(struct worldmesh *mesh, GLfloat x, GLfloat y,
+	GLfloat z, const GLfloat normal[3], GLfloat s, GLfloat t, unsigned slot)
+{
+	const GLfloat position[3] = { x, y, z };
+	const GLfloat texcoord[3] = { s, t, slot };
+
+	return worldmesh_vertex(mesh, position, normal, texcoord);
+}
+
+/* add the floor, ceiling and solid walls of one sector to mesh. portals
+ * are left open, the sectors behind them add their own. */
+static int sector_mesh(const struct world *world, struct worldmesh *mesh,
+	const struct map_sector *sec)
+{
+	static const GLfloat up[3] = { 0.0, 1.0, 0.0 };
+	static const GLfloat down[3] = { 0.0, -1.0, 0.0 };
+	const struct map *map = &world->map;
 	unsigned i;
-	const struct sector_vertex *last = &sec->sides_xy[sec->num_sides - 1];
+	long v, first = 0;
+
+	if (!sec->num_walls)
+		return 0;
+	const struct map_vertex *last = map_wall_vertex(map, sec,
+		sec->num_walls - 1);
+	unsigned floor_texture = texture_slot(world, sec->floor_texture);
+	unsigned ceil_texture = texture_slot(world, sec->ceil_texture);
 	GLfloat floor_height = sec->floor_height;
 	GLfloat ceil_height = sec->ceil_height;
-#if 0 /* use colors */
-	const GLfloat colors[][3] = {
-		{ 1.0, 1.0, 1.0, },
-		{ 0.0, 1.0, 1.0, },
-		{ 1.0, 0.0, 1.0, },
-		{ 1.0, 1.0, 0.0, },
-		{ 1.0, 0.0, 0.0, },
-		{ 0.0, 1.0, 0.0, },
-		{ 0.0, 0.0, 1.0, },
-
-		{ 0.5, 0.5, 0.5, },
-		{ 0.0, 0.5, 0.5, },
-		{ 0.5, 0.0, 0.5, },
-		{ 0.5, 0.5, 0.0, },
-		{ 0.5, 0.0, 0.0, },
-		{ 0.0, 0.5, 0.0, },
-		{ 0.0, 0.0, 0.5, },
-	};
-#endif
 
-	/* draw floor and ceiling */
 	// TODO: floor and ceiling could be portals too...
-
-	/* draw floor */
-	glBindTexture(GL_TEXTURE_2D, world->tex_ids[0]);
-	glEnable(GL_TEXTURE_2D);
-	if (sec->num_sides > 2) { /* sector must be a real polygon */
-		glBegin(GL_TRIANGLE_FAN);
-		/* this moves in counter-clockwise order */
-		for (i = 0; i < sec->num_sides; i++) {
-			const struct sector_vertex *cur = &sec->sides_xy[i];
-			glTexCoord2f(cur->x, cur->y);
-			glVertex3f(cur->x, floor_height, cur->y);
+	if (sec->num_walls > 2) { /* sector must be a real polygon */
+		/* the floor is a fan in counter-clockwise order */
+		for (i = 0; i < sec->num_walls; i++) {
+			const struct map_vertex *cur = map_wall_vertex(map,
+				sec, i);
+			v = sector_vertex(mesh, cur->x, floor_height, cur->y, up,
+				cur->x, cur->y, floor_texture);
+			if (v < 0)
+				return -1;
+			if (!i)
+				first = v;
+			else if (i > 1 && worldmesh_triangle(mesh,
+				floor_texture, first, v - 1, v))
+				return -1;
 		}
-		glEnd();
-	}
-	/* draw ceiling */
-	glBindTexture(GL_TEXTURE_2D, world->tex_ids[1]);
-	glEnable(GL_TEXTURE_2D);
-	if (sec->num_sides > 2) { /* sector must be a real polygon */
-		glBegin(GL_TRIANGLE_FAN);
-		/* this moves in a clock-wise order */
-		for (i = sec->num_sides; i-- > 0; ) {
-			const struct sector_vertex *cur = &sec->sides_xy[i];
-			glTexCoord2f(cur->x, cur->y);
-			glVertex3f(cur->x, ceil_height, cur->y);
+		/* the ceiling goes around the other way to face down */
+		for (i = sec->num_walls; i-- > 0; ) {
+			const struct map_vertex *cur = map_wall_vertex(map,
+				sec, i);
+			v = sector_vertex(mesh, cur->x, ceil_height, cur->y, down,
+				cur->x, cur->y, ceil_texture);
+			if (v < 0)
+				return -1;
+			if (i == sec->num_walls - 1)
+				first = v;
+			else if (i < sec->num_walls - 2 && worldmesh_triangle(
+				mesh, ceil_texture, first, v - 1, v))
+				return -1;
 		}
-		glEnd();
 	}
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	/* draw each wall */
-	for (i = 0; i < sec->num_sides; i++) {
-		const struct sector_vertex *cur = &sec->sides_xy[i];
-		unsigned short destination_sector = sec->destination_sector[i];
-		if (destination_sector == SECTOR_NONE) {
-			// TODO: don't use immediate mode!
-#if 1 /* use textures */
-			glBindTexture(GL_TEXTURE_2D, world->tex_ids[i % world->num_textures]);
-			glEnable(GL_TEXTURE_2D);
-			glBegin(GL_TRIANGLE_STRIP);
-#endif
-#if 0 /* use colors */
-			glColor3fv(colors[sec->color[i] % ARRAY_SIZE(colors)]);
-#endif
-			/* find the length of the wall */
-			GLfloat x = last->x - cur->x;
-			GLfloat y = last->y - cur->y;
-			GLfloat length = sqrt(x*x + y*y);
-			/* draw simple repeating texture coordinates for a wall texture */
-			glTexCoord2f(length, ceil_height);
-			glVertex3f(last->x, ceil_height, last->y);
-			glTexCoord2f(0.0, ceil_height);
-			glVertex3f(cur->x, ceil_height, cur->y);
-			glTexCoord2f(length, floor_height);
-			glVertex3f(last->x, floor_height, last->y);
-			glTexCoord2f(0.0, floor_height);
-			glVertex3f(cur->x, floor_height, cur->y);
-			glEnd();
-			glBindTexture(GL_TEXTURE_2D, 0);
-			glDisable(GL_TEXTURE_2D);
-		} else if (ttl > 0) { /* only recurse if ttl > 0 */
-			// debug("portal %d = %hu\n", i, destination_sector);
-			const struct map_sector *newsec =
-				sector_get(destination_sector);
-			/* let the depth buffer mask off the room */
-			// TODO: optimize with a scissor test of the wall's bbox
-			// TODO: add additional modelview matrix
-			// TODO: draw front and back with gluNewTess()
-			/* recurse into the portal */
-			sector_gen_visible(newsec, ttl - 1);
+
+	/* each solid wall is a quad */
+	for (i = 0; i < sec->num_walls; i++) {
+		const struct map_vertex *cur = map_wall_vertex(map, sec, i);
+		unsigned slot = texture_slot(world,
+			map_wall_texture(map, sec, i));
+		/* find the length of the wall */
+		GLfloat x = last->x - cur->x;
+		GLfloat y = last->y - cur->y;
+		GLfloat length = sqrt(x*x + y*y);
+
+		if (map_wall_portal(map, sec, i) != MAP_NONE ||
+			!(length > 0.0)) {
+			last = cur;
+			continue;
 		}
+		/* the wall faces into the sector */
+		const GLfloat normal[3] = { -y / length, 0.0, x / length };
+		/* simple repeating texture coordinates for a wall texture */
+		if ((v = sector_vertex(mesh, last->x, ceil_height, last->y,
+			normal, length, ceil_height, slot)) < 0 ||
+			sector_vertex(mesh, cur->x, ceil_height, cur->y,
+			normal, 0.0, ceil_height, slot) < 0 ||
+			sector_vertex(mesh, last->x, floor_height, last->y,
+			normal, length, floor_height, slot) < 0 ||
+			sector_vertex(mesh, cur->x, floor_height, cur->y,
+			normal, 0.0, floor_height, slot) < 0)
+			return -1;
+		if (worldmesh_triangle(mesh, slot, v, v + 1, v + 2) ||
+			worldmesh_triangle(mesh, slot, v + 2, v + 1, v + 3))
+			return -1;
 		last = cur;
 	}
+	return 0;
 }
 
-/* ptr must be a pointer to a pointer. void**, int**, etc. */
-int grow(void *ptr, unsigned *max, unsigned min, size_t elem)
+/* add sector n of the world in arg to the mesh of its page, runs on the
+ * page loader */
+static int world_page_build(struct worldmesh *mesh, unsigned n, void *arg)
 {
-	/* the formula below can't handle large min. */
-	if (min > INT_MAX) {
-		errno = EINVAL;
-		return -1;
-	}
+	const struct world *world = arg;
+	const struct map_sector *sec = map_sector(&world->map, n);
 
-	size_t old_size = *max * elem;
-	size_t new_size = min * elem;
-
-	/* round up to next power of 2 (limited to 32-bits) */
-	new_size--;
-	new_size |= new_size >> 1;
-	new_size |= new_size >> 2;
-	new_size |= new_size >> 4;
-	new_size |= new_size >> 8;
-	new_size |= new_size >> 16;
-	new_size++;
-
-	unsigned tmpmax = new_size / elem;
-	new_size = tmpmax * elem;
-	if (new_size <= old_size)
-		return 0; /* no need to grow this one */
-
-	void *p = realloc(*(void**)ptr, new_size);
-	if (!p)
-		return -1;
-	memset((char*)p + old_size, 0, new_size - old_size);
-	*max = tmpmax;
-	*(void**)ptr = p;
-	return 0;
+	/* a missing sector still takes its number, it just has nothing */
+	if (!sec) {
+		warn("%s:sector #%u is corrupt\n", config.map, n);
+		return 0;
+	}
+	return sector_mesh(world, mesh, sec);
 }
 
-/* add sector to world */
-static int world_sector_add(struct world *world, unsigned n,
-	const struct map_sector *sec)
+struct world *world_new(struct threadpool *pool, const char *mapfile)
 {
-	int e = grow(&world->sectors, &world->max_sectors,
-		n + 1, sizeof(*world->sectors));
-	if (e) {
-		error("Unable to allocate sector!\n");
-		return -1;
+	struct world *world = calloc(1, sizeof(*world));
+	world->pool = pool;
+	if (map_open(&world->map, mapfile))
+		die("Unable to load map \"%s\"\n", mapfile);
+	info("%s:%u sectors, %u walls, %u textures\n", mapfile,
+		world->map.num_sectors, world->map.num_walls,
+		world->map.num_textures);
+	texcache_init(&world->textures, (size_t)config.texture_budget << 20,
+		pool);
+	world->textures.upload_budget = (size_t)config.upload_budget << 10;
+	unsigned tex_max = world->map.num_textures;
+	if (!tex_max)
+		die("%s:map has no textures\n", mapfile);
+	world->num_textures = tex_max;
+	world->tex_handles = calloc(tex_max, sizeof(*world->tex_handles));
+	assert(world->tex_handles != NULL);
+	world->max_visited = world->map.num_sectors;
+	world->visited = calloc(world->max_visited + 1,
+		sizeof(*world->visited));
+	assert(world->visited != NULL);
+	if (worldcache_init(&world->pages, &world->map, tex_max, PAGE_REACH,
+		(size_t)config.world_budget << 20,
+		(size_t)config.upload_budget << 10, world_page_build, world))
+		die("Unable to allocate the world pages\n");
+
+	unsigned i;
+	for (i = 0; i < tex_max; i++) {
+		const char *path = map_texture(&world->map, i);
+		if (!path)
+			die("%s:texture #%u is corrupt\n", mapfile, i);
+		world->tex_handles[i] = texcache_acquire(&world->textures,
+			path);
+	}
+	world->walls_held = true;
+	Uint64 start = SDL_GetPerformanceCounter();
+	if (texcache_load(&world->textures))
+		die("Unable to load world textures\n");
+	if (world->textures.upload_budget)
+		world->stream_start = start;
+	else
+		info("Loaded %u textures (%zu KiB) in %.1fms\n", tex_max,
+			world->textures.bytes >> 10,
+			(SDL_GetPerformanceCounter() - start) * 1000.0 /
+			SDL_GetPerformanceFrequency());
+
+	if (config.use_glsl) {
+		bool texture_array = texarray_supported();
+		world->shader = shader_new(texture_array);
+		if (!world->shader)
+			warn("GLSL unavailable, using fixed-function pipeline\n");
+		else
+			world->pack_walls = texture_array;
 	}
-	assert(world->sectors != NULL);
-	assert(world->max_sectors > n);
+	world_textures_update(world);
+	if (sectorgrid_build(&world->grid, &world->map))
+		die("Unable to index the map\n");
+	if (map_pvs_depth(&world->map) >= VIEW_DEPTH) {
+		world->pvs = malloc(map_pvs_bytes(&world->map));
+		world->pvs_sector = MAP_NONE;
+	} else if (map_pvs_depth(&world->map)) {
+		info("%s:PVS is only %u portals deep, not using it\n", mapfile,
+			map_pvs_depth(&world->map));
+	}
+	occlusion_init(&world->occlusion);
+	streambuf_init(&world->stream, GL_ARRAY_BUFFER, STREAM_SIZE);
+
+	return world;
+}
+
+/* stops the loader threads, call while the GL context and the thread pool
+ * are still around. */
+void world_free(struct world *world)
+{
+	struct frame_jobs *jobs = &world->jobs;
+	unsigned i;
 
-	struct wsector *wsec = &world->sectors[n];
-	wsec->display_list = glGenLists(1);
-	glNewList(wsec->display_list, GL_COMPILE);
-	sector_gen_visible(sec, 0);
-	glEndList();
+	worldcache_free(&world->pages);
+	world_walls_hold(world, false);
+	texcache_free(&world->textures);
+	free(world->tex_handles);
+	texarray_free(&world->walls);
+	shader_free(world->shader);
+	occlusion_free(&world->occlusion);
+	streambuf_free(&world->stream);
+	rq_free(&world->queue);
+	for (i = 0; i < jobs->max_bufs; i++)
+		cmdbuf_free(&jobs->bufs[i]);
+	free(jobs->bufs);
+	free(jobs->stats);
+	free(jobs->visits);
+	free(jobs->queue);
+	free(jobs->scissors);
+	for (i = 0; i < world->max_models; i++)
+		model_free(world->models[i]);
+	free(world->models);
+	free(world->sprites);
+	free(world->cull.spheres);
+	free(world->cull.visible);
+	free(world->visited);
+	free(world->pvs);
+	sectorgrid_free(&world->grid);
+	map_close(&world->map);
+	free(world);
+}
 
-	return 0; /* success */
+static int world_light_add(struct world *world, const struct light *light)
+{
+	if (world->num_lights >= MAX_LIGHTS) {
+		warn("Too many lights, limit is %d\n", MAX_LIGHTS);
+		return -1;
+	}
+	world->lights[world->num_lights++] = *light;
+	return 0;
 }
 
 static int world_model_add(struct world *world, unsigned n, const char *filename)
@@ -428,30 +650,334 @@ static int world_model_add(struct world *world, unsigned n, const char *filename
 	return 0;
 }
 
+static int world_sprite_add(struct world *world, unsigned model_num,
+	GLdouble x, GLdouble y, GLdouble z, GLfloat scale)
+{
+	unsigned n = world->num_sprites;
+	int e = grow(&world->sprites, &world->max_sprites,
+		n + 1, sizeof(*world->sprites));
+	if (e) {
+		error("Unable to allocate sprite!\n");
+		return -1;
+	}
+	if (model_num >= world->max_models || !world->models[model_num]) {
+		warn("Sprite #%u uses empty model slot #%u\n", n, model_num);
+		return -1;
+	}
+
+	struct sprite *sprite = &world->sprites[n];
+	sprite->x = x;
+	sprite->y = y;
+	sprite->z = z;
+	sprite->scale = scale;
+	sprite->model_num = model_num;
+	world->num_sprites = n + 1;
+	return 0;
+}
+
 /** MVC: View - take the model and show it **/
 
-/* draw one sector */
-static void sector_draw(struct game_state *state, const struct map_sector *sec, int ttl)
+#define NEAR_PLANE 0.125 /* how close you can get before it's clipped. */
+#define FAR_PLANE 1000.0 /* how far you can see before it's clipped. */
+
+/* distance from the player's eye to a point in world coordinates */
+static GLfloat eye_distance(const struct game_state *state,
+	GLfloat x, GLfloat y, GLfloat z)
+{
+	GLfloat dx = x - state->player_x;
+	GLfloat dy = y - (state->player_floor + state->player_height +
+		state->player_z);
+	GLfloat dz = z - state->player_y;
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+/* record the draw commands for the visible sectors of one world page: one
+ * item for each texture and scissor box, with every texture in the same
+ * item when the shader can pick the layer of world->walls. the boxes are
+ * in the order they were first seen, which is roughly front to back.
+ * -1 if the queue is full. */
+static int page_record(struct worldmesh *mesh, bool layered,
+	const struct frame_jobs *jobs)
+{
+	unsigned i, num_batches;
+
+	if (worldmesh_visible_end(mesh, layered))
+		return 0;
+	const struct worldmesh_batch *batches = worldmesh_batches(mesh,
+		&num_batches);
+	for (i = 0; i < num_batches; i++) {
+		const struct worldmesh_batch *batch = &batches[i];
+		struct rq_item *item = rq_add(&world->queue);
+		if (!item)
+			return -1;
+		item->type = RQ_DRAW_RANGES;
+		if (layered) {
+			item->texture = world->walls.id;
+			item->texture_array = true;
+		} else {
+			item->texture = texcache_id(&world->textures,
+				world->tex_handles[batch->texture]);
+		}
+		item->material = MATERIAL_WORLD;
+		if (batch->group) {
+			item->has_scissor = true;
+			memcpy(item->scissor, jobs->scissors[batch->group],
+				sizeof(item->scissor));
+		}
+		item->u.ranges.mesh = mesh;
+		item->u.ranges.counts = batch->counts;
+		item->u.ranges.offsets = batch->offsets;
+		item->u.ranges.num = batch->num;
+		item->key = rq_key(RQ_PASS_OPAQUE, 0, item->texture,
+			item->material, batch->group, jobs->num_scissors);
+	}
+	return 0;
+}
+
+/* record the world's draw commands, page by page */
+static void sectors_record(const struct game_state *state,
+	const struct frame_jobs *jobs)
 {
+	bool layered = walls_layered(state);
 	unsigned i;
-	/* limit our depth */
-	if (ttl < 0)
-		return;
+
+	for (i = 0; i < world->pages.num_drawn; i++) {
+		unsigned p = world->pages.drawn[i];
+		if (page_record(world->pages.pages[p].mesh, layered, jobs))
+			return;
+	}
+}
+
+/* screen extent of wall i of a sector. walls crossing the near plane
+ * cover the whole screen, walls entirely behind it are empty. */
+static struct screen_rect portal_rect(const float clip[16],
+	const struct map_sector *sec, unsigned i)
+{
+	const struct map *map = &world->map;
+	const struct map_vertex *v[2] = {
+		map_wall_vertex(map, sec, i ? i - 1 : sec->num_walls - 1),
+		map_wall_vertex(map, sec, i),
+	};
+	struct screen_rect r = { 1.0f, 1.0f, -1.0f, -1.0f };
+	unsigned j, behind = 0;
+
+	for (j = 0; j < 4; j++) {
+		GLfloat x = v[j / 2]->x, z = v[j / 2]->y;
+		GLfloat y = j % 2 ? sec->ceil_height : sec->floor_height;
+		GLfloat cx = clip[0] * x + clip[4] * y + clip[8] * z + clip[12];
+		GLfloat cy = clip[1] * x + clip[5] * y + clip[9] * z + clip[13];
+		GLfloat cw = clip[3] * x + clip[7] * y + clip[11] * z + clip[15];
+		if (cw < NEAR_PLANE) {
+			behind++;
+			continue;
+		}
+		cx /= cw;
+		cy /= cw;
+		if (cx < r.x0) r.x0 = cx;
+		if (cx > r.x1) r.x1 = cx;
+		if (cy < r.y0) r.y0 = cy;
+		if (cy > r.y1) r.y1 = cy;
+	}
+	if (behind == 4)
+		return (struct screen_rect){ 1.0f, 1.0f, -1.0f, -1.0f };
+	if (behind)
+		return (struct screen_rect){ -1.0f, -1.0f, 1.0f, 1.0f };
+	return r;
+}
+
+static GLint box_area(const GLint box[4])
+{
+	return box[2] * box[3];
+}
+
+/* the smallest box holding a and b */
+static void box_union(GLint u[4], const GLint a[4], const GLint b[4])
+{
+	GLint x0 = a[0] < b[0] ? a[0] : b[0];
+	GLint y0 = a[1] < b[1] ? a[1] : b[1];
+	GLint x1 = a[0] + a[2] > b[0] + b[2] ? a[0] + a[2] : b[0] + b[2];
+	GLint y1 = a[1] + a[3] > b[1] + b[3] ? a[1] + a[3] : b[1] + b[3];
+
+	u[0] = x0;
+	u[1] = y0;
+	u[2] = x1 - x0;
+	u[3] = y1 - y0;
+}
+
+/* the scissor group of a sector that can be seen through rect, 0 if the
+ * box is the whole view or scissoring is off. each group is one draw call
+ * per texture, so boxes are snapped out to a grid of SCISSOR_GRID cells
+ * and a box joins a group when their union is no bigger than the two of
+ * them apart. past MAX_SCISSORS groups it joins the one that grows the
+ * least. a box that is too big only costs fill, the depth test keeps the
+ * picture the same. */
+static unsigned scissor_group(struct frame_jobs *jobs,
+	const struct screen_rect *r)
+{
+	const struct game_state *state = jobs->state;
+	GLint x0 = floorf((r->x0 + 1.0f) * 0.5f * SCISSOR_GRID);
+	GLint y0 = floorf((r->y0 + 1.0f) * 0.5f * SCISSOR_GRID);
+	GLint x1 = ceilf((r->x1 + 1.0f) * 0.5f * SCISSOR_GRID);
+	GLint y1 = ceilf((r->y1 + 1.0f) * 0.5f * SCISSOR_GRID);
+	unsigned i, best = 0;
+	GLint best_growth = 0;
+
+	if (!state->scissor)
+		return 0;
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > SCISSOR_GRID) x1 = SCISSOR_GRID;
+	if (y1 > SCISSOR_GRID) y1 = SCISSOR_GRID;
+	if (x0 == 0 && y0 == 0 && x1 == SCISSOR_GRID && y1 == SCISSOR_GRID)
+		return 0;
+	/* cells to window pixels */
+	x0 = x0 * (GLint)state->win_w / SCISSOR_GRID;
+	y0 = y0 * (GLint)state->win_h / SCISSOR_GRID;
+	x1 = x1 * (GLint)state->win_w / SCISSOR_GRID;
+	y1 = y1 * (GLint)state->win_h / SCISSOR_GRID;
+	const GLint box[4] = { state->win_x + x0, state->win_y + y0,
+		x1 - x0, y1 - y0 };
+	for (i = 1; i < jobs->num_scissors; i++) {
+		GLint u[4];
+		box_union(u, jobs->scissors[i], box);
+		GLint growth = box_area(u) - box_area(jobs->scissors[i]) -
+			box_area(box);
+		if (!best || growth < best_growth) {
+			best = i;
+			best_growth = growth;
+		}
+	}
+	if (!best || (best_growth > 0 && jobs->num_scissors <= MAX_SCISSORS)) {
+		if (grow(&jobs->scissors, &jobs->max_scissors, i + 1,
+			sizeof(*jobs->scissors)))
+			return 0; /* draw it unclipped */
+		memcpy(jobs->scissors[i], box, sizeof(box));
+		jobs->num_scissors = i + 1;
+		return i;
+	}
+	box_union(jobs->scissors[best], jobs->scissors[best], box);
+	return best;
+}
+
+static bool rect_empty(const struct screen_rect *r)
+{
+	return r->x0 >= r->x1 || r->y0 >= r->y1;
+}
+
+static struct screen_rect rect_intersect(const struct screen_rect *a,
+	const struct screen_rect *b)
+{
+	return (struct screen_rect){
+		fmaxf(a->x0, b->x0), fmaxf(a->y0, b->y0),
+		fminf(a->x1, b->x1), fminf(a->y1, b->y1),
+	};
+}
+
+static bool rect_contains(const struct screen_rect *a,
+	const struct screen_rect *b)
+{
+	return b->x0 >= a->x0 && b->y0 >= a->y0 &&
+		b->x1 <= a->x1 && b->y1 <= a->y1;
+}
+
+/* sector n can be seen through rect with ttl portals to go. the first time
+ * adds it to the visible sectors, and every time it shows more than before
+ * it is queued to look through its portals again. -1 on error. */
+static int sector_reach(struct frame_jobs *jobs, unsigned *num_queue,
+	const struct map_sector *sec, unsigned n, const struct screen_rect *rect,
+	int ttl)
+{
+	struct sector_mark *mark = &world->visited[n];
+	struct sector_visit *visit;
+
+	if (mark->frame != world->frame) {
+		if (grow(&jobs->visits, &jobs->max_visits, jobs->num_visits + 1,
+			sizeof(*jobs->visits)))
+			return -1;
+		mark->frame = world->frame;
+		mark->visit = jobs->num_visits++;
+		visit = &jobs->visits[mark->visit];
+		*visit = (struct sector_visit){ sec, ttl, *rect };
+	} else {
+		visit = &jobs->visits[mark->visit];
+		if (ttl <= visit->ttl && rect_contains(&visit->rect, rect))
+			return 0; /* nothing new to see */
+		if (ttl > visit->ttl)
+			visit->ttl = ttl;
+		visit->rect.x0 = fminf(visit->rect.x0, rect->x0);
+		visit->rect.y0 = fminf(visit->rect.y0, rect->y0);
+		visit->rect.x1 = fmaxf(visit->rect.x1, rect->x1);
+		visit->rect.y1 = fmaxf(visit->rect.y1, rect->y1);
+	}
+	if (grow(&jobs->queue, &jobs->max_queue, *num_queue + 1,
+		sizeof(*jobs->queue)))
+		return -1;
+	jobs->queue[(*num_queue)++] = *visit;
+	return 0;
+}
+
+/* the sectors that may be visible from sector n, as a bitset. NULL if there
+ * is no PVS or it is off. */
+static const unsigned char *sector_pvs(const struct game_state *state,
+	unsigned n)
+{
+	if (!world->pvs || !state->pvs)
+		return NULL;
+	if (world->pvs_sector != n) {
+		world->pvs_sector = n;
+		if (map_pvs_row(&world->map, n, world->pvs)) {
+			warn("PVS of sector #%u is corrupt\n", n);
+			memset(world->pvs, 0xff, map_pvs_bytes(&world->map));
+		}
+	}
+	return world->pvs;
+}
+
+/* find every sector that can be seen within ttl portals of sec, each one
+ * only once. sectors the PVS rules out are skipped before anything else.
+ * each portal clips the view to its extent on the screen, and only portals
+ * that are still on screen are followed, so the work depends on what is
+ * visible rather than on how the sectors link up. */
+static void sectors_visit(struct frame_jobs *jobs, const struct map_sector *sec,
+	int ttl)
+{
+	static const struct screen_rect screen = { -1.0f, -1.0f, 1.0f, 1.0f };
+	unsigned i, j, num_queue = 0;
+
+	jobs->num_visits = 0;
 	if (!sec)
 		return; /* TODO: maybe draw some empty void? */
-	/* draw the entire room */
-	glCallList(world->sectors[sec->sector_number].display_list);
-	/* find any portals for this room and draw them */
-	for (i = 0; i < sec->num_sides; i++) {
-		unsigned short destination_sector = sec->destination_sector[i];
-
-		/* only recurse if ttl > 0 */
-		if (destination_sector != SECTOR_NONE && ttl > 0) {
-			const struct map_sector *newsec =
-				sector_get(destination_sector);
-			sector_draw(state, newsec, ttl - 1);
+	unsigned n = map_sector_number(&world->map, sec);
+	const unsigned char *pvs = sector_pvs(jobs->state, n);
+	if (sector_reach(jobs, &num_queue, sec, n, &screen, ttl))
+		goto fail;
+	for (i = 0; i < num_queue; i++) {
+		const struct sector_visit cur = jobs->queue[i];
+		/* limit our depth */
+		if (cur.ttl <= 0)
+			continue;
+		/* look through every portal of this room that is on screen */
+		for (j = 0; j < cur.sec->num_walls; j++) {
+			unsigned portal = map_wall_portal(&world->map, cur.sec, j);
+			if (portal == MAP_NONE)
+				continue;
+			const struct map_sector *newsec = sector_get(portal);
+			if (!newsec || portal >= world->max_visited)
+				continue;
+			if (pvs && !(pvs[portal / 8] & 1 << portal % 8))
+				continue;
+			struct screen_rect r = portal_rect(jobs->clip, cur.sec, j);
+			r = rect_intersect(&r, &cur.rect);
+			if (rect_empty(&r))
+				continue;
+			if (sector_reach(jobs, &num_queue, newsec, portal, &r,
+				cur.ttl - 1))
+				goto fail;
 		}
 	}
+	return;
+fail:
+	error("Unable to allocate visible sector list!\n");
 }
 
 static void sector_print(const struct map_sector *sec)
@@ -460,12 +986,305 @@ static void sector_print(const struct map_sector *sec)
 
 	// TODO: print more information
 	debug("dest:");
-	for (i = 0; i < sec->num_sides; i++) {
-		debug(" %hx", sec->destination_sector[i]);
+	for (i = 0; i < sec->num_walls; i++) {
+		debug(" %x", map_wall_portal(&world->map, sec, i));
 	}
 	debug("\n");
 }
 
+/* model matrix: translate then uniform scale */
+static void sprite_matrix(const struct sprite *sprite, GLfloat m[16])
+{
+	memset(m, 0, 16 * sizeof(*m));
+	m[0] = m[5] = m[10] = sprite->scale;
+	m[12] = sprite->x;
+	m[13] = sprite->z;
+	m[14] = sprite->y;
+	m[15] = 1.0;
+}
+
+/* record the sprites of one batch that are inside the view frustum */
+static void sprites_record(struct frame_jobs *jobs, unsigned batch,
+	struct cmdbuf *buf, struct cull_stats *stats)
+{
+	const struct game_state *state = jobs->state;
+	struct sprite_cull *cull = &world->cull;
+	unsigned i, first = batch * SPRITE_BATCH;
+	unsigned n = world->num_sprites - first;
+
+	if (n > SPRITE_BATCH)
+		n = SPRITE_BATCH;
+	GLfloat *sx = cull->spheres;
+	GLfloat *sy = sx + cull->max_spheres;
+	GLfloat *sz = sy + cull->max_spheres;
+	GLfloat *sr = sz + cull->max_spheres;
+
+	/* world space bounding spheres of the model's box */
+	for (i = first; i < first + n; i++) {
+		const struct sprite *sprite = &world->sprites[i];
+		const struct model *model = world->models[sprite->model_num];
+		const float *min = model->bounding_box.min;
+		const float *max = model->bounding_box.max;
+		GLfloat dx = max[0] - min[0], dy = max[1] - min[1],
+			dz = max[2] - min[2];
+		sx[i] = sprite->x + sprite->scale * (min[0] + max[0]) / 2;
+		sy[i] = sprite->z + sprite->scale * (min[1] + max[1]) / 2;
+		sz[i] = sprite->y + sprite->scale * (min[2] + max[2]) / 2;
+		sr[i] = sprite->scale * sqrtf(dx * dx + dy * dy + dz * dz) / 2;
+	}
+
+	if (state->culling) {
+		frustum_cull_spheres(&jobs->view, n, sx + first, sy + first,
+			sz + first, sr + first, cull->visible + first, stats);
+	} else {
+		memset(cull->visible + first, 1, n);
+	}
+
+	for (i = first; i < first + n; i++) {
+		if (!cull->visible[i]) {
+			/* an old result is no use once it comes back into view */
+			occlusion_forget(&world->occlusion, i);
+			continue;
+		}
+		const struct sprite *sprite = &world->sprites[i];
+		struct model *model = world->models[sprite->model_num];
+
+		GLfloat m[16];
+		sprite_matrix(sprite, m);
+		struct frustum local;
+		frustum_transform(&local, &jobs->view, m);
+		if (state->culling) {
+			if (!frustum_test_aabb(&local, model->bounding_box.min,
+				model->bounding_box.max)) {
+				stats->culled_box++;
+				cull->visible[i] = 0; /* don't query it either */
+				occlusion_forget(&world->occlusion, i);
+				continue;
+			}
+			stats->visible++;
+		}
+
+		/* the box was hidden the last time we had a result */
+		if (state->occlusion &&
+			!occlusion_visible(&world->occlusion, i)) {
+			stats->occluded++;
+			continue;
+		}
+
+		/* record each object that is inside the frustum */
+		GLfloat depth = eye_distance(state, sx[i], sy[i], sz[i]);
+		int j;
+		for (j = 0; j < model->nr_object; j++) {
+			const struct object *obj = &model->object[j];
+			if (state->culling) {
+				stats->objects_tested++;
+				if (!frustum_test_aabb(&local,
+					obj->bounding_box.min,
+					obj->bounding_box.max)) {
+					stats->objects_culled++;
+					continue;
+				}
+			}
+			struct rq_item *item = cmdbuf_add(buf);
+			if (!item)
+				return;
+			item->type = RQ_DRAW_OBJECT;
+			item->texture = 0;
+			item->material = MATERIAL_TEAPOT;
+			item->u.obj.model = model;
+			item->u.obj.object = j;
+			item->has_matrix = true;
+			memcpy(item->matrix, m, sizeof(item->matrix));
+			item->key = rq_key(RQ_PASS_OPAQUE, 0, item->texture,
+				item->material, depth, FAR_PLANE);
+		}
+	}
+}
+
+/* fill the command buffer of one sprite batch, called on the worker
+ * threads. */
+static void frame_record_job(void *arg, unsigned batch)
+{
+	struct frame_jobs *jobs = arg;
+	struct cmdbuf *buf = &jobs->bufs[batch];
+
+	cmdbuf_reset(buf);
+	sprites_record(jobs, batch, buf, &jobs->stats[batch]);
+}
+
+static void cull_stats_add(struct cull_stats *total,
+	const struct cull_stats *s)
+{
+	total->tested += s->tested;
+	total->culled_sphere += s->culled_sphere;
+	total->culled_box += s->culled_box;
+	total->visible += s->visible;
+	total->occluded += s->occluded;
+	total->objects_tested += s->objects_tested;
+	total->objects_culled += s->objects_culled;
+}
+
+/* find what is visible and add its draw commands to world->queue. the
+ * sectors are a handful of items made here, the sprites are recorded on the
+ * worker threads and their buffers are appended in a fixed order, so the
+ * frame doesn't depend on which thread recorded what.
+ * expects the modelview matrix to hold the camera. */
+static void frame_record(struct game_state *state)
+{
+	struct frame_jobs *jobs = &world->jobs;
+	struct sprite_cull *cull = &world->cull;
+	unsigned i, n = world->num_sprites;
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	/* everything that needs GL is done here, before the workers start */
+	jobs->state = state;
+	frustum_from_gl(&jobs->view, jobs->clip);
+	occlusion_frame(&world->occlusion);
+	occlusion_collect(&world->occlusion);
+
+	world->frame++;
+	worldcache_center(&world->pages, state->player_sector);
+	worldcache_update(&world->pages);
+	worldcache_frame(&world->pages, world->frame);
+	sectors_visit(jobs, sector_get(state->player_sector), VIEW_DEPTH);
+	/* stream in what can be seen first */
+	jobs->num_scissors = 1;
+	for (i = 0; i < jobs->num_visits; i++) {
+		const struct sector_visit *visit = &jobs->visits[i];
+		unsigned j, num, index, sec = map_sector_number(&world->map,
+			visit->sec);
+		struct worldmesh *mesh = worldcache_mesh(&world->pages, sec,
+			&index);
+		if (!mesh)
+			continue;
+		const struct worldmesh_range *r = worldmesh_sector(mesh, index,
+			&num);
+		for (j = 0; j < num; j++)
+			texcache_touch(&world->textures,
+				world->tex_handles[r[j].texture], world->frame);
+		worldmesh_visible_add(mesh, index,
+			scissor_group(jobs, &visit->rect));
+	}
+	world_walls_hold(world, !walls_layered(state));
+	world_textures_update(world);
+	sectors_record(state, jobs);
+
+	jobs->num_batches = (n + SPRITE_BATCH - 1) / SPRITE_BATCH;
+	unsigned num_bufs = jobs->num_batches;
+	if (grow(&cull->spheres, &cull->max_spheres, n,
+		4 * sizeof(*cull->spheres)) ||
+		grow(&cull->visible, &cull->max_visible, n,
+		sizeof(*cull->visible)) ||
+		grow(&jobs->bufs, &jobs->max_bufs, num_bufs,
+		sizeof(*jobs->bufs)) ||
+		grow(&jobs->stats, &jobs->max_stats, jobs->num_batches,
+		sizeof(*jobs->stats))) {
+		error("Unable to allocate frame recording data!\n");
+		return;
+	}
+	memset(jobs->stats, 0, jobs->num_batches * sizeof(*jobs->stats));
+
+	threadpool_run(world->pool, num_bufs, frame_record_job, jobs);
+
+	memset(&state->cull_stats, 0, sizeof(state->cull_stats));
+	for (i = 0; i < jobs->num_batches; i++)
+		cull_stats_add(&state->cull_stats, &jobs->stats[i]);
+	for (i = 0; i < num_bufs; i++)
+		rq_append(&world->queue, jobs->bufs[i].items,
+			jobs->bufs[i].num_items);
+	debug("record: sectors=%u pages=%u scissors=%u batches=%u threads=%u "
+		"time=%.3fms\n", jobs->num_visits, world->pages.num_drawn,
+		jobs->num_scissors - 1, jobs->num_batches,
+		threadpool_size(world->pool),
+		(SDL_GetPerformanceCounter() - start) * 1000.0 /
+		SDL_GetPerformanceFrequency());
+}
+
+/* draw the box of every sprite that survived frustum culling into an
+ * occlusion query, the results decide what sprites_draw() skips next frame.
+ * must come after everything that can hide a sprite has been drawn. */
+static void sprites_query(struct game_state *state)
+{
+	struct sprite_cull *cull = &world->cull;
+	unsigned i;
+	/* eye in world coordinates */
+	const GLfloat eye[3] = { state->player_x,
+		state->player_floor + state->player_height + state->player_z,
+		state->player_y };
+
+	for (i = 0; i < world->num_sprites; i++) {
+		if (!cull->visible[i])
+			continue;
+		const struct sprite *sprite = &world->sprites[i];
+		const struct model *model = world->models[sprite->model_num];
+		const float *min = model->bounding_box.min;
+		const float *max = model->bounding_box.max;
+		GLfloat m[16];
+		sprite_matrix(sprite, m);
+
+		/* the near plane can cut into a box the eye is inside of or
+		 * very close to, the query would miss it. */
+		unsigned k;
+		bool inside = true;
+		for (k = 0; k < 3; k++) {
+			GLfloat lo = m[12 + k] + sprite->scale * min[k];
+			GLfloat hi = m[12 + k] + sprite->scale * max[k];
+			if (eye[k] < lo - 2 * NEAR_PLANE ||
+				eye[k] > hi + 2 * NEAR_PLANE)
+				inside = false;
+		}
+		if (inside) {
+			occlusion_forget(&world->occlusion, i);
+			continue;
+		}
+		occlusion_query_box(&world->occlusion, i, min, max, m);
+	}
+}
+
+/* invert a view matrix made of only rotations and translations */
+static void camera_from_view(GLfloat camera[16], const GLfloat view[16])
+{
+	unsigned i, j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++)
+			camera[i * 4 + j] = view[j * 4 + i];
+		camera[i * 4 + 3] = 0.0;
+	}
+	for (i = 0; i < 3; i++) {
+		camera[12 + i] = -(view[12] * camera[i] +
+			view[13] * camera[4 + i] + view[14] * camera[8 + i]);
+	}
+	camera[15] = 1.0;
+}
+
+/* load world->lights into the fixed-function lights.
+ * expects the modelview matrix to hold the camera. */
+static void lights_setup(bool lighting)
+{
+	unsigned i;
+
+	if (!lighting) {
+		glstate_disable(GL_LIGHTING);
+		return;
+	}
+	glstate_enable(GL_LIGHTING);
+	for (i = 0; i < MAX_LIGHTS; i++) {
+		GLenum id = GL_LIGHT0 + i;
+		if (i >= world->num_lights) {
+			glstate_disable(id);
+			continue;
+		}
+		const struct light *light = &world->lights[i];
+		glstate_enable(id);
+		glstate_lightfv(id, GL_AMBIENT, light->ambient);
+		glstate_lightfv(id, GL_DIFFUSE, light->diffuse);
+		glstate_lightfv(id, GL_SPECULAR, light->specular);
+		/* position is in world coordinates, set after the camera */
+		glstate_lightfv(id, GL_POSITION, light->position);
+	}
+}
+
 /* TODO: draw all sectors visible to player's camera */
 static void game_paint(void)
 {
@@ -473,105 +1292,111 @@ static void game_paint(void)
 	struct game_state *state = SDL_GetWindowData(win, "game");
 	SDL_assert(state != NULL);
 
+	glstate_stats_reset();
 	glScissor(state->win_x, state->win_y, state->win_w, state->win_h);
+	gputimer_begin(GPU_PASS_CLEAR);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
-	glCullFace(GL_BACK);
-	glEnable(GL_CULL_FACE);
-	glShadeModel(GL_SMOOTH);
-
-	if (state->lighting) {
-		glEnable(GL_LIGHTING);
-		glEnable(GL_LIGHT0);
-		GLfloat light_ambient[] = { 0.2f, 0.2f, 0.2f, 1.0f };
-		GLfloat light_diffuse[] = { 0.8f, 0.8f, 0.8, 1.0f };
-		GLfloat light_specular[] = { 0.5f, 0.5f, 0.5f, 1.0f };
-		GLfloat light_position[] = { -1.5f, 1.0f, -4.0f, 1.0f };
-		// Assign created components to GL_LIGHT0
-		glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);
-		glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
-		glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
-		glLightfv(GL_LIGHT0, GL_POSITION, light_position);
-	}
+	gputimer_end(GPU_PASS_CLEAR);
+	glstate_enable(GL_DEPTH_TEST);
+	glstate_depth_func(GL_LESS);
+	glstate_cull_face(GL_BACK);
+	glstate_enable(GL_CULL_FACE);
+	glstate_shade_model(GL_SMOOTH);
 
 	/* setup projection matrix */
-	glMatrixMode(GL_PROJECTION);
+	glstate_matrix_mode(GL_PROJECTION);
 	glLoadIdentity();
 
 	int width, height;
 	SDL_GetWindowSize(win, &width, &height);
 	double aspect_root = sqrt((double)width / (double)height);
-	double nearest = 0.125; /* how close you can get before it's clipped. */
+	double nearest = NEAR_PLANE;
 	glFrustum(-nearest * aspect_root, nearest * aspect_root,
-		-nearest / aspect_root, nearest / aspect_root, nearest, 1000.0);
+		-nearest / aspect_root, nearest / aspect_root, nearest, FAR_PLANE);
 
 	/* setup world coordinates */
-	glMatrixMode(GL_MODELVIEW);
+	glstate_matrix_mode(GL_MODELVIEW);
 
 	glLoadIdentity();
 	glRotatef(state->player_tilt, -1.0, 0.0, 0.0);
 	glRotatef(state->player_facing, 0.0, 1.0, 0.0);
-	glTranslatef(-state->player_x, -state->player_height - state->player_z,
+	glTranslatef(-state->player_x,
+		-state->player_floor - state->player_height - state->player_z,
 		-state->player_y);
-	/* draw up to 10 sectors deep */
-	if (state->lighting) {
-		GLfloat mat_ambient[] = { 0.3, 0.3, 0.3, 1.0 };
-		GLfloat mat_diffuse[] = { 0.8, 0.8, 0.8, 1.0 };
-		GLfloat mat_specular[] = { 1.0, 1.0, 1.0, 1.0 };
-		GLfloat mat_emission[] = { 0.0, 0.0, 0.0, 0.0 };
-		GLfloat mat_shininess = 50.0;
-		glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
-		glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
-		glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
-		glMaterialfv(GL_FRONT, GL_EMISSION, mat_emission);
-		glMaterialf(GL_FRONT, GL_SHININESS, mat_shininess);
-	}
-	glColor4f(1.0, 1.0, 1.0, 0.0);
-	sector_draw(state, sector_get(state->player_sector), 10);
-
-	/* draw a teapot */
-	debug("max_models=%d\n", world->max_models);
-	if (world->max_models > 0) {
-		/* Some test code to drop a teapot down, it's quite ugly */
-		glLoadIdentity();
-		GLdouble teapot_x, teapot_y;
-		sector_find_center(sector_get(0), &teapot_x, &teapot_y);
-		glRotatef(state->player_tilt, -1.0, 0.0, 0.0);
-		glRotatef(state->player_facing, 0.0, 1.0, 0.0);
-		glTranslatef(teapot_x - state->player_x,
-			-state->player_height / 2 - state->player_z,
-			teapot_y - state->player_y);
-		glScalef(0.25, 0.25, 0.25);
-
-		if (state->lighting) {
-			GLfloat mat_specular[] = { 1.0, 1.0, 1.0, 1.0 };
-			GLfloat mat_diffuse[] = { 0.9, 0.9, 0.2, 1.0 };
-			GLfloat mat_ambient[] = { 0.9, 0.9, 0.2, 1.0 };
-			GLfloat mat_emission[] = { 0.0, 0.0, 0.0, 1.0 };
-			GLfloat mat_shininess = 50.0;
-			glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
-			glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
-			glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
-			glMaterialfv(GL_FRONT, GL_EMISSION, mat_emission);
-			glMaterialf(GL_FRONT, GL_SHININESS, mat_shininess);
-		} else {
-			glColor3f(1.0, 1.0, 0.0);
-		}
 
-#if 1 /* teapot */
-		model_draw(world->models[0]);
-#else /* sphere */
-		GLUquadricObj *quadric = gluNewQuadric();
-		gluQuadricNormals(quadric, GLU_SMOOTH);
-		gluQuadricDrawStyle(quadric, GLU_FILL);
-		gluSphere(quadric, .5, 36, 18);
-		gluDeleteQuadric(quadric);
-#endif
+	struct shader *shader = state->use_shader ? world->shader : NULL;
+	if (shader) {
+		GLfloat view[16], camera[16];
+		glGetFloatv(GL_MODELVIEW_MATRIX, view);
+		camera_from_view(camera, view);
+		glstate_disable(GL_LIGHTING);
+		shader_begin(shader, camera, state->lighting,
+			world->lights, world->num_lights);
+	} else {
+		lights_setup(state->lighting);
+	}
+	/* collect, sort then draw everything */
+	rq_begin(&world->queue, materials, ARRAY_SIZE(materials));
+	frame_record(state);
+	debug("cull: tested=%u sphere=%u box=%u visible=%u occluded=%u "
+		"objects=%u culled=%u\n",
+		state->cull_stats.tested, state->cull_stats.culled_sphere,
+		state->cull_stats.culled_box, state->cull_stats.visible,
+		state->cull_stats.occluded, state->cull_stats.objects_tested,
+		state->cull_stats.objects_culled);
+
+	rq_sort(&world->queue);
+	/* the world then the models, as separate passes so they can be timed */
+	gputimer_begin(GPU_PASS_SECTORS);
+	rq_submit_type(&world->queue, RQ_DRAW_RANGES, state->lighting, shader);
+	gputimer_end(GPU_PASS_SECTORS);
+	gputimer_begin(GPU_PASS_MODELS);
+	rq_submit_type(&world->queue, RQ_DRAW_OBJECT, state->lighting, shader);
+	if (shader) {
+		debug("shader: uniform uploads=%u\n", shader_uploads(shader));
+		shader_end(shader);
 	}
+	/* test sprite boxes against the finished depth buffer */
+	if (state->occlusion) {
+		occlusion_begin(&world->occlusion,
+			world->stream.buffer ? &world->stream : NULL);
+		sprites_query(state);
+		occlusion_end(&world->occlusion);
+		debug("occlusion: queries=%u\n", world->occlusion.issued);
+	}
+	gputimer_end(GPU_PASS_MODELS);
+	streambuf_frame_end(&world->stream);
+	debug("stream: waits=%u orphans=%u\n", world->stream.waits,
+		world->stream.orphans);
+	debug("pages: builds=%u uploads=%u evictions=%u stalls=%u KiB=%zu\n",
+		world->pages.builds, world->pages.uploads,
+		world->pages.evictions, world->pages.stalls,
+		world->pages.bytes >> 10);
+	debug("queue: items=%u binds=%u materials=%u matrices=%u scissors=%u\n",
+		world->queue.stats.items, world->queue.stats.texture_binds,
+		world->queue.stats.material_changes,
+		world->queue.stats.matrix_changes,
+		world->queue.stats.scissor_changes);
+	debug("glstate: issued=%u elided=%u\n",
+		glstate_stats()->issued, glstate_stats()->elided);
+}
+
+/* show the GPU pass timings in the window title about once a second */
+static void timing_show(SDL_Window *win)
+{
+	struct game_state *state = SDL_GetWindowData(win, "game");
+	SDL_assert(state != NULL);
 
-	glDisable(GL_LIGHTING);
-	glDisable(GL_LIGHT0);
+	Uint32 now = SDL_GetTicks();
+	if (!state->show_timing)
+		return;
+	if (state->timing_tick && now - state->timing_tick < 1000)
+		return;
+	state->timing_tick = now;
+	char title[256];
+	int len = snprintf(title, sizeof(title), "Hero - gpu avg/p99 ");
+	gputimer_format(title + len, sizeof(title) - len);
+	SDL_SetWindowTitle(win, title);
 }
 
 /** MVC: Controller - process inputs and alter the model over time. **/
@@ -645,6 +1470,51 @@ static void game_process_key(bool down, SDL_Keysym keysym, SDL_Window *win)
 		if (down)
 			state->lighting ^= true;
 		break;
+	/* toggle between GLSL and fixed-function */
+	case SDLK_g:
+		if (down && world->shader) {
+			state->use_shader ^= true;
+			info("Using %s pipeline\n",
+				state->use_shader ? "GLSL" : "fixed-function");
+		}
+		break;
+	/* toggle frustum culling on/off */
+	case SDLK_c:
+		if (down)
+			state->culling ^= true;
+		break;
+	/* toggle the PVS on/off */
+	case SDLK_p:
+		if (down && world->pvs) {
+			state->pvs ^= true;
+			info("PVS %s\n", state->pvs ? "on" : "off");
+		}
+		break;
+	/* toggle clipping sectors to their portals on/off */
+	case SDLK_x:
+		if (down) {
+			state->scissor ^= true;
+			info("Portal scissor %s\n", state->scissor ? "on" : "off");
+		}
+		break;
+	/* toggle occlusion queries on/off */
+	case SDLK_o:
+		if (down && world->occlusion.supported) {
+			state->occlusion ^= true;
+			occlusion_reset(&world->occlusion);
+		}
+		break;
+	/* toggle GPU timings in the title, dump them to the log when done */
+	case SDLK_t:
+		if (down) {
+			state->show_timing ^= true;
+			state->timing_tick = 0;
+			if (!state->show_timing) {
+				gputimer_dump();
+				SDL_SetWindowTitle(win, "Hero");
+			}
+		}
+		break;
 	}
 }
 
@@ -770,26 +1640,35 @@ static void game_process_ticks(SDL_Window *win)
 		state->act.up, state->act.down,
 		state->act.left, state->act.right);
 	*/
-	// TODO: handle wall collision
+	double move_x = 0.0, move_y = 0.0;
 	if (state->act.down) {
-		state->player_x += ax;
-		state->player_y += ay;
+		move_x += ax;
+		move_y += ay;
 	}
 	if (state->act.up) {
-		state->player_x -= ax;
-		state->player_y -= ay;
+		move_x -= ax;
+		move_y -= ay;
 	}
 	if (state->act.left) {
 		double ax_left = r * cos(theta);
 		double ay_left = r * sin(theta);
-		state->player_x -= ax_left;
-		state->player_y -= ay_left;
+		move_x -= ax_left;
+		move_y -= ay_left;
 	}
 	if (state->act.right) {
 		double ax_right = r * cos(theta);
 		double ay_right = r * sin(theta);
-		state->player_x += ax_right;
-		state->player_y += ay_right;
+		move_x += ax_right;
+		move_y += ay_right;
+	}
+	/* walk, sliding along the walls and through the portals */
+	unsigned sector = state->player_sector;
+	if (move_x != 0.0 || move_y != 0.0) {
+		float x = state->player_x, y = state->player_y;
+		sector = collide_move(&world->map, sector, &player_body, &x, &y,
+			move_x, move_y);
+		state->player_x = x;
+		state->player_y = y;
 	}
 	if (state->act.turn_left) {
 		state->player_facing -= elapsed / player_turn_speed;
@@ -810,6 +1689,16 @@ static void game_process_ticks(SDL_Window *win)
 		state->player_tilt -= elapsed / player_turn_speed;
 	}
 
+	/* the portals are followed while walking, the grid catches anything
+	 * that slipped past them */
+	sector = sectorgrid_track(&world->grid, &world->map, sector,
+		state->player_x, state->player_y);
+	if (sector != state->player_sector) {
+		debug("player moved to sector %u\n", sector);
+		state->player_sector = sector;
+		state->player_floor = sector_get(sector)->floor_height;
+	}
+
 	/* put player_facing between 0 and 360. [0.0, 360.0) */
 	state->player_facing = fmod(state->player_facing, 360.0);
 	if (state->player_facing < 0.0)
@@ -823,7 +1712,9 @@ static void game_process_ticks(SDL_Window *win)
 static void usage(const char *argv0)
 {
 	// TODO: should we replace this with SDL_Log() ?
-	fprintf(stderr, "%s [-geometry %dx%d]\n",
+	fprintf(stderr, "%s [-geometry %dx%d] [-threads n] [-texture-budget MiB]"
+		" [-upload-budget KiB] [-world-budget MiB] [-texture-scale 1|2|4|8]"
+		" [-map file]\n",
 		argv0, config.width, config.height);
 	exit(EXIT_FAILURE);
 }
@@ -851,6 +1742,69 @@ static void parse_args(int argc, char **argv)
 			config.verbose = true;
 		} else if (!strcmp(cur, "-debug")) {
 			config.debug = true;
+		} else if (!strcmp(cur, "-glsl")) {
+			config.use_glsl = true;
+		} else if (!strcmp(cur, "-fixed")) {
+			config.use_glsl = false;
+		} else if (!strcmp(cur, "-threads")) {
+			if (i >= argc) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+			const char *arg = argv[i++];
+			if (sscanf(arg, "%u", &config.threads) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-texture-budget")) {
+			if (i >= argc) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+			const char *arg = argv[i++];
+			if (sscanf(arg, "%u", &config.texture_budget) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-upload-budget")) {
+			if (i >= argc) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+			const char *arg = argv[i++];
+			if (sscanf(arg, "%u", &config.upload_budget) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-world-budget")) {
+			if (i >= argc) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+			const char *arg = argv[i++];
+			if (sscanf(arg, "%u", &config.world_budget) != 1) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+		} else if (!strcmp(cur, "-texture-scale")) {
+			if (i >= argc) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+			const char *arg = argv[i++];
+			unsigned n;
+			if (sscanf(arg, "%u", &n) != 1 || !n || n > 8 ||
+				(n & (n - 1))) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+			config.texture_scale = n;
+		} else if (!strcmp(cur, "-map")) {
+			if (i >= argc) {
+				fprintf(stderr, "ERROR at %s\n", cur);
+				usage(argv[0]);
+			}
+			config.map = argv[i++];
 		} else if (!strcmp(cur, "-vsync")) {
 			config.use_vsync = true;
 		} else if (!strcmp(cur, "-novsync") ||
@@ -919,6 +1873,9 @@ int main(int argc, char **argv)
 	SDL_SetWindowData(main_window, "game", main_state);
 
 	main_state->lighting = true; /* use L to toggle on/off */
+	main_state->culling = true; /* use C to toggle on/off */
+	main_state->pvs = true; /* use P to toggle on/off */
+	main_state->scissor = true; /* use X to toggle on/off */
 
 	/* Configure the player gamepad */
 	if (SDL_GameControllerAddMappingsFromFile("gamecontrollerdb.txt") == -1)
@@ -940,13 +1897,27 @@ int main(int argc, char **argv)
 		die("SDL could not create GL context! (%s)\n", SDL_GetError());
 	setup_gl();
 
+	/* the main thread does its share of the work, so 1 means no workers */
+	struct threadpool *pool = NULL;
+	if (config.threads != 1)
+		pool = threadpool_new(config.threads ? config.threads - 1 : 0);
+
 	/* establish a world */
-	world = world_new();
+	world = world_new(pool, config.map);
 	assert(world != NULL);
 
-	// TODO: replace this with some kind of map loading routine
-	world_sector_add(world, 0, sector_get(0));
-	world_sector_add(world, 1, sector_get(1));
+	main_state->use_shader = world->shader != NULL; /* use G to toggle */
+	main_state->occlusion = world->occlusion.supported; /* use O to toggle */
+	gputimer_init(); /* use T to show */
+
+	/* the original GL_LIGHT0 */
+	static const struct light default_light = {
+		.position = { -1.5f, 1.0f, -4.0f, 1.0f },
+		.ambient = { 0.2f, 0.2f, 0.2f, 1.0f },
+		.diffuse = { 0.8f, 0.8f, 0.8f, 1.0f },
+		.specular = { 0.5f, 0.5f, 0.5f, 1.0f },
+	};
+	world_light_add(world, &default_light);
 
 	world_model_add(world, 0, "assets/teapot.obj");
 	/*
@@ -957,13 +1928,25 @@ int main(int argc, char **argv)
 	world_model_add(world, 5, "assets/icosahedron.obj");
 	*/
 
-	/* put us in the center of the map of the 1st sector */
-	main_state->player_sector = 1;
+	/* put us in the center of the map's starting sector */
+	main_state->player_sector = world->map.header->start_sector;
+	if (!sector_get(main_state->player_sector))
+		die("%s:no starting sector\n", config.map);
 	sector_find_center(sector_get(main_state->player_sector),
 		&main_state->player_x, &main_state->player_y);
+	main_state->player_floor =
+		sector_get(main_state->player_sector)->floor_height;
 	main_state->player_facing = 180.0;
 	main_state->player_height = 1.0;
 
+	/* drop a teapot in the middle of the 1st sector */
+	GLdouble teapot_x, teapot_y;
+	if (sector_get(0)) {
+		sector_find_center(sector_get(0), &teapot_x, &teapot_y);
+		world_sprite_add(world, 0, teapot_x, teapot_y,
+			main_state->player_height / 2, 0.25);
+	}
+
 	/* print the starting sector */
 	sector_print(sector_get(main_state->player_sector));
 
@@ -1018,8 +2001,17 @@ int main(int argc, char **argv)
 		/* Render/Paint */
 		SDL_GL_MakeCurrent(main_window, main_context); /* not needed for single window applications */
 		game_paint();
+		gputimer_begin(GPU_PASS_SWAP);
 		SDL_GL_SwapWindow(main_window);
+		gputimer_end(GPU_PASS_SWAP);
+		gputimer_collect();
+		timing_show(main_window);
 	}
+	gputimer_dump();
+	gputimer_free();
+	world_free(world);
+	world = NULL;
+	threadpool_free(pool);
 
 	SDL_GameControllerClose(main_state->gamepad);
 	main_state->gamepad = NULL;
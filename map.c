@@ -0,0 +1,387 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "logging.h"
+#include "map.h"
+
+/* sizes of the records in the file, the structs must match them */
+#define HEADER_SIZE 60
+#define SECTOR_SIZE 20
+#define VERTEX_SIZE 8
+#define TEXTURE_SIZE MAP_PATH_MAX
+
+/* the tables are used in place, which needs the file's layout */
+static bool layout_matches(void)
+{
+	const uint16_t one = 1;
+
+	return *(const unsigned char*)&one == 1 &&
+		sizeof(struct map_header) == HEADER_SIZE &&
+		sizeof(struct map_sector) == SECTOR_SIZE &&
+		sizeof(struct map_vertex) == VERTEX_SIZE &&
+		sizeof(struct map_texture) == TEXTURE_SIZE;
+}
+
+#ifdef _WIN32
+/* no mmap(), read the whole file instead */
+static int map_file(struct map *m, const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		warn("%s:unable to open\n", filename);
+		return -1;
+	}
+	long len = -1;
+	if (!fseek(f, 0, SEEK_END))
+		len = ftell(f);
+	if (len < 0 || fseek(f, 0, SEEK_SET)) {
+		warn("%s:read error\n", filename);
+		fclose(f);
+		return -1;
+	}
+	m->size = len;
+	m->base = malloc(len ? len : 1);
+	if (!m->base || fread(m->base, 1, len, f) != (size_t)len) {
+		warn("%s:read error\n", filename);
+		fclose(f);
+		free(m->base);
+		m->base = NULL;
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+#else
+/* pages are only read in as the records on them are used */
+static int map_file(struct map *m, const char *filename)
+{
+	struct stat st;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		warn("%s:unable to open\n", filename);
+		return -1;
+	}
+	if (fstat(fd, &st) || st.st_size < HEADER_SIZE) {
+		warn("%s:not a compiled map\n", filename);
+		close(fd);
+		return -1;
+	}
+	m->size = st.st_size;
+	m->base = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m->base == MAP_FAILED) {
+		warn("%s:unable to map\n", filename);
+		m->base = NULL;
+		return -1;
+	}
+	m->mapped = true;
+	return 0;
+}
+#endif
+
+/* a table of count records at offset, true if it fits in the file */
+static bool table_fits(const struct map *m, uint32_t offset, uint32_t count,
+	size_t size)
+{
+	return offset % 4 == 0 && offset >= HEADER_SIZE && offset <= m->size &&
+		count <= (m->size - offset) / size;
+}
+
+/* map a compiled map into memory. only the header is checked, so opening
+ * costs the same for any size of map. */
+int map_open(struct map *m, const char *filename)
+{
+	memset(m, 0, sizeof(*m));
+	if (!layout_matches()) {
+		error("Compiled maps are not supported on this platform\n");
+		return -1;
+	}
+	if (map_file(m, filename))
+		return -1;
+
+	const struct map_header *h = m->base;
+	if (m->size < HEADER_SIZE || memcmp(h->magic, MAP_MAGIC, 4) ||
+		h->version != MAP_VERSION) {
+		warn("%s:not a compiled map\n", filename);
+		goto bad;
+	}
+	if (!table_fits(m, h->sectors, h->num_sectors, SECTOR_SIZE) ||
+		!table_fits(m, h->wall_vertices, h->num_walls, 4) ||
+		!table_fits(m, h->wall_portals, h->num_walls, 4) ||
+		!table_fits(m, h->wall_textures, h->num_walls, 2) ||
+		!table_fits(m, h->vertices, h->num_vertices, VERTEX_SIZE) ||
+		!table_fits(m, h->textures, h->num_textures, TEXTURE_SIZE) ||
+		(h->num_walls && !h->num_vertices)) {
+		warn("%s:corrupt compiled map\n", filename);
+		goto bad;
+	}
+	const unsigned char *base = m->base;
+	m->header = h;
+	m->sectors = (const struct map_sector*)(base + h->sectors);
+	m->wall_vertices = (const uint32_t*)(base + h->wall_vertices);
+	m->wall_portals = (const uint32_t*)(base + h->wall_portals);
+	m->wall_textures = (const uint16_t*)(base + h->wall_textures);
+	m->vertices = (const struct map_vertex*)(base + h->vertices);
+	m->textures = (const struct map_texture*)(base + h->textures);
+	m->num_sectors = h->num_sectors;
+	if (h->pvs) {
+		if (!table_fits(m, h->pvs, h->num_sectors + 1, 4)) {
+			warn("%s:corrupt PVS\n", filename);
+			goto bad;
+		}
+		m->pvs_offsets = (const uint32_t*)(base + h->pvs);
+		m->pvs_rows = (const unsigned char*)(m->pvs_offsets +
+			h->num_sectors + 1);
+		m->pvs_size = m->size - (m->pvs_rows - base);
+	}
+	m->num_walls = h->num_walls;
+	m->num_vertices = h->num_vertices;
+	m->num_textures = h->num_textures;
+	return 0;
+bad:
+	map_close(m);
+	return -1;
+}
+
+void map_close(struct map *m)
+{
+#ifndef _WIN32
+	if (m->mapped)
+		munmap(m->base, m->size);
+	else
+#endif
+		free(m->base);
+	memset(m, 0, sizeof(*m));
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void put16(unsigned char *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void putf(unsigned char *p, float f)
+{
+	uint32_t v;
+
+	memcpy(&v, &f, sizeof(v));
+	put32(p, v);
+}
+
+/* write a map with its tables one after the other. the counts and start
+ * sector come from header, the offsets are filled in. pvs may be NULL. */
+int map_write(const struct map_header *header,
+	const struct map_sector *sectors, const struct map_wall *walls,
+	const struct map_vertex *vertices, const struct map_texture *textures,
+	const struct map_pvs *pvs, const char *filename)
+{
+	unsigned char rec[HEADER_SIZE];
+	uint32_t offset = HEADER_SIZE;
+	unsigned i;
+
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		error("%s:unable to create\n", filename);
+		return -1;
+	}
+	memcpy(rec, MAP_MAGIC, 4);
+	put32(rec + 4, MAP_VERSION);
+	put32(rec + 8, header->num_sectors);
+	put32(rec + 12, header->num_walls);
+	put32(rec + 16, header->num_vertices);
+	put32(rec + 20, header->num_textures);
+	put32(rec + 24, header->start_sector);
+	put32(rec + 28, offset);
+	offset += header->num_sectors * SECTOR_SIZE;
+	put32(rec + 32, offset);
+	offset += header->num_walls * 4;
+	put32(rec + 36, offset);
+	offset += header->num_walls * 4;
+	put32(rec + 40, offset);
+	offset += (header->num_walls * 2 + 3) & ~3u;
+	put32(rec + 44, offset);
+	offset += header->num_vertices * VERTEX_SIZE;
+	put32(rec + 48, offset);
+	offset += header->num_textures * TEXTURE_SIZE;
+	put32(rec + 52, pvs ? pvs->depth : 0);
+	put32(rec + 56, pvs ? offset : 0);
+	bool ok = fwrite(rec, HEADER_SIZE, 1, f) == 1;
+
+	for (i = 0; ok && i < header->num_sectors; i++) {
+		const struct map_sector *sec = &sectors[i];
+		put32(rec, sec->first_wall);
+		put32(rec + 4, sec->num_walls);
+		putf(rec + 8, sec->floor_height);
+		putf(rec + 12, sec->ceil_height);
+		put32(rec + 16, sec->floor_texture |
+			(uint32_t)sec->ceil_texture << 16);
+		ok = fwrite(rec, SECTOR_SIZE, 1, f) == 1;
+	}
+	for (i = 0; ok && i < header->num_walls; i++) {
+		put32(rec, walls[i].vertex);
+		ok = fwrite(rec, 4, 1, f) == 1;
+	}
+	for (i = 0; ok && i < header->num_walls; i++) {
+		put32(rec, walls[i].portal);
+		ok = fwrite(rec, 4, 1, f) == 1;
+	}
+	for (i = 0; ok && i < header->num_walls; i++) {
+		put16(rec, walls[i].texture);
+		ok = fwrite(rec, 2, 1, f) == 1;
+	}
+	if (ok && header->num_walls % 2) {
+		put16(rec, 0); /* keep the next table aligned */
+		ok = fwrite(rec, 2, 1, f) == 1;
+	}
+	for (i = 0; ok && i < header->num_vertices; i++) {
+		putf(rec, vertices[i].x);
+		putf(rec + 4, vertices[i].y);
+		ok = fwrite(rec, VERTEX_SIZE, 1, f) == 1;
+	}
+	for (i = 0; ok && i < header->num_textures; i++)
+		ok = fwrite(textures[i].path, TEXTURE_SIZE, 1, f) == 1;
+	for (i = 0; ok && pvs && i <= header->num_sectors; i++) {
+		put32(rec, pvs->offsets[i]);
+		ok = fwrite(rec, 4, 1, f) == 1;
+	}
+	if (ok && pvs && pvs->offsets[header->num_sectors])
+		ok = fwrite(pvs->rows, pvs->offsets[header->num_sectors], 1,
+			f) == 1;
+	if (fclose(f) || !ok) {
+		error("%s:write error\n", filename);
+		remove(filename);
+		return -1;
+	}
+	return 0;
+}
+
+/* records are only range checked when they are looked up, so nothing has
+ * to be read in until it is used. */
+
+/* sector n, NULL if there isn't one or its walls are out of range */
+const struct map_sector *map_sector(const struct map *m, unsigned n)
+{
+	if (n >= m->num_sectors)
+		return NULL;
+	const struct map_sector *sec = &m->sectors[n];
+	if (sec->first_wall > m->num_walls ||
+		sec->num_walls > m->num_walls - sec->first_wall)
+		return NULL;
+	return sec;
+}
+
+unsigned map_sector_number(const struct map *m, const struct map_sector *sec)
+{
+	return sec - m->sectors;
+}
+
+/* the fields of wall i of a sector returned by map_sector() */
+
+/* sector on the other side, MAP_NONE for a solid wall */
+unsigned map_wall_portal(const struct map *m, const struct map_sector *sec,
+	unsigned i)
+{
+	return m->wall_portals[sec->first_wall + i];
+}
+
+unsigned map_wall_texture(const struct map *m, const struct map_sector *sec,
+	unsigned i)
+{
+	return m->wall_textures[sec->first_wall + i];
+}
+
+/* the vertex the wall ends at, a bad index gives the first vertex */
+const struct map_vertex *map_wall_vertex(const struct map *m,
+	const struct map_sector *sec, unsigned i)
+{
+	uint32_t v = m->wall_vertices[sec->first_wall + i];
+	return &m->vertices[v < m->num_vertices ? v : 0];
+}
+
+/* true if x,y is inside of sector, or on one of its walls */
+bool map_sector_contains(const struct map *m, const struct map_sector *sec,
+	float x, float y)
+{
+	unsigned i;
+
+	if (!sec->num_walls)
+		return false;
+	const struct map_vertex *a = map_wall_vertex(m, sec, sec->num_walls - 1);
+	for (i = 0; i < sec->num_walls; i++) {
+		const struct map_vertex *b = map_wall_vertex(m, sec, i);
+		/* on x,y the inside is to the right of every wall */
+		if ((b->x - a->x) * (y - a->y) - (b->y - a->y) * (x - a->x) > 0.0f)
+			return false;
+		a = b;
+	}
+	return true;
+}
+
+/* path of texture n, NULL if there isn't one */
+const char *map_texture(const struct map *m, unsigned n)
+{
+	if (n >= m->num_textures ||
+		!memchr(m->textures[n].path, 0, MAP_PATH_MAX))
+		return NULL;
+	return m->textures[n].path;
+}
+
+/* portals the PVS was built through, 0 if the map has none */
+unsigned map_pvs_depth(const struct map *m)
+{
+	return m->pvs_offsets ? m->header->pvs_depth : 0;
+}
+
+/* size of a PVS row once it is expanded */
+size_t map_pvs_bytes(const struct map *m)
+{
+	return (m->num_sectors + 7) / 8;
+}
+
+/* expand the PVS of sector n into row, map_pvs_bytes() long. bit k is set if
+ * sector k may be visible from it. -1 if there is no PVS or the row is bad. */
+int map_pvs_row(const struct map *m, unsigned n, unsigned char *row)
+{
+	size_t i = 0, len = map_pvs_bytes(m);
+
+	if (!m->pvs_offsets || n >= m->num_sectors)
+		return -1;
+	uint32_t pos = m->pvs_offsets[n], end = m->pvs_offsets[n + 1];
+	if (pos > end || end > m->pvs_size)
+		return -1;
+	while (i < len && pos < end) {
+		unsigned char c = m->pvs_rows[pos++];
+		if (c) {
+			row[i++] = c;
+			continue;
+		}
+		if (pos >= end)
+			return -1;
+		unsigned run = m->pvs_rows[pos++];
+		if (run > len - i)
+			return -1;
+		memset(row + i, 0, run);
+		i += run;
+	}
+	return i == len && pos == end ? 0 : -1;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef MAP_H
+#define MAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* a compiled map made by hero-mapc. the file is little-endian, and the
+ * tables are used in place so it can be mapped instead of parsed:
+ *   "HMAP" version num_sectors num_walls num_vertices num_textures
+ *   start_sector, then the file offset of each table (32 bits each)
+ * every table is 4 byte aligned. the walls are split into one table for
+ * each field, so following portals only reads the portal table.
+ *
+ * the optional PVS (potentially visible set) table holds num_sectors + 1
+ * offsets into the rows that follow it. row n is a bitset of the sectors
+ * that can be seen from anywhere in sector n through at most pvs_depth
+ * portals, with every run of zero bytes stored as a 0 and a count. */
+#define MAP_MAGIC "HMAP"
+#define MAP_VERSION 3
+#define MAP_EXT ".hmap"
+#define MAP_NONE (0xffffffffu) /* no portal */
+#define MAP_PATH_MAX 64
+
+struct map_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t num_sectors, num_walls, num_vertices, num_textures;
+	uint32_t start_sector; /* where the player begins */
+	/* file offsets of struct map_sector, uint32_t, uint32_t, uint16_t,
+	 * struct map_vertex and struct map_texture tables */
+	uint32_t sectors, wall_vertices, wall_portals, wall_textures;
+	uint32_t vertices, textures;
+	uint32_t pvs_depth; /* portals the PVS looks through */
+	uint32_t pvs; /* file offset of the PVS, 0 if there is none */
+};
+
+/* a sector is a convex 2D polygon. each wall is a side of it, clockwise on
+ * the map's x,y plane with the sector to the right of each wall, and is
+ * either solid or a portal. */
+struct map_sector {
+	uint32_t first_wall, num_walls; /* range in the wall tables */
+	float floor_height, ceil_height;
+	uint16_t floor_texture, ceil_texture; /* index in the texture table */
+};
+
+/* the side that ends at vertex, starting at the previous wall's vertex.
+ * only used to build a map, the file keeps each field in its own table. */
+struct map_wall {
+	uint32_t vertex; /* index in the vertex pool */
+	uint32_t portal; /* sector on the other side, or MAP_NONE */
+	uint16_t texture; /* index in the texture table */
+};
+
+struct map_vertex {
+	float x, y;
+};
+
+/* an image file, relative to the working directory */
+struct map_texture {
+	char path[MAP_PATH_MAX]; /* 0 terminated */
+};
+
+/* a PVS being built, offsets are into rows */
+struct map_pvs {
+	unsigned depth;
+	uint32_t *offsets; /* num_sectors + 1 */
+	unsigned char *rows;
+};
+
+struct map {
+	const struct map_header *header;
+	const struct map_sector *sectors;
+	const uint32_t *wall_vertices, *wall_portals;
+	const uint16_t *wall_textures;
+	const struct map_vertex *vertices;
+	const struct map_texture *textures;
+	const uint32_t *pvs_offsets; /* NULL without a PVS */
+	const unsigned char *pvs_rows;
+	size_t pvs_size; /* bytes from pvs_rows to the end of the file */
+	unsigned num_sectors, num_walls, num_vertices, num_textures;
+	void *base; /* the whole file */
+	size_t size;
+	bool mapped; /* base came from mmap() rather than malloc() */
+};
+
+int map_open(struct map *m, const char *filename);
+void map_close(struct map *m);
+int map_write(const struct map_header *header,
+	const struct map_sector *sectors, const struct map_wall *walls,
+	const struct map_vertex *vertices, const struct map_texture *textures,
+	const struct map_pvs *pvs, const char *filename);
+
+const struct map_sector *map_sector(const struct map *m, unsigned n);
+unsigned map_sector_number(const struct map *m, const struct map_sector *sec);
+unsigned map_wall_portal(const struct map *m, const struct map_sector *sec,
+	unsigned i);
+unsigned map_wall_texture(const struct map *m, const struct map_sector *sec,
+	unsigned i);
+const struct map_vertex *map_wall_vertex(const struct map *m,
+	const struct map_sector *sec, unsigned i);
+bool map_sector_contains(const struct map *m, const struct map_sector *sec,
+	float x, float y);
+const char *map_texture(const struct map *m, unsigned n);
+unsigned map_pvs_depth(const struct map *m);
+size_t map_pvs_bytes(const struct map *m);
+int map_pvs_row(const struct map *m, unsigned n, unsigned char *row);
+#endif
@@ -0,0 +1,22 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+/* most lights either backend will use */
+#define MAX_LIGHTS 8
+
+/* surface properties for lit (material) and unlit (color) drawing */
+struct material {
+	GLfloat ambient[4], diffuse[4], specular[4], emission[4];
+	GLfloat shininess;
+	GLfloat color[4];
+};
+
+/* a point light (position w=1) or directional light (w=0) in world space */
+struct light {
+	GLfloat position[4];
+	GLfloat ambient[4], diffuse[4], specular[4];
+};
+#endif
@@ -0,0 +1,308 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "logging.h"
+#include "mipmap.h"
+
+/* the taps of one axis of a box filter, in 8.8 fixed point.
+ * an even size averages pairs. an odd size n = 2m + 1 has m outputs, each
+ * covering 2 + 1/m inputs, see "Non-Power-of-Two Mipmapping" (NVIDIA). */
+struct taps {
+	unsigned first; /* input index of weight[0] */
+	unsigned short weight[3];
+};
+
+static void taps_make(struct taps *t, int src, int dst)
+{
+	int i;
+
+	for (i = 0; i < dst; i++) {
+		if (src == 1) {
+			t[i].first = 0;
+			t[i].weight[0] = 256;
+			t[i].weight[1] = t[i].weight[2] = 0;
+		} else if (src % 2 == 0) {
+			t[i].first = 2 * i;
+			t[i].weight[0] = t[i].weight[1] = 128;
+			t[i].weight[2] = 0;
+		} else {
+			unsigned m = dst, d = 2 * m + 1;
+			t[i].first = 2 * i;
+			t[i].weight[0] = 256 * (m - i) / d;
+			t[i].weight[2] = 256 * (i + 1) / d;
+			t[i].weight[1] = 256 - t[i].weight[0] - t[i].weight[2];
+		}
+	}
+}
+
+/* any size, any number of components. horizontal then vertical, with
+ * 16-bit intermediate values in tmp (dw * sh * comps). */
+static void downsample_generic(const unsigned char *src, int sw, int sh,
+	unsigned char *dst, int dw, int dh, int comps, uint16_t *tmp,
+	struct taps *xt, struct taps *yt)
+{
+	int x, y, c, k;
+
+	taps_make(xt, sw, dw);
+	taps_make(yt, sh, dh);
+	for (y = 0; y < sh; y++) {
+		const unsigned char *row = src + (size_t)y * sw * comps;
+		uint16_t *out = tmp + (size_t)y * dw * comps;
+		for (x = 0; x < dw; x++) {
+			for (c = 0; c < comps; c++) {
+				unsigned sum = 0;
+				for (k = 0; k < 3; k++) {
+					if (!xt[x].weight[k])
+						continue;
+					sum += xt[x].weight[k] *
+						row[(xt[x].first + k) * comps + c];
+				}
+				out[x * comps + c] = sum;
+			}
+		}
+	}
+	for (y = 0; y < dh; y++) {
+		unsigned char *out = dst + (size_t)y * dw * comps;
+		for (x = 0; x < dw * comps; x++) {
+			uint32_t sum = 0;
+			for (k = 0; k < 3; k++) {
+				if (!yt[y].weight[k])
+					continue;
+				sum += (uint32_t)yt[y].weight[k] *
+					tmp[(size_t)(yt[y].first + k) * dw * comps + x];
+			}
+			out[x] = (sum + 32768) >> 16;
+		}
+	}
+}
+
+/* even width and height, 4 components: average each 2x2 block */
+static void downsample_rgba_2x2(const unsigned char *src, int sw, int sh,
+	unsigned char *dst)
+{
+	int dw = sw / 2, dh = sh / 2;
+	int x, y, c;
+
+	for (y = 0; y < dh; y++) {
+		const unsigned char *r0 = src + (size_t)(2 * y) * sw * 4;
+		const unsigned char *r1 = r0 + (size_t)sw * 4;
+		unsigned char *out = dst + (size_t)y * dw * 4;
+		x = 0;
+#if defined(__AVX2__)
+		/* 8 pixels in, 4 out */
+		for (; x + 4 <= dw; x += 4) {
+			const __m256i zero = _mm256_setzero_si256();
+			__m256i a = _mm256_loadu_si256((const __m256i*)(r0 + x * 8));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(r1 + x * 8));
+			/* per 128-bit lane: lo = pixels 0,1 hi = pixels 2,3 */
+			__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+				_mm256_unpacklo_epi8(b, zero));
+			__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+				_mm256_unpackhi_epi8(b, zero));
+			lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+			hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+			__m256i sum = _mm256_unpacklo_epi64(lo, hi);
+			sum = _mm256_srli_epi16(_mm256_add_epi16(sum,
+				_mm256_set1_epi16(2)), 2);
+			__m256i packed = _mm256_packus_epi16(sum, sum);
+			packed = _mm256_permute4x64_epi64(packed, 0x08);
+			_mm_storeu_si128((__m128i*)(out + x * 4),
+				_mm256_castsi256_si128(packed));
+		}
+#endif
+#if defined(__SSE2__)
+		/* 4 pixels in, 2 out */
+		for (; x + 2 <= dw; x += 2) {
+			const __m128i zero = _mm_setzero_si128();
+			__m128i a = _mm_loadu_si128((const __m128i*)(r0 + x * 8));
+			__m128i b = _mm_loadu_si128((const __m128i*)(r1 + x * 8));
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+				_mm_unpacklo_epi8(b, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+				_mm_unpackhi_epi8(b, zero));
+			lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+			hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+			__m128i sum = _mm_unpacklo_epi64(lo, hi);
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+			_mm_storel_epi64((__m128i*)(out + x * 4),
+				_mm_packus_epi16(sum, sum));
+		}
+#endif
+		for (; x < dw; x++) {
+			for (c = 0; c < 4; c++) {
+				out[x * 4 + c] = (r0[x * 8 + c] + r0[x * 8 + 4 + c] +
+					r1[x * 8 + c] + r1[x * 8 + 4 + c] + 2) >> 2;
+			}
+		}
+	}
+}
+
+static bool is_pot(int n)
+{
+	return n > 0 && !(n & (n - 1));
+}
+
+/* closest power of 2, as gluBuild2DMipmaps picks */
+static int nearest_pot(int n)
+{
+	int p = 1;
+	while (p * 2 <= n)
+		p *= 2;
+	return (n - p < p * 2 - n) ? p : p * 2;
+}
+
+/* bilinear resample of an sw x sh image into dw x dh, for a GL that can't
+ * take NPOT textures or textures that have to match another's size. */
+void mipmap_resize(const unsigned char *src, int sw, int sh,
+	unsigned char *dst, int dw, int dh, int comps)
+{
+	int x, y, c;
+
+	for (y = 0; y < dh; y++) {
+		float fy = (y + 0.5f) * sh / dh - 0.5f;
+		int y0 = fy < 0 ? 0 : (int)fy;
+		int y1 = y0 + 1 < sh ? y0 + 1 : sh - 1;
+		float wy = fy - y0;
+		if (wy < 0)
+			wy = 0;
+		for (x = 0; x < dw; x++) {
+			float fx = (x + 0.5f) * sw / dw - 0.5f;
+			int x0 = fx < 0 ? 0 : (int)fx;
+			int x1 = x0 + 1 < sw ? x0 + 1 : sw - 1;
+			float wx = fx - x0;
+			if (wx < 0)
+				wx = 0;
+			for (c = 0; c < comps; c++) {
+				float a = src[((size_t)y0 * sw + x0) * comps + c];
+				float b = src[((size_t)y0 * sw + x1) * comps + c];
+				float d = src[((size_t)y1 * sw + x0) * comps + c];
+				float e = src[((size_t)y1 * sw + x1) * comps + c];
+				float top = a + (b - a) * wx;
+				float bot = d + (e - d) * wx;
+				dst[((size_t)y * dw + x) * comps + c] =
+					top + (bot - top) * wy + 0.5f;
+			}
+		}
+	}
+}
+
+/* build every level of data down to 1x1. data is not copied and must
+ * live as long as the chain, unless npot is false and it has to be
+ * resized to a power of 2. levels halve rounding down, as GL expects. */
+int mipmap_build(struct mipmap *mm, unsigned char *data, int width,
+	int height, int comps, bool npot)
+{
+	unsigned i;
+
+	memset(mm, 0, sizeof(*mm));
+	mm->comps = comps;
+	int w = width, h = height;
+	if (!npot && (!is_pot(w) || !is_pot(h))) {
+		w = nearest_pot(width);
+		h = nearest_pot(height);
+	}
+
+	/* size everything up front, one allocation for all of it */
+	size_t total = 0, tmp_size = 0;
+	int lw = w, lh = h;
+	for (i = 0; i < MIPMAP_MAX_LEVELS; i++) {
+		mm->level[i].width = lw;
+		mm->level[i].height = lh;
+		if (i || w != width || h != height)
+			total += (size_t)lw * lh * comps;
+		mm->num_levels = i + 1;
+		if (lw == 1 && lh == 1)
+			break;
+		int nw = lw > 1 ? lw / 2 : 1, nh = lh > 1 ? lh / 2 : 1;
+		size_t t = (size_t)nw * lh * comps * sizeof(uint16_t);
+		if (t > tmp_size)
+			tmp_size = t;
+		lw = nw;
+		lh = nh;
+	}
+	size_t taps_size = (size_t)(w + h) * sizeof(struct taps);
+	mm->storage = malloc(total + tmp_size + taps_size);
+	if (!mm->storage) {
+		error("Unable to allocate mipmaps!\n");
+		return -1;
+	}
+	struct taps *xt = (struct taps*)mm->storage;
+	struct taps *yt = xt + w;
+	uint16_t *tmp = (uint16_t*)(yt + h);
+	unsigned char *p = (unsigned char*)tmp + tmp_size;
+
+	if (w != width || h != height) {
+		mm->level[0].data = p;
+		mipmap_resize(data, width, height, p, w, h, comps);
+		p += (size_t)w * h * comps;
+	} else {
+		mm->level[0].data = data;
+	}
+	for (i = 1; i < mm->num_levels; i++) {
+		const struct mip_level *s = &mm->level[i - 1];
+		struct mip_level *d = &mm->level[i];
+		d->data = p;
+		p += (size_t)d->width * d->height * comps;
+		if (comps == 4 && s->width % 2 == 0 && s->height % 2 == 0)
+			downsample_rgba_2x2(s->data, s->width, s->height,
+				d->data);
+		else
+			downsample_generic(s->data, s->width, s->height,
+				d->data, d->width, d->height, comps, tmp,
+				xt, yt);
+	}
+	return 0;
+}
+
+/* upload one level into the currently bound texture. pixels is normally
+ * the level's data, or an offset into a bound pixel unpack buffer. */
+void mipmap_upload_level(const struct mipmap *mm, unsigned level,
+	GLint internalFormat, const void *pixels)
+{
+	static const GLenum formats[] = {
+		0, GL_LUMINANCE, GL_LUMINANCE_ALPHA, GL_RGB, GL_RGBA,
+	};
+	const struct mip_level *l = &mm->level[level];
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, level, internalFormat, l->width,
+		l->height, 0, formats[mm->comps], GL_UNSIGNED_BYTE, pixels);
+}
+
+/* upload every level into the currently bound texture */
+void mipmap_upload(const struct mipmap *mm, GLint internalFormat)
+{
+	unsigned i;
+
+	for (i = 0; i < mm->num_levels; i++)
+		mipmap_upload_level(mm, i, internalFormat, mm->level[i].data);
+}
+
+/* throw away the n largest levels, always keeping the smallest one */
+void mipmap_drop(struct mipmap *mm, unsigned n)
+{
+	if (n >= mm->num_levels)
+		n = mm->num_levels ? mm->num_levels - 1 : 0;
+	memmove(mm->level, mm->level + n,
+		(mm->num_levels - n) * sizeof(*mm->level));
+	mm->num_levels -= n;
+}
+
+void mipmap_free(struct mipmap *mm)
+{
+	free(mm->storage);
+	memset(mm, 0, sizeof(*mm));
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef MIPMAP_H
+#define MIPMAP_H
+#include <stdbool.h>
+
+/* enough for a 65536x65536 image */
+#define MIPMAP_MAX_LEVELS 17
+
+struct mip_level {
+	int width, height;
+	unsigned char *data;
+};
+
+/* a full mip chain down to 1x1, level 0 may point at the caller's image */
+struct mipmap {
+	unsigned num_levels;
+	int comps; /* bytes per pixel */
+	struct mip_level level[MIPMAP_MAX_LEVELS];
+	unsigned char *storage; /* everything we allocated */
+};
+
+void mipmap_resize(const unsigned char *src, int sw, int sh,
+	unsigned char *dst, int dw, int dh, int comps);
+int mipmap_build(struct mipmap *mm, unsigned char *data, int width,
+	int height, int comps, bool npot);
+void mipmap_upload_level(const struct mipmap *mm, unsigned level,
+	GLint internalFormat, const void *pixels);
+void mipmap_upload(const struct mipmap *mm, GLint internalFormat);
+void mipmap_drop(struct mipmap *mm, unsigned n);
+void mipmap_free(struct mipmap *mm);
+#endif
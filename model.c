@@ -17,9 +17,9 @@ struct model *model_create(void)
 	mdl->bounding_box.min[0] = FLT_MAX;
 	mdl->bounding_box.min[1] = FLT_MAX;
 	mdl->bounding_box.min[2] = FLT_MAX;
-	mdl->bounding_box.max[0] = FLT_MIN;
-	mdl->bounding_box.max[1] = FLT_MIN;
-	mdl->bounding_box.max[2] = FLT_MIN;
+	mdl->bounding_box.max[0] = -FLT_MAX;
+	mdl->bounding_box.max[1] = -FLT_MAX;
+	mdl->bounding_box.max[2] = -FLT_MAX;
 
 	return mdl;
 }
@@ -54,7 +54,7 @@ struct object *model_object_create(struct model *mdl, const char *tag,
 	tmp->nr_vertex = 0;
 	tmp->global_vertex = use_global_vertex;
 	tmp->bounding_box.min[0] = tmp->bounding_box.min[1] = tmp->bounding_box.min[2] = FLT_MAX;
-	tmp->bounding_box.max[0] = tmp->bounding_box.max[1] = tmp->bounding_box.max[2] = FLT_MIN;
+	tmp->bounding_box.max[0] = tmp->bounding_box.max[1] = tmp->bounding_box.max[2] = -FLT_MAX;
 	return tmp;
 }
 
@@ -75,12 +75,12 @@ int model_vertex_add(struct model *mdl, float vertex0, float vertex1, float vert
 	(*tmp)[2] = vertex2;
 
 	/* we assume if a vertex is on the list that it is used */
-	mdl->bounding_box.min[0] = maxf(vertex0, mdl->bounding_box.min[0]);
-	mdl->bounding_box.min[1] = maxf(vertex1, mdl->bounding_box.min[1]);
-	mdl->bounding_box.min[2] = maxf(vertex2, mdl->bounding_box.min[2]);
-	mdl->bounding_box.max[0] = minf(vertex0, mdl->bounding_box.max[0]);
-	mdl->bounding_box.max[1] = minf(vertex1, mdl->bounding_box.max[1]);
-	mdl->bounding_box.max[2] = minf(vertex2, mdl->bounding_box.max[2]);
+	mdl->bounding_box.min[0] = minf(vertex0, mdl->bounding_box.min[0]);
+	mdl->bounding_box.min[1] = minf(vertex1, mdl->bounding_box.min[1]);
+	mdl->bounding_box.min[2] = minf(vertex2, mdl->bounding_box.min[2]);
+	mdl->bounding_box.max[0] = maxf(vertex0, mdl->bounding_box.max[0]);
+	mdl->bounding_box.max[1] = maxf(vertex1, mdl->bounding_box.max[1]);
+	mdl->bounding_box.max[2] = maxf(vertex2, mdl->bounding_box.max[2]);
 
 	return ret;
 }
@@ -103,22 +103,14 @@ int model_object_vertex_add(struct object *o, float vertex0, float vertex1, floa
 	(*tmp)[2] = vertex2;
 
 	/* we assume if a vertex is on the list that it is used */
-	o->bounding_box.min[0] = maxf(vertex0, o->bounding_box.min[0]);
-	o->bounding_box.min[1] = maxf(vertex1, o->bounding_box.min[1]);
-	o->bounding_box.min[2] = maxf(vertex2, o->bounding_box.min[2]);
-	o->bounding_box.max[0] = minf(vertex0, o->bounding_box.max[0]);
-	o->bounding_box.max[1] = minf(vertex1, o->bounding_box.max[1]);
-	o->bounding_box.max[2] = minf(vertex2, o->bounding_box.max[2]);
-
-	/* TODO: update the model bounding box too */
-#if 0
-	mdl->bounding_box.min[0] = maxf(vertex0, mdl->bounding_box.min[0]);
-	mdl->bounding_box.min[1] = maxf(vertex1, mdl->bounding_box.min[1]);
-	mdl->bounding_box.min[2] = maxf(vertex2, mdl->bounding_box.min[2]);
-	mdl->bounding_box.max[0] = minf(vertex0, mdl->bounding_box.max[0]);
-	mdl->bounding_box.max[1] = minf(vertex1, mdl->bounding_box.max[1]);
-	mdl->bounding_box.max[2] = minf(vertex2, mdl->bounding_box.max[2]);
-#endif
+	o->bounding_box.min[0] = minf(vertex0, o->bounding_box.min[0]);
+	o->bounding_box.min[1] = minf(vertex1, o->bounding_box.min[1]);
+	o->bounding_box.min[2] = minf(vertex2, o->bounding_box.min[2]);
+	o->bounding_box.max[0] = maxf(vertex0, o->bounding_box.max[0]);
+	o->bounding_box.max[1] = maxf(vertex1, o->bounding_box.max[1]);
+	o->bounding_box.max[2] = maxf(vertex2, o->bounding_box.max[2]);
+
+	/* the model's bounding box is updated by model_update_bounds() */
 	return 1;
 }
 
@@ -140,6 +132,50 @@ int model_object_face_add(struct object *o, unsigned face0, unsigned face1, unsi
 	return 1;
 }
 
+/* recalculate the bounding box of every object and of the whole model.
+ * objects using the global vertex pool only get the vertices they reference. */
+void model_update_bounds(struct model *m)
+{
+	struct object *o;
+	int i, j, k, l;
+
+	for (k = 0; k < 3; k++) {
+		m->bounding_box.min[k] = FLT_MAX;
+		m->bounding_box.max[k] = -FLT_MAX;
+	}
+	for (i = 0; i < m->nr_object; i++) {
+		o = m->object + i;
+		for (k = 0; k < 3; k++) {
+			o->bounding_box.min[k] = FLT_MAX;
+			o->bounding_box.max[k] = -FLT_MAX;
+		}
+		if (o->global_vertex) {
+			for (j = 0; j < o->nr_face; j++) {
+				for (l = 0; l < 3; l++) {
+					unsigned vi = o->face[j][l];
+					if (vi >= (unsigned)m->nr_vertex)
+						continue;
+					for (k = 0; k < 3; k++) {
+						o->bounding_box.min[k] = minf(m->vertex[vi][k], o->bounding_box.min[k]);
+						o->bounding_box.max[k] = maxf(m->vertex[vi][k], o->bounding_box.max[k]);
+					}
+				}
+			}
+		} else {
+			for (j = 0; j < o->nr_vertex; j++) {
+				for (k = 0; k < 3; k++) {
+					o->bounding_box.min[k] = minf(o->vertex[j][k], o->bounding_box.min[k]);
+					o->bounding_box.max[k] = maxf(o->vertex[j][k], o->bounding_box.max[k]);
+				}
+			}
+		}
+		for (k = 0; k < 3; k++) {
+			m->bounding_box.min[k] = minf(o->bounding_box.min[k], m->bounding_box.min[k]);
+			m->bounding_box.max[k] = maxf(o->bounding_box.max[k], m->bounding_box.max[k]);
+		}
+	}
+}
+
 void model_object_free(struct object *o)
 {
 	if (!o) return;
@@ -26,7 +26,6 @@ struct model {
 	struct object *object;
 	int nr_vertex;
 	float (*vertex)[3];
-	/* TODO: model_object_vertex_add() needs to update the bounding box */
 	struct {
 		float min[3];
 		float max[3];
@@ -38,6 +37,7 @@ struct object *model_object_create(struct model *mdl, const char *tag, int use_g
 int model_vertex_add(struct model *mdl, float vertex0, float vertex1, float vertex2);
 int model_object_vertex_add(struct object *o, float vertex0, float vertex1, float vertex2);
 int model_object_face_add(struct object *o, unsigned face0, unsigned face1, unsigned face2);
+void model_update_bounds(struct model *m);
 void model_object_free(struct object *o);
 int model_verify(struct model *m);
 void model_free(struct model *m);
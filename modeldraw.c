@@ -10,6 +10,7 @@
 #include <GL/glu.h>
 #include "logging.h"
 #include "model.h"
+#include "glstate.h"
 #include "modeldraw.h"
 
 static void cross_product(GLfloat c[3], GLfloat a[3], GLfloat b[3])
@@ -32,7 +33,7 @@ static int object_draw(struct object *obj, unsigned nr_vertex,
 	}
 
 	int f;
-	glEnable(GL_NORMALIZE);
+	glstate_enable(GL_NORMALIZE);
 	/* calculate normals if none are present in the model */
 	unsigned has_normals = obj->has_normals;
 	for (f = 0; f < obj->nr_face; f++) {
@@ -61,17 +62,16 @@ static int object_draw(struct object *obj, unsigned nr_vertex,
 		glVertex3fv(vertex[c]);
 		glEnd();
 	}
-	glDisable(GL_NORMALIZE);
+	glstate_disable(GL_NORMALIZE);
 
 	return 0;
 }
 
-int model_draw(struct model *mdl)
+/* draw a single object of a model */
+int model_object_draw(struct model *mdl, int i)
 {
-	int i;
-	for (i = 0; i < mdl->nr_object; i++) {
-		object_draw(mdl->object + i, mdl->nr_vertex,
-			(GLfloat(*)[3])mdl->vertex);
-	}
-	return 0;
+	if (i < 0 || i >= mdl->nr_object)
+		return -1;
+	return object_draw(mdl->object + i, mdl->nr_vertex,
+		(GLfloat(*)[3])mdl->vertex);
 }
@@ -1,3 +1,2 @@
-
 /* modeldraw.c */
-int model_draw(struct model *mdl);
+int model_object_draw(struct model *mdl, int i);
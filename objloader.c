@@ -293,6 +293,7 @@ struct model *obj_load_from_file(FILE *f, const char *filename)
 		debug("%s:model verification failed\n", filename);
 		goto error;
 	}
+	model_update_bounds(m);
 	return m;
 error:
 	model_free(m);
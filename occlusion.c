@@ -0,0 +1,202 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "grow.h"
+#include "glcaps.h"
+#include "glstate.h"
+#include "streambuf.h"
+#include "occlusion.h"
+
+/* check for query support, returns false and leaves everything visible if
+ * the queries can't be used. */
+bool occlusion_init(struct occlusion *oc)
+{
+	memset(oc, 0, sizeof(*oc));
+	if (!gl_has_version(1, 5)) {
+		warn("occlusion queries need OpenGL 1.5, disabled\n");
+		return false;
+	}
+	/* an implementation may support the API but count nothing */
+	GLint bits = 0;
+	glGetQueryiv(GL_SAMPLES_PASSED, GL_QUERY_COUNTER_BITS, &bits);
+	if (!bits) {
+		warn("occlusion queries have no counter bits, disabled\n");
+		return false;
+	}
+	oc->supported = true;
+	return true;
+}
+
+void occlusion_free(struct occlusion *oc)
+{
+	unsigned i;
+
+	for (i = 0; i < oc->max_queries; i++) {
+		if (oc->queries[i].id)
+			glDeleteQueries(1, &oc->queries[i].id);
+	}
+	free(oc->queries);
+	memset(oc, 0, sizeof(*oc));
+}
+
+/* clear the per-frame counters */
+void occlusion_frame(struct occlusion *oc)
+{
+	oc->issued = 0;
+}
+
+/* pick up the result of every finished query, never waiting for one.
+ * call on the GL thread before asking occlusion_visible(). */
+void occlusion_collect(struct occlusion *oc)
+{
+	unsigned i;
+
+	if (!oc->supported)
+		return;
+	for (i = 0; i < oc->max_queries; i++) {
+		struct occlusion_query *q = &oc->queries[i];
+		if (!q->pending)
+			continue;
+		GLuint available = 0;
+		glGetQueryObjectuiv(q->id, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+		GLuint samples = 0;
+		glGetQueryObjectuiv(q->id, GL_QUERY_RESULT, &samples);
+		q->visible = samples > 0;
+		q->pending = false;
+	}
+}
+
+/* last known visibility of object n. doesn't touch GL, so it is safe to
+ * call from any thread as long as nothing is issuing queries. */
+bool occlusion_visible(const struct occlusion *oc, unsigned n)
+{
+	if (!oc->supported || n >= oc->max_queries)
+		return true;
+	const struct occlusion_query *q = &oc->queries[n];
+	if (!q->id)
+		return true; /* never queried */
+	return q->visible;
+}
+
+/* drop what is known about object n, it is visible until queried again.
+ * used when the box can't be trusted, ex: the camera is inside it.
+ * threads may forget different objects at the same time. */
+void occlusion_forget(struct occlusion *oc, unsigned n)
+{
+	if (n >= oc->max_queries)
+		return;
+	oc->queries[n].pending = false;
+	oc->queries[n].visible = true;
+}
+
+/* forget every result, ex: after the queries were turned off for a while */
+void occlusion_reset(struct occlusion *oc)
+{
+	unsigned i;
+
+	for (i = 0; i < oc->max_queries; i++)
+		occlusion_forget(oc, i);
+}
+
+/* boxes only touch the depth test, they must not change the image.
+ * faces are not culled so a box the camera is close to still counts.
+ * boxes are streamed through sb, or drawn in immediate mode if it is NULL. */
+void occlusion_begin(struct occlusion *oc, struct streambuf *sb)
+{
+	oc->stream = sb;
+	if (sb)
+		glEnableClientState(GL_VERTEX_ARRAY);
+	glstate_use_program(0);
+	glstate_disable(GL_TEXTURE_2D);
+	glstate_disable(GL_LIGHTING);
+	glstate_disable(GL_CULL_FACE);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+}
+
+void occlusion_end(struct occlusion *oc)
+{
+	if (oc->stream) {
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		oc->stream = NULL;
+	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	glstate_enable(GL_CULL_FACE);
+}
+
+static void box_draw(struct streambuf *sb, const float min[3],
+	const float max[3])
+{
+	/* corner i uses max on axis k if bit k of i is set */
+	static const unsigned char faces[6][4] = {
+		{ 0, 2, 3, 1 }, { 4, 5, 7, 6 }, /* -z, +z */
+		{ 0, 1, 5, 4 }, { 2, 6, 7, 3 }, /* -y, +y */
+		{ 0, 4, 6, 2 }, { 1, 3, 7, 5 }, /* -x, +x */
+	};
+	GLfloat v[6 * 4][3];
+	unsigned i, j;
+
+	for (i = 0; i < 6; i++) {
+		for (j = 0; j < 4; j++) {
+			unsigned c = faces[i][j];
+			v[i * 4 + j][0] = c & 1 ? max[0] : min[0];
+			v[i * 4 + j][1] = c & 2 ? max[1] : min[1];
+			v[i * 4 + j][2] = c & 4 ? max[2] : min[2];
+		}
+	}
+
+	size_t offset;
+	void *p = sb ? streambuf_map(sb, sizeof(v), 16, &offset) : NULL;
+	if (p) {
+		memcpy(p, v, sizeof(v));
+		streambuf_unmap(sb);
+		glVertexPointer(3, GL_FLOAT, 0, (const GLvoid*)offset);
+		glDrawArrays(GL_QUADS, 0, 6 * 4);
+		return;
+	}
+	glBegin(GL_QUADS);
+	for (i = 0; i < 6 * 4; i++)
+		glVertex3fv(v[i]);
+	glEnd();
+}
+
+/* issue a query for object n's bounding box, in the space matrix transforms
+ * from. nothing is issued while the previous query is still in flight.
+ * must be called between occlusion_begin() and occlusion_end(). */
+void occlusion_query_box(struct occlusion *oc, unsigned n,
+	const float min[3], const float max[3], const float matrix[16])
+{
+	if (!oc->supported)
+		return;
+	if (grow(&oc->queries, &oc->max_queries, n + 1,
+		sizeof(*oc->queries))) {
+		error("Unable to allocate occlusion query!\n");
+		return;
+	}
+	struct occlusion_query *q = &oc->queries[n];
+	if (!q->id) {
+		glGenQueries(1, &q->id);
+		q->visible = true;
+	}
+	if (q->pending)
+		return;
+	glPushMatrix();
+	glMultMatrixf(matrix);
+	glBeginQuery(GL_SAMPLES_PASSED, q->id);
+	box_draw(oc->stream, min, max);
+	glEndQuery(GL_SAMPLES_PASSED);
+	glPopMatrix();
+	q->pending = true;
+	oc->issued++;
+}
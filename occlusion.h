@@ -0,0 +1,39 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+#include <stdbool.h>
+
+/* hardware occlusion queries on bounding boxes.
+ * results are read a frame after the query was issued and never waited
+ * on, anything without a result yet is treated as visible. */
+
+struct streambuf;
+
+struct occlusion_query {
+	GLuint id;
+	bool pending; /* issued, result not read yet */
+	bool visible; /* last known result */
+};
+
+struct occlusion {
+	bool supported;
+	struct occlusion_query *queries; /* indexed by the caller's object */
+	unsigned max_queries;
+	unsigned issued; /* queries started this frame */
+	struct streambuf *stream; /* between occlusion_begin() and _end() */
+};
+
+bool occlusion_init(struct occlusion *oc);
+void occlusion_free(struct occlusion *oc);
+void occlusion_frame(struct occlusion *oc);
+void occlusion_collect(struct occlusion *oc);
+bool occlusion_visible(const struct occlusion *oc, unsigned n);
+void occlusion_forget(struct occlusion *oc, unsigned n);
+void occlusion_reset(struct occlusion *oc);
+void occlusion_begin(struct occlusion *oc, struct streambuf *sb);
+void occlusion_query_box(struct occlusion *oc, unsigned n,
+	const float min[3], const float max[3], const float matrix[16]);
+void occlusion_end(struct occlusion *oc);
+#endif
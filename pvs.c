@@ -0,0 +1,450 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+/* builds the potentially visible set of every sector of a map.
+ *
+ * a sector can be seen from another if a single line passes through every
+ * portal on the way to it. this is checked from above, in 2D, which only
+ * ever adds sectors, so the result can be used to cull before the renderer
+ * does its own clipping. for each portal leading out of a sector the view
+ * is flowed from sector to sector: the next portal is cut down to the part
+ * that is beyond the previous one and between the separating lines of the
+ * first portal and the previous one, and the flow stops when nothing is
+ * left of it. like Quake's vis, only the first portal and the last one
+ * limit the view, which can let a little more through. */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "logging.h"
+#include "grow.h"
+#include "map.h"
+#include "threadpool.h"
+#include "pvs.h"
+
+/* distance in map units that still counts as being on a line */
+#define PVS_EPSILON 0.001f
+
+/* part of a wall, from x0,y0 to x1,y1. the sector it leads out of is on
+ * the left. */
+struct segment {
+	float x0, y0, x1, y1;
+};
+
+/* points with nx * x + ny * y >= d are in front */
+struct line {
+	float nx, ny, d;
+};
+
+/* the part of a wall that has already been flowed through */
+struct seen {
+	unsigned stamp; /* flow it belongs to */
+	float t0, t1; /* along the wall, 0 to 1 */
+};
+
+/* the view going into a sector through part of a portal */
+struct pass {
+	unsigned sector;
+	unsigned portals; /* passed on the way, including this one */
+	struct segment seg;
+};
+
+struct pvs_job {
+	const struct map_header *header;
+	const struct map_sector *sectors;
+	const struct map_wall *walls;
+	const struct map_vertex *vertices;
+	unsigned depth;
+	SDL_atomic_t next; /* sector to do next */
+	SDL_atomic_t failed;
+	/* compressed rows, each one allocated by the worker that built it */
+	unsigned char **rows;
+	uint32_t *sizes;
+	uint32_t *counts; /* sectors in each row, for the stats */
+};
+
+/* scratch space of one worker */
+struct flow {
+	struct pvs_job *job;
+	unsigned char *row; /* sectors seen so far */
+	struct seen *seen; /* one for every wall */
+	unsigned stamp;
+	struct segment source; /* the portal it started from */
+	struct pass *queue;
+	unsigned num_queue, max_queue;
+};
+
+static struct segment wall_segment(const struct pvs_job *job,
+	const struct map_sector *sec, unsigned i)
+{
+	const struct map_vertex *a, *b;
+
+	a = &job->vertices[job->walls[sec->first_wall +
+		(i ? i - 1 : sec->num_walls - 1)].vertex];
+	b = &job->vertices[job->walls[sec->first_wall + i].vertex];
+	/* the walls go clockwise on the map's x,y, with the sector on the
+	 * right. turn it around to have the sector on the left. */
+	return (struct segment){ b->x, b->y, a->x, a->y };
+}
+
+/* line through a and b facing left, false if they are the same point */
+static bool line_through(float ax, float ay, float bx, float by,
+	struct line *l)
+{
+	float dx = bx - ax, dy = by - ay;
+	float len = sqrtf(dx * dx + dy * dy);
+
+	if (len < PVS_EPSILON)
+		return false;
+	l->nx = -dy / len;
+	l->ny = dx / len;
+	l->d = l->nx * ax + l->ny * ay;
+	return true;
+}
+
+static float line_side(const struct line *l, float x, float y)
+{
+	return l->nx * x + l->ny * y - l->d;
+}
+
+static void line_flip(struct line *l)
+{
+	l->nx = -l->nx;
+	l->ny = -l->ny;
+	l->d = -l->d;
+}
+
+/* cut s down to the front of l, false if nothing is left of it */
+static bool clip(struct segment *s, const struct line *l)
+{
+	float d0 = line_side(l, s->x0, s->y0), d1 = line_side(l, s->x1, s->y1);
+
+	if (d0 < -PVS_EPSILON && d1 < -PVS_EPSILON)
+		return false;
+	if (d0 < -PVS_EPSILON || d1 < -PVS_EPSILON) {
+		float t = d0 / (d0 - d1);
+		float x = s->x0 + (s->x1 - s->x0) * t;
+		float y = s->y0 + (s->y1 - s->y0) * t;
+		if (d0 < -PVS_EPSILON) {
+			s->x0 = x;
+			s->y0 = y;
+		} else {
+			s->x1 = x;
+			s->y1 = y;
+		}
+	}
+	float dx = s->x1 - s->x0, dy = s->y1 - s->y0;
+	return dx * dx + dy * dy >= PVS_EPSILON * PVS_EPSILON;
+}
+
+/* cut s down to what is beyond pass, coming from the left of pass */
+static bool clip_beyond(struct segment *s, const struct segment *pass)
+{
+	struct line l;
+
+	if (!line_through(pass->x0, pass->y0, pass->x1, pass->y1, &l))
+		return false;
+	line_flip(&l);
+	/* walls lying along pass, like the way back, can't be seen */
+	if (line_side(&l, s->x0, s->y0) <= PVS_EPSILON &&
+		line_side(&l, s->x1, s->y1) <= PVS_EPSILON)
+		return false;
+	return clip(s, &l);
+}
+
+/* cut s down to what can be seen from source through pass. every line
+ * through a corner of each that has source on one side and pass on the
+ * other bounds the view, beyond pass it is on the side pass is on. */
+static bool clip_separating(struct segment *s, const struct segment *source,
+	const struct segment *pass)
+{
+	const float sx[2] = { source->x0, source->x1 };
+	const float sy[2] = { source->y0, source->y1 };
+	const float px[2] = { pass->x0, pass->x1 };
+	const float py[2] = { pass->y0, pass->y1 };
+	unsigned i, j;
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2; j++) {
+			struct line l;
+			if (!line_through(sx[i], sy[i], px[j], py[j], &l))
+				continue;
+			float ds = line_side(&l, sx[!i], sy[!i]);
+			float dp = line_side(&l, px[!j], py[!j]);
+			if ((ds > PVS_EPSILON && dp < -PVS_EPSILON) ||
+				(ds < -PVS_EPSILON && dp > PVS_EPSILON)) {
+				if (dp < 0.0f)
+					line_flip(&l);
+				if (!clip(s, &l))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* position of x,y along wall w, 0 at its start and 1 at its end */
+static float wall_position(const struct segment *w, float x, float y)
+{
+	float dx = w->x1 - w->x0, dy = w->y1 - w->y0;
+
+	return ((x - w->x0) * dx + (y - w->y0) * dy) / (dx * dx + dy * dy);
+}
+
+static struct segment wall_part(const struct segment *w, float t0, float t1)
+{
+	float dx = w->x1 - w->x0, dy = w->y1 - w->y0;
+
+	return (struct segment){
+		w->x0 + dx * t0, w->y0 + dy * t0,
+		w->x0 + dx * t1, w->y0 + dy * t1,
+	};
+}
+
+/* queue the pieces of s, part of wall n, that haven't been flowed through
+ * yet. what can be seen through a piece is the union of what can be seen
+ * through each of its points, so the pieces already done can be skipped.
+ * the flow is breadth first, so they were reached through fewer portals.
+ * -1 on error. */
+static int flow_push(struct flow *f, unsigned n, const struct segment *w,
+	const struct segment *s, unsigned portals)
+{
+	struct seen *seen = &f->seen[n];
+	float t0 = wall_position(w, s->x0, s->y0);
+	float t1 = wall_position(w, s->x1, s->y1);
+	float part[2][2];
+	unsigned i, num_parts = 0;
+	/* slivers left over from rounding aren't worth following */
+	float dx = w->x1 - w->x0, dy = w->y1 - w->y0;
+	float min_part = PVS_EPSILON / sqrtf(dx * dx + dy * dy);
+
+	if (seen->stamp != f->stamp || t1 < seen->t0 || t0 > seen->t1) {
+		part[num_parts][0] = t0;
+		part[num_parts++][1] = t1;
+		/* only one piece is kept, the longer one */
+		if (seen->stamp != f->stamp || t1 - t0 > seen->t1 - seen->t0)
+			*seen = (struct seen){ f->stamp, t0, t1 };
+	} else {
+		if (t0 < seen->t0) {
+			part[num_parts][0] = t0;
+			part[num_parts++][1] = seen->t0;
+			seen->t0 = t0;
+		}
+		if (t1 > seen->t1) {
+			part[num_parts][0] = seen->t1;
+			part[num_parts++][1] = t1;
+			seen->t1 = t1;
+		}
+	}
+	if (grow(&f->queue, &f->max_queue, f->num_queue + num_parts,
+		sizeof(*f->queue)))
+		return -1;
+	for (i = 0; i < num_parts; i++) {
+		if (part[i][1] - part[i][0] < min_part)
+			continue;
+		f->queue[f->num_queue++] = (struct pass){
+			f->job->walls[n].portal, portals,
+			wall_part(w, part[i][0], part[i][1]),
+		};
+	}
+	return 0;
+}
+
+/* flow the view out of a sector through one of its portals. -1 on error. */
+static int flow(struct flow *f, unsigned portal, const struct segment *source)
+{
+	const struct pvs_job *job = f->job;
+	unsigned i, cur;
+
+	f->stamp++;
+	f->source = *source;
+	f->num_queue = 0;
+	if (grow(&f->queue, &f->max_queue, 1, sizeof(*f->queue)))
+		return -1;
+	f->queue[f->num_queue++] = (struct pass){ portal, 1, *source };
+	for (cur = 0; cur < f->num_queue; cur++) {
+		const struct pass pass = f->queue[cur];
+		const struct map_sector *sec = &job->sectors[pass.sector];
+
+		f->row[pass.sector / 8] |= 1 << pass.sector % 8;
+		if (pass.portals >= job->depth)
+			continue;
+		for (i = 0; i < sec->num_walls; i++) {
+			unsigned w = sec->first_wall + i;
+			if (job->walls[w].portal == MAP_NONE)
+				continue;
+			struct segment wall = wall_segment(job, sec, i);
+			struct segment s = wall;
+			if (!clip_beyond(&s, &pass.seg))
+				continue;
+			/* next to the source any line through both will do */
+			if (pass.portals > 1 &&
+				!clip_separating(&s, &f->source, &pass.seg))
+				continue;
+			if (flow_push(f, w, &wall, &s, pass.portals + 1))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/* zero bytes become a 0 and the length of the run. returns the size. */
+static uint32_t row_compress(const unsigned char *row, size_t len,
+	unsigned char *out)
+{
+	uint32_t size = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		if (row[i]) {
+			out[size++] = row[i++];
+			continue;
+		}
+		unsigned run = 0;
+		while (i < len && !row[i] && run < 255) {
+			run++;
+			i++;
+		}
+		out[size++] = 0;
+		out[size++] = run;
+	}
+	return size;
+}
+
+static int row_build(struct flow *f, unsigned n, unsigned char *out)
+{
+	struct pvs_job *job = f->job;
+	const struct map_sector *sec = &job->sectors[n];
+	size_t len = (job->header->num_sectors + 7) / 8;
+	unsigned i, count = 0;
+
+	memset(f->row, 0, len);
+	f->row[n / 8] |= 1 << n % 8;
+	if (job->depth) {
+		for (i = 0; i < sec->num_walls; i++) {
+			unsigned portal = job->walls[sec->first_wall + i].portal;
+			if (portal == MAP_NONE)
+				continue;
+			struct segment source = wall_segment(job, sec, i);
+			if (flow(f, portal, &source))
+				return -1;
+		}
+	}
+	for (i = 0; i < len; i++) {
+		unsigned char c = f->row[i];
+		for (; c; c &= c - 1)
+			count++;
+	}
+	job->counts[n] = count;
+
+	uint32_t size = row_compress(f->row, len, out);
+	job->rows[n] = malloc(size ? size : 1);
+	if (!job->rows[n])
+		return -1;
+	memcpy(job->rows[n], out, size);
+	job->sizes[n] = size;
+	return 0;
+}
+
+/* every worker takes sectors until there are none left, so each needs its
+ * own scratch space only once */
+static void pvs_worker(void *arg, unsigned index)
+{
+	struct pvs_job *job = arg;
+	size_t len = (job->header->num_sectors + 7) / 8;
+	struct flow f = { .job = job };
+	unsigned n;
+
+	(void)index;
+	f.row = malloc(len);
+	f.seen = calloc(job->header->num_walls + 1, sizeof(*f.seen));
+	/* at worst every byte needs two */
+	unsigned char *out = malloc(len * 2 + 1);
+	if (!f.row || !f.seen || !out) {
+		SDL_AtomicSet(&job->failed, 1);
+		goto out;
+	}
+	while (!SDL_AtomicGet(&job->failed)) {
+		n = SDL_AtomicAdd(&job->next, 1);
+		if (n >= job->header->num_sectors)
+			break;
+		if (row_build(&f, n, out))
+			SDL_AtomicSet(&job->failed, 1);
+	}
+out:
+	free(out);
+	free(f.queue);
+	free(f.seen);
+	free(f.row);
+}
+
+/* build the PVS of a map that has passed hero-mapc's checks, looking
+ * through at most depth portals from each sector. -1 on error. */
+int pvs_build(struct threadpool *pool, const struct map_header *header,
+	const struct map_sector *sectors, const struct map_wall *walls,
+	const struct map_vertex *vertices, unsigned depth, struct map_pvs *pvs)
+{
+	struct pvs_job job = {
+		.header = header,
+		.sectors = sectors,
+		.walls = walls,
+		.vertices = vertices,
+		.depth = depth,
+	};
+	unsigned i, n = header->num_sectors;
+	int ret = -1;
+
+	memset(pvs, 0, sizeof(*pvs));
+	job.rows = calloc(n + 1, sizeof(*job.rows));
+	job.sizes = calloc(n + 1, sizeof(*job.sizes));
+	job.counts = calloc(n + 1, sizeof(*job.counts));
+	pvs->offsets = calloc(n + 1, sizeof(*pvs->offsets));
+	if (!job.rows || !job.sizes || !job.counts || !pvs->offsets)
+		goto out;
+	threadpool_run(pool, threadpool_size(pool), pvs_worker, &job);
+	if (SDL_AtomicGet(&job.failed))
+		goto out;
+
+	uint64_t total = 0, visible = 0;
+	for (i = 0; i < n; i++) {
+		pvs->offsets[i] = total;
+		total += job.sizes[i];
+		visible += job.counts[i];
+	}
+	if (total > UINT32_MAX - 4 * (n + 1)) {
+		error("PVS is too large\n");
+		goto out;
+	}
+	pvs->offsets[n] = total;
+	pvs->rows = malloc(total ? total : 1);
+	if (!pvs->rows)
+		goto out;
+	for (i = 0; i < n; i++)
+		memcpy(pvs->rows + pvs->offsets[i], job.rows[i], job.sizes[i]);
+	pvs->depth = depth;
+	info("PVS: %u portals deep, %.1f of %u sectors visible on average, "
+		"%u bytes\n", depth,
+		n ? (double)visible / n : 0.0, n,
+		(unsigned)total);
+	ret = 0;
+out:
+	if (ret) {
+		error("Unable to build the PVS!\n");
+		pvs_free(pvs);
+	}
+	for (i = 0; job.rows && i < n; i++)
+		free(job.rows[i]);
+	free(job.rows);
+	free(job.sizes);
+	free(job.counts);
+	return ret;
+}
+
+void pvs_free(struct map_pvs *pvs)
+{
+	free(pvs->offsets);
+	free(pvs->rows);
+	memset(pvs, 0, sizeof(*pvs));
+}
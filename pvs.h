@@ -0,0 +1,13 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef PVS_H
+#define PVS_H
+#include "map.h"
+#include "threadpool.h"
+
+int pvs_build(struct threadpool *pool, const struct map_header *header,
+	const struct map_sector *sectors, const struct map_wall *walls,
+	const struct map_vertex *vertices, unsigned depth, struct map_pvs *pvs);
+void pvs_free(struct map_pvs *pvs);
+#endif
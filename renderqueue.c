@@ -0,0 +1,276 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "grow.h"
+#include "glstate.h"
+#include "model.h"
+#include "modeldraw.h"
+#include "shader.h"
+#include "worldmesh.h"
+#include "renderqueue.h"
+
+/* key and item number, sorted together to keep the sort cache friendly */
+struct rq_sort {
+	uint64_t key;
+	uint32_t index;
+};
+
+#define FIELD(v, bits) ((uint64_t)(v) & ((UINT64_C(1) << (bits)) - 1))
+
+/* pack a sort key. depth is clamped to [0, max_depth] and quantized. */
+uint64_t rq_key(enum rq_pass pass, unsigned shader, GLuint texture,
+	unsigned material, float depth, float max_depth)
+{
+	const uint32_t depth_max = (1u << RQ_DEPTH_BITS) - 1;
+	uint32_t d;
+
+	if (!(depth > 0.0f))
+		d = 0;
+	else if (depth >= max_depth)
+		d = depth_max;
+	else
+		d = (uint32_t)(depth / max_depth * depth_max);
+	if (pass == RQ_PASS_TRANSLUCENT)
+		d = depth_max - d; /* back to front */
+
+	uint64_t key = FIELD(pass, RQ_PASS_BITS);
+	key = (key << RQ_SHADER_BITS) | FIELD(shader, RQ_SHADER_BITS);
+	key = (key << RQ_TEXTURE_BITS) | FIELD(texture, RQ_TEXTURE_BITS);
+	key = (key << RQ_MATERIAL_BITS) | FIELD(material, RQ_MATERIAL_BITS);
+	key = (key << RQ_DEPTH_BITS) | FIELD(d, RQ_DEPTH_BITS);
+	return key;
+}
+
+/* start a new frame. the material table must live until the last
+ * rq_submit_type(). */
+void rq_begin(struct render_queue *q, const struct material *materials,
+	unsigned num_materials)
+{
+	q->num_items = 0;
+	q->materials = materials;
+	q->num_materials = num_materials;
+	memset(&q->stats, 0, sizeof(q->stats));
+}
+
+/* returns a cleared item at the end of the queue, or NULL on error. */
+struct rq_item *rq_add(struct render_queue *q)
+{
+	if (grow(&q->items, &q->max_items, q->num_items + 1,
+		sizeof(*q->items))) {
+		error("Unable to allocate render queue item!\n");
+		return NULL;
+	}
+	struct rq_item *item = &q->items[q->num_items++];
+	memset(item, 0, sizeof(*item));
+	return item;
+}
+
+/* copy n recorded items onto the end of the queue, -1 on error. */
+int rq_append(struct render_queue *q, const struct rq_item *items, unsigned n)
+{
+	if (!n)
+		return 0;
+	if (grow(&q->items, &q->max_items, q->num_items + n,
+		sizeof(*q->items))) {
+		error("Unable to allocate render queue items!\n");
+		return -1;
+	}
+	memcpy(q->items + q->num_items, items, n * sizeof(*items));
+	q->num_items += n;
+	return 0;
+}
+
+/* LSD radix sort of 64-bit keys, 8 bits at a time.
+ * passes where every key shares the same digit are skipped, which is the
+ * common case for the pass and shader fields. */
+static struct rq_sort *radix_sort(struct rq_sort *a, struct rq_sort *tmp,
+	unsigned n)
+{
+	unsigned shift, i;
+
+	for (shift = 0; shift < 64; shift += 8) {
+		unsigned count[256];
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++)
+			count[(a[i].key >> shift) & 0xff]++;
+		if (count[(a[0].key >> shift) & 0xff] == n)
+			continue;
+		unsigned total = 0;
+		for (i = 0; i < 256; i++) {
+			unsigned c = count[i];
+			count[i] = total;
+			total += c;
+		}
+		for (i = 0; i < n; i++)
+			tmp[count[(a[i].key >> shift) & 0xff]++] = a[i];
+		struct rq_sort *swap = a;
+		a = tmp;
+		tmp = swap;
+	}
+	return a;
+}
+
+void rq_sort(struct render_queue *q)
+{
+	unsigned i, n = q->num_items;
+
+	if (grow(&q->sort, &q->max_sort, n + 1, sizeof(*q->sort)) ||
+		grow(&q->sort_tmp, &q->max_sort_tmp, n + 1,
+		sizeof(*q->sort_tmp))) {
+		error("Unable to allocate render queue sort space!\n");
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		q->sort[i].key = q->items[i].key;
+		q->sort[i].index = i;
+	}
+	struct rq_sort *sorted = radix_sort(q->sort, q->sort_tmp, n);
+	if (sorted != q->sort) {
+		/* keep q->sort as the result */
+		q->sort_tmp = q->sort;
+		q->sort = sorted;
+		unsigned swap = q->max_sort;
+		q->max_sort = q->max_sort_tmp;
+		q->max_sort_tmp = swap;
+	}
+}
+
+static void material_apply(const struct material *mat, bool lighting)
+{
+	if (lighting) {
+		glstate_materialfv(GL_FRONT, GL_SPECULAR, mat->specular);
+		glstate_materialfv(GL_FRONT, GL_DIFFUSE, mat->diffuse);
+		glstate_materialfv(GL_FRONT, GL_AMBIENT, mat->ambient);
+		glstate_materialfv(GL_FRONT, GL_EMISSION, mat->emission);
+		glstate_materialf(GL_FRONT, GL_SHININESS, mat->shininess);
+	} else {
+		glstate_color4fv(mat->color);
+	}
+}
+
+/* switch between no texture, a 2D texture and an array texture */
+static void texturing_set(struct shader *shader, enum shader_texture mode)
+{
+	if (shader) {
+		shader_texturing(shader, mode);
+		return;
+	}
+	if (mode == SHADER_TEXTURE_2D)
+		glstate_enable(GL_TEXTURE_2D);
+	else
+		glstate_disable(GL_TEXTURE_2D);
+}
+
+/* draw the items of one type in sorted order, only changing state when it
+ * differs from the previous item, so the types can be drawn (or timed) as
+ * separate passes. rq_sort() must be called first.
+ * state left over from the previous frame is reused through glstate.
+ * with a shader materials and texturing become uniforms, the caller must
+ * have called shader_begin(). pass NULL for the fixed-function pipeline. */
+void rq_submit_type(struct render_queue *q, enum rq_type type, bool lighting,
+	struct shader *shader)
+{
+	unsigned i;
+	GLuint cur_texture = 0;
+	enum shader_texture texturing = SHADER_TEXTURE_NONE;
+	unsigned cur_material = ~0u;
+	const GLint *cur_scissor = NULL;
+	const struct worldmesh *cur_mesh = NULL;
+
+	texturing_set(shader, texturing);
+	for (i = 0; i < q->num_items; i++) {
+		const struct rq_item *item = &q->items[q->sort[i].index];
+
+		if (item->type != type)
+			continue;
+		q->stats.items++;
+		/* fixed-function can't sample arrays, those go untextured */
+		enum shader_texture mode = SHADER_TEXTURE_NONE;
+		if (item->texture && !item->texture_array)
+			mode = SHADER_TEXTURE_2D;
+		else if (item->texture && shader)
+			mode = SHADER_TEXTURE_ARRAY;
+		if (mode != SHADER_TEXTURE_NONE && item->texture != cur_texture) {
+			if (mode == SHADER_TEXTURE_ARRAY) {
+				glstate_active_texture(GL_TEXTURE0 +
+					SHADER_ARRAY_UNIT);
+				glstate_bind_texture(GL_TEXTURE_2D_ARRAY_EXT,
+					item->texture);
+				glstate_active_texture(GL_TEXTURE0);
+			} else {
+				glstate_bind_texture(GL_TEXTURE_2D, item->texture);
+			}
+			q->stats.texture_binds++;
+			cur_texture = item->texture;
+		}
+		if (mode != texturing) {
+			texturing_set(shader, mode);
+			texturing = mode;
+		}
+
+		if (item->material != cur_material &&
+			item->material < q->num_materials) {
+			if (shader)
+				shader_material(shader, &q->materials[item->material]);
+			else
+				material_apply(&q->materials[item->material], lighting);
+			q->stats.material_changes++;
+			cur_material = item->material;
+		}
+
+		if (!item->has_scissor && cur_scissor) {
+			glstate_disable(GL_SCISSOR_TEST);
+			cur_scissor = NULL;
+		} else if (item->has_scissor && (!cur_scissor ||
+			memcmp(cur_scissor, item->scissor, sizeof(item->scissor)))) {
+			glstate_enable(GL_SCISSOR_TEST);
+			glScissor(item->scissor[0], item->scissor[1],
+				item->scissor[2], item->scissor[3]);
+			q->stats.scissor_changes++;
+			cur_scissor = item->scissor;
+		}
+
+		if (item->has_matrix) {
+			glPushMatrix();
+			glMultMatrixf(item->matrix);
+			q->stats.matrix_changes++;
+		}
+		switch ((enum rq_type)item->type) {
+		case RQ_DRAW_OBJECT:
+			model_object_draw(item->u.obj.model, item->u.obj.object);
+			break;
+		case RQ_DRAW_RANGES:
+			if (item->u.ranges.mesh != cur_mesh) {
+				cur_mesh = item->u.ranges.mesh;
+				worldmesh_bind(cur_mesh);
+			}
+			glMultiDrawElements(GL_TRIANGLES, item->u.ranges.counts,
+				GL_UNSIGNED_INT, (const GLvoid**)item->u.ranges.offsets,
+				item->u.ranges.num);
+			break;
+		}
+		if (item->has_matrix)
+			glPopMatrix();
+	}
+	if (!shader)
+		glstate_disable(GL_TEXTURE_2D);
+	glstate_disable(GL_SCISSOR_TEST);
+	if (cur_mesh)
+		worldmesh_unbind(cur_mesh);
+}
+
+void rq_free(struct render_queue *q)
+{
+	free(q->items);
+	free(q->sort);
+	free(q->sort_tmp);
+	memset(q, 0, sizeof(*q));
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "material.h"
+
+/* sort key layout, from most to least significant:
+ *   pass:4 shader:8 texture:16 material:12 depth:24
+ * items are drawn in ascending key order. */
+#define RQ_DEPTH_BITS 24
+#define RQ_MATERIAL_BITS 12
+#define RQ_TEXTURE_BITS 16
+#define RQ_SHADER_BITS 8
+#define RQ_PASS_BITS 4
+
+enum rq_pass {
+	RQ_PASS_OPAQUE,
+	RQ_PASS_TRANSLUCENT, /* sorted back to front */
+};
+
+enum rq_type {
+	RQ_DRAW_OBJECT, /* one object of a model */
+	RQ_DRAW_RANGES, /* glMultiDrawElements() of a world mesh's triangles */
+};
+
+struct model;
+struct shader;
+struct worldmesh;
+
+struct rq_item {
+	uint64_t key;
+	unsigned char type; /* enum rq_type */
+	bool has_matrix; /* multiply matrix onto the modelview */
+	bool texture_array; /* texture is a 2D array, only with a shader */
+	bool has_scissor; /* only draw inside scissor */
+	GLint scissor[4]; /* x, y, width, height in window pixels */
+	GLuint texture; /* 0 for untextured */
+	unsigned material; /* index into the queue's material table */
+	union {
+		struct {
+			struct model *model;
+			int object;
+		} obj;
+		struct {
+			const struct worldmesh *mesh;
+			const GLsizei *counts;
+			const GLvoid *const *offsets; /* GL_UNSIGNED_INT indices */
+			GLsizei num;
+		} ranges;
+	} u;
+	GLfloat matrix[16];
+};
+
+struct rq_stats {
+	unsigned items;
+	unsigned texture_binds;
+	unsigned material_changes;
+	unsigned matrix_changes;
+	unsigned scissor_changes;
+};
+
+struct render_queue {
+	struct rq_item *items;
+	unsigned num_items, max_items;
+	/* scratch space for sorting */
+	struct rq_sort *sort, *sort_tmp;
+	unsigned max_sort, max_sort_tmp;
+	/* materials referenced by rq_item.material */
+	const struct material *materials;
+	unsigned num_materials;
+	struct rq_stats stats;
+};
+
+uint64_t rq_key(enum rq_pass pass, unsigned shader, GLuint texture,
+	unsigned material, float depth, float max_depth);
+void rq_begin(struct render_queue *q, const struct material *materials,
+	unsigned num_materials);
+struct rq_item *rq_add(struct render_queue *q);
+int rq_append(struct render_queue *q, const struct rq_item *items, unsigned n);
+void rq_sort(struct render_queue *q);
+void rq_submit_type(struct render_queue *q, enum rq_type type, bool lighting,
+	struct shader *shader);
+void rq_free(struct render_queue *q);
+#endif
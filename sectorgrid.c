@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "map.h"
+#include "sectorgrid.h"
+
+/* the grid never has more cells than this many per sector */
+#define CELLS_PER_SECTOR 2
+
+struct bounds {
+	float x0, y0, x1, y1;
+};
+
+static struct bounds sector_bounds(const struct map *m,
+	const struct map_sector *sec)
+{
+	struct bounds b = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+	unsigned i;
+
+	for (i = 0; i < sec->num_walls; i++) {
+		const struct map_vertex *v = map_wall_vertex(m, sec, i);
+		b.x0 = fminf(b.x0, v->x);
+		b.y0 = fminf(b.y0, v->y);
+		b.x1 = fmaxf(b.x1, v->x);
+		b.y1 = fmaxf(b.y1, v->y);
+	}
+	return b;
+}
+
+static unsigned cell_clamp(float f, unsigned size)
+{
+	if (!(f > 0.0f))
+		return 0;
+	if (f >= size)
+		return size - 1;
+	return f;
+}
+
+/* range of cells covered by b, inclusive */
+static void cell_range(const struct sectorgrid *g, const struct bounds *b,
+	unsigned *cx0, unsigned *cy0, unsigned *cx1, unsigned *cy1)
+{
+	*cx0 = cell_clamp((b->x0 - g->x0) * g->scale, g->width);
+	*cy0 = cell_clamp((b->y0 - g->y0) * g->scale, g->height);
+	*cx1 = cell_clamp((b->x1 - g->x0) * g->scale, g->width);
+	*cy1 = cell_clamp((b->y1 - g->y0) * g->scale, g->height);
+}
+
+/* index every sector of m. the cells are sized for one or two sectors
+ * each, so finding a point only tests a few sectors. -1 on error. */
+int sectorgrid_build(struct sectorgrid *g, const struct map *m)
+{
+	struct bounds all = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+	unsigned i, x, y, cx0, cy0, cx1, cy1;
+
+	memset(g, 0, sizeof(*g));
+	for (i = 0; i < m->num_sectors; i++) {
+		const struct map_sector *sec = map_sector(m, i);
+		if (!sec || !sec->num_walls)
+			continue;
+		struct bounds b = sector_bounds(m, sec);
+		all.x0 = fminf(all.x0, b.x0);
+		all.y0 = fminf(all.y0, b.y0);
+		all.x1 = fmaxf(all.x1, b.x1);
+		all.y1 = fmaxf(all.y1, b.y1);
+	}
+	if (all.x0 > all.x1)
+		all = (struct bounds){ 0.0f, 0.0f, 1.0f, 1.0f };
+	float w = fmaxf(all.x1 - all.x0, 1.0f), h = fmaxf(all.y1 - all.y0, 1.0f);
+	double cells = (double)(m->num_sectors ? m->num_sectors : 1) *
+		CELLS_PER_SECTOR;
+	g->x0 = all.x0;
+	g->y0 = all.y0;
+	g->scale = sqrt(cells / ((double)w * h));
+	g->width = fmin(fmax(ceil(w * g->scale), 1.0), cells);
+	g->height = fmin(fmax(ceil(h * g->scale), 1.0), cells);
+
+	/* count the sectors of each cell, then fill them in */
+	size_t num_cells = (size_t)g->width * g->height;
+	g->cells = calloc(num_cells + 1, sizeof(*g->cells));
+	if (!g->cells)
+		goto fail;
+	uint64_t total = 0;
+	for (i = 0; i < m->num_sectors; i++) {
+		const struct map_sector *sec = map_sector(m, i);
+		if (!sec || !sec->num_walls)
+			continue;
+		struct bounds b = sector_bounds(m, sec);
+		cell_range(g, &b, &cx0, &cy0, &cx1, &cy1);
+		for (y = cy0; y <= cy1; y++)
+			for (x = cx0; x <= cx1; x++)
+				g->cells[y * g->width + x]++;
+		total += (uint64_t)(cx1 - cx0 + 1) * (cy1 - cy0 + 1);
+	}
+	if (total > UINT32_MAX)
+		goto fail;
+	uint32_t offset = 0;
+	for (i = 0; i <= num_cells; i++) {
+		uint32_t count = g->cells[i];
+		g->cells[i] = offset;
+		offset += count;
+	}
+	g->sectors = malloc((total ? total : 1) * sizeof(*g->sectors));
+	if (!g->sectors)
+		goto fail;
+	/* cells[n] counts up to the start of the next cell, then is put back */
+	for (i = 0; i < m->num_sectors; i++) {
+		const struct map_sector *sec = map_sector(m, i);
+		if (!sec || !sec->num_walls)
+			continue;
+		struct bounds b = sector_bounds(m, sec);
+		cell_range(g, &b, &cx0, &cy0, &cx1, &cy1);
+		for (y = cy0; y <= cy1; y++)
+			for (x = cx0; x <= cx1; x++)
+				g->sectors[g->cells[y * g->width + x]++] = i;
+	}
+	for (i = num_cells; i > 0; i--)
+		g->cells[i] = g->cells[i - 1];
+	g->cells[0] = 0;
+	verbose("sector grid: %ux%u cells, %u entries\n", g->width, g->height,
+		(unsigned)total);
+	return 0;
+fail:
+	error("Unable to allocate sector grid!\n");
+	sectorgrid_free(g);
+	return -1;
+}
+
+void sectorgrid_free(struct sectorgrid *g)
+{
+	free(g->cells);
+	free(g->sectors);
+	memset(g, 0, sizeof(*g));
+}
+
+/* the sector x,y is in, MAP_NONE if it is outside of the map */
+unsigned sectorgrid_find(const struct sectorgrid *g, const struct map *m,
+	float x, float y)
+{
+	if (!g->cells)
+		return MAP_NONE;
+	float fx = (x - g->x0) * g->scale, fy = (y - g->y0) * g->scale;
+	if (!(fx >= 0.0f && fy >= 0.0f && fx <= g->width && fy <= g->height))
+		return MAP_NONE;
+	unsigned cell = cell_clamp(fy, g->height) * g->width +
+		cell_clamp(fx, g->width);
+	uint32_t i;
+	for (i = g->cells[cell]; i < g->cells[cell + 1]; i++) {
+		const struct map_sector *sec = map_sector(m, g->sectors[i]);
+		if (sec && map_sector_contains(m, sec, x, y))
+			return g->sectors[i];
+	}
+	return MAP_NONE;
+}
+
+/* the sector x,y is in, given that it was in cur a moment ago. cur and the
+ * sectors through its portals are tried before the grid. outside of the map
+ * it stays in cur. */
+unsigned sectorgrid_track(const struct sectorgrid *g, const struct map *m,
+	unsigned cur, float x, float y)
+{
+	const struct map_sector *sec = map_sector(m, cur);
+	unsigned i;
+
+	if (sec) {
+		if (map_sector_contains(m, sec, x, y))
+			return cur;
+		for (i = 0; i < sec->num_walls; i++) {
+			unsigned portal = map_wall_portal(m, sec, i);
+			const struct map_sector *next = map_sector(m, portal);
+			if (next && map_sector_contains(m, next, x, y))
+				return portal;
+		}
+	}
+	unsigned found = sectorgrid_find(g, m, x, y);
+	return found != MAP_NONE ? found : cur;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef SECTORGRID_H
+#define SECTORGRID_H
+#include <stdint.h>
+
+struct map;
+
+/* finds the sector a point is in. the map is split into square cells, and
+ * each cell lists the sectors whose bounds overlap it. */
+struct sectorgrid {
+	float x0, y0; /* corner of the first cell */
+	float scale; /* cells per map unit */
+	unsigned width, height; /* in cells */
+	uint32_t *cells; /* width * height + 1 offsets into sectors */
+	uint32_t *sectors;
+};
+
+int sectorgrid_build(struct sectorgrid *g, const struct map *m);
+void sectorgrid_free(struct sectorgrid *g);
+unsigned sectorgrid_find(const struct sectorgrid *g, const struct map *m,
+	float x, float y);
+unsigned sectorgrid_track(const struct sectorgrid *g, const struct map *m,
+	unsigned cur, float x, float y);
+#endif
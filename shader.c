@@ -0,0 +1,344 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "material.h"
+#include "glstate.h"
+#include "shader.h"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+/* lighting is calculated in world space, so light positions only need to be
+ * uploaded when a light moves, not every time the camera does. */
+static const char version_source[] = "#version 120\n";
+
+/* inserted after the version when texture arrays are available */
+static const char array_source[] =
+	"#extension GL_EXT_texture_array : require\n"
+	"#define TEXTURE_ARRAY\n";
+
+static const char vertex_source[] =
+	"uniform mat4 u_camera; /* eye to world */\n"
+	"varying vec3 v_position;\n"
+	"varying vec3 v_normal;\n"
+	"varying vec3 v_texcoord;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 eye = gl_ModelViewMatrix * gl_Vertex;\n"
+	"	v_position = (u_camera * eye).xyz;\n"
+	"	v_normal = mat3(u_camera) * (gl_NormalMatrix * gl_Normal);\n"
+	"	v_texcoord = gl_MultiTexCoord0.stp;\n"
+	"	gl_Position = gl_ProjectionMatrix * eye;\n"
+	"}\n";
+
+static const char fragment_source[] =
+	"#define MAX_LIGHTS " XSTR(MAX_LIGHTS) "\n"
+	"uniform mat4 u_camera;\n"
+	"uniform bool u_lighting;\n"
+	"uniform int u_texturing; /* enum shader_texture */\n"
+	"uniform sampler2D u_texture;\n"
+	"#ifdef TEXTURE_ARRAY\n"
+	"uniform sampler2DArray u_texture_array;\n"
+	"#endif\n"
+	"uniform int u_num_lights;\n"
+	"uniform vec4 u_light_position[MAX_LIGHTS];\n"
+	"uniform vec4 u_light_ambient[MAX_LIGHTS];\n"
+	"uniform vec4 u_light_diffuse[MAX_LIGHTS];\n"
+	"uniform vec4 u_light_specular[MAX_LIGHTS];\n"
+	"uniform vec4 u_mat_ambient;\n"
+	"uniform vec4 u_mat_diffuse;\n"
+	"uniform vec4 u_mat_specular;\n"
+	"uniform vec4 u_mat_emission;\n"
+	"uniform float u_mat_shininess;\n"
+	"uniform vec4 u_color;\n"
+	"varying vec3 v_position;\n"
+	"varying vec3 v_normal;\n"
+	"varying vec3 v_texcoord;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 base = vec4(1.0);\n"
+	"	if (u_texturing == 1) /* SHADER_TEXTURE_2D */\n"
+	"		base = texture2D(u_texture, v_texcoord.st);\n"
+	"#ifdef TEXTURE_ARRAY\n"
+	"	else if (u_texturing == 2) /* SHADER_TEXTURE_ARRAY */\n"
+	"		base = texture2DArray(u_texture_array, v_texcoord);\n"
+	"#endif\n"
+	"	if (!u_lighting) {\n"
+	"		gl_FragColor = base * u_color;\n"
+	"		return;\n"
+	"	}\n"
+	"	vec3 n = normalize(gl_FrontFacing ? v_normal : -v_normal);\n"
+	"	vec3 v = normalize(u_camera[3].xyz - v_position);\n"
+	"	/* same scene ambient as the fixed-function default */\n"
+	"	vec4 color = u_mat_emission + vec4(0.2, 0.2, 0.2, 1.0) * u_mat_ambient;\n"
+	"	for (int i = 0; i < MAX_LIGHTS; i++) {\n"
+	"		if (i >= u_num_lights)\n"
+	"			break;\n"
+	"		vec4 lp = u_light_position[i];\n"
+	"		vec3 l = normalize(lp.w == 0.0 ? lp.xyz : lp.xyz - v_position);\n"
+	"		float ndotl = max(dot(n, l), 0.0);\n"
+	"		color += u_light_ambient[i] * u_mat_ambient;\n"
+	"		color += ndotl * u_light_diffuse[i] * u_mat_diffuse;\n"
+	"		if (ndotl > 0.0) {\n"
+	"			float ndoth = max(dot(n, normalize(l + v)), 0.0);\n"
+	"			color += pow(ndoth, u_mat_shininess) *\n"
+	"				u_light_specular[i] * u_mat_specular;\n"
+	"		}\n"
+	"	}\n"
+	"	gl_FragColor = vec4(color.rgb, u_mat_diffuse.a) * base;\n"
+	"}\n";
+
+struct shader {
+	GLuint program;
+	/* uniform locations */
+	GLint u_camera, u_lighting, u_texturing, u_texture, u_texture_array,
+		u_num_lights;
+	GLint u_light_position, u_light_ambient, u_light_diffuse,
+		u_light_specular;
+	GLint u_mat_ambient, u_mat_diffuse, u_mat_specular, u_mat_emission,
+		u_mat_shininess, u_color;
+	/* last uploaded values, valid once loaded is set */
+	bool loaded;
+	GLfloat camera[16];
+	bool lighting;
+	enum shader_texture texturing;
+	unsigned num_lights;
+	struct light lights[MAX_LIGHTS];
+	bool material_loaded;
+	struct material material;
+	unsigned uploads; /* glUniform calls made */
+};
+
+static GLuint shader_compile(GLenum type, const char *source,
+	bool texture_array)
+{
+	const char *sources[] = {
+		version_source, texture_array ? array_source : "", source,
+	};
+	GLuint id = glCreateShader(type);
+	GLint status;
+
+	glShaderSource(id, 3, sources, NULL);
+	glCompileShader(id);
+	glGetShaderiv(id, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[1024];
+		glGetShaderInfoLog(id, sizeof(log), NULL, log);
+		warn("shader compile failed:%s\n", log);
+		glDeleteShader(id);
+		return 0;
+	}
+	return id;
+}
+
+/* compile and link the lighting program, NULL if GLSL is unavailable.
+ * texture_array enables SHADER_TEXTURE_ARRAY, it needs GL_EXT_texture_array. */
+struct shader *shader_new(bool texture_array)
+{
+	const char *version = (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION);
+	if (!version) {
+		warn("GLSL is not supported\n");
+		return NULL;
+	}
+	info("GLSL version %s\n", version);
+
+	GLuint vs = shader_compile(GL_VERTEX_SHADER, vertex_source,
+		texture_array);
+	if (!vs)
+		return NULL;
+	GLuint fs = shader_compile(GL_FRAGMENT_SHADER, fragment_source,
+		texture_array);
+	if (!fs) {
+		glDeleteShader(vs);
+		return NULL;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	glLinkProgram(program);
+	/* the program keeps them alive while it is attached */
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		warn("shader link failed:%s\n", log);
+		glDeleteProgram(program);
+		return NULL;
+	}
+
+	struct shader *sh = calloc(1, sizeof(*sh));
+	if (!sh) {
+		glDeleteProgram(program);
+		return NULL;
+	}
+	sh->program = program;
+#define LOCATE(name) sh->name = glGetUniformLocation(program, #name)
+	LOCATE(u_camera);
+	LOCATE(u_lighting);
+	LOCATE(u_texturing);
+	LOCATE(u_texture);
+	LOCATE(u_texture_array);
+	LOCATE(u_num_lights);
+	LOCATE(u_light_position);
+	LOCATE(u_light_ambient);
+	LOCATE(u_light_diffuse);
+	LOCATE(u_light_specular);
+	LOCATE(u_mat_ambient);
+	LOCATE(u_mat_diffuse);
+	LOCATE(u_mat_specular);
+	LOCATE(u_mat_emission);
+	LOCATE(u_mat_shininess);
+	LOCATE(u_color);
+#undef LOCATE
+
+	/* the samplers never change, they need different units since they
+	 * are different types */
+	glstate_use_program(program);
+	glUniform1i(sh->u_texture, 0);
+	if (sh->u_texture_array >= 0)
+		glUniform1i(sh->u_texture_array, SHADER_ARRAY_UNIT);
+	glstate_use_program(0);
+
+	return sh;
+}
+
+void shader_free(struct shader *sh)
+{
+	if (!sh)
+		return;
+	glstate_use_program(0);
+	glDeleteProgram(sh->program);
+	free(sh);
+}
+
+/* upload the array of a light parameter at offset bytes into struct light */
+static void upload_lights(struct shader *sh, GLint location, size_t offset,
+	const struct light *lights, unsigned n)
+{
+	GLfloat v[MAX_LIGHTS][4];
+	unsigned i;
+
+	for (i = 0; i < n; i++)
+		memcpy(v[i], (const char*)&lights[i] + offset, sizeof(v[i]));
+	glUniform4fv(location, n, v[0]);
+	sh->uploads++;
+}
+
+/* bind the program and update per-frame values.
+ * camera is the inverse of the view matrix (eye to world). */
+void shader_begin(struct shader *sh, const GLfloat camera[16], bool lighting,
+	const struct light *lights, unsigned num_lights)
+{
+	unsigned i;
+
+	sh->uploads = 0;
+	glstate_use_program(sh->program);
+	if (num_lights > MAX_LIGHTS)
+		num_lights = MAX_LIGHTS;
+
+	if (!sh->loaded || memcmp(sh->camera, camera, sizeof(sh->camera))) {
+		memcpy(sh->camera, camera, sizeof(sh->camera));
+		glUniformMatrix4fv(sh->u_camera, 1, GL_FALSE, camera);
+		sh->uploads++;
+	}
+	if (!sh->loaded || sh->lighting != lighting) {
+		sh->lighting = lighting;
+		glUniform1i(sh->u_lighting, lighting);
+		sh->uploads++;
+	}
+	bool all = !sh->loaded || sh->num_lights != num_lights;
+	if (all) {
+		sh->num_lights = num_lights;
+		glUniform1i(sh->u_num_lights, num_lights);
+		sh->uploads++;
+	}
+
+	/* each parameter array is only sent if one of its lights changed */
+	bool moved = all, ambient = all, diffuse = all, specular = all;
+	for (i = 0; i < num_lights; i++) {
+		const struct light *a = &sh->lights[i], *b = &lights[i];
+		moved |= !!memcmp(a->position, b->position, sizeof(a->position));
+		ambient |= !!memcmp(a->ambient, b->ambient, sizeof(a->ambient));
+		diffuse |= !!memcmp(a->diffuse, b->diffuse, sizeof(a->diffuse));
+		specular |= !!memcmp(a->specular, b->specular, sizeof(a->specular));
+	}
+	if (num_lights) {
+		if (moved)
+			upload_lights(sh, sh->u_light_position,
+				offsetof(struct light, position), lights, num_lights);
+		if (ambient)
+			upload_lights(sh, sh->u_light_ambient,
+				offsetof(struct light, ambient), lights, num_lights);
+		if (diffuse)
+			upload_lights(sh, sh->u_light_diffuse,
+				offsetof(struct light, diffuse), lights, num_lights);
+		if (specular)
+			upload_lights(sh, sh->u_light_specular,
+				offsetof(struct light, specular), lights, num_lights);
+		memcpy(sh->lights, lights, num_lights * sizeof(*lights));
+	}
+
+	if (!sh->loaded) {
+		glUniform1i(sh->u_texturing, sh->texturing);
+		sh->uploads++;
+	}
+	sh->loaded = true;
+}
+
+#define UPLOAD4(field, location) do { \
+		if (!sh->material_loaded || memcmp(sh->material.field, mat->field, \
+			sizeof(mat->field))) { \
+			glUniform4fv(sh->location, 1, mat->field); \
+			sh->uploads++; \
+		} \
+	} while (0)
+
+void shader_material(struct shader *sh, const struct material *mat)
+{
+	UPLOAD4(ambient, u_mat_ambient);
+	UPLOAD4(diffuse, u_mat_diffuse);
+	UPLOAD4(specular, u_mat_specular);
+	UPLOAD4(emission, u_mat_emission);
+	UPLOAD4(color, u_color);
+	if (!sh->material_loaded || sh->material.shininess != mat->shininess) {
+		glUniform1f(sh->u_mat_shininess, mat->shininess);
+		sh->uploads++;
+	}
+	sh->material = *mat;
+	sh->material_loaded = true;
+}
+
+/* the array texture must be bound to unit SHADER_ARRAY_UNIT */
+void shader_texturing(struct shader *sh, enum shader_texture mode)
+{
+	if (sh->texturing == mode)
+		return;
+	sh->texturing = mode;
+	glUniform1i(sh->u_texturing, mode);
+	sh->uploads++;
+}
+
+/* return to the fixed-function pipeline */
+void shader_end(struct shader *sh)
+{
+	(void)sh;
+	glstate_use_program(0);
+}
+
+/* number of uniform uploads since the last shader_begin() */
+unsigned shader_uploads(const struct shader *sh)
+{
+	return sh->uploads;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef SHADER_H
+#define SHADER_H
+#include <stdbool.h>
+
+/* GLSL 1.20 backend with per-pixel lighting.
+ * vertices use the built-in position, normal and texcoord 0 attributes, so
+ * display lists and immediate mode geometry work with either backend.
+ * every uniform is cached and only uploaded when its value changes. */
+
+enum shader_texture {
+	SHADER_TEXTURE_NONE,
+	SHADER_TEXTURE_2D, /* u_texture on unit 0 */
+	SHADER_TEXTURE_ARRAY, /* u_texture_array, layer from texcoord r */
+};
+
+/* the unit used by SHADER_TEXTURE_ARRAY */
+#define SHADER_ARRAY_UNIT 1
+
+struct material;
+struct light;
+struct shader;
+
+struct shader *shader_new(bool texture_array);
+void shader_free(struct shader *sh);
+void shader_begin(struct shader *sh, const GLfloat camera[16], bool lighting,
+	const struct light *lights, unsigned num_lights);
+void shader_material(struct shader *sh, const struct material *mat);
+void shader_texturing(struct shader *sh, enum shader_texture mode);
+void shader_end(struct shader *sh);
+unsigned shader_uploads(const struct shader *sh);
+#endif
@@ -428,6 +428,11 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk  , void
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_uc *stbi_load_from_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp);
 // for stbi_load_from_file, file pointer is left pointing immediately after image
+
+STBIDEF stbi_uc *stbi_load_scaled     (char const *filename,     int *x, int *y, int *comp, int req_comp, int *scale);
+// like stbi_load, but JPEGs are decoded at 1/(1<<*scale) size (*scale is
+// 0..3) by scaling in the IDCT. *scale is set to what was applied, 0 for
+// other formats.
 #endif
 
 #ifndef STBI_NO_LINEAR
@@ -787,6 +792,7 @@ static void stbi__rewind(stbi__context *s)
 #ifndef STBI_NO_JPEG
 static int      stbi__jpeg_test(stbi__context *s);
 static stbi_uc *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp);
+static stbi_uc *stbi__jpeg_load_scaled(stbi__context *s, int *x, int *y, int *comp, int req_comp, int scale);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
@@ -950,6 +956,28 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int *scale)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   stbi__context s;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   if (*scale < 0) *scale = 0;
+   if (*scale > 3) *scale = 3;
+   #ifndef STBI_NO_JPEG
+   if (*scale && stbi__jpeg_test(&s))
+      result = stbi__jpeg_load_scaled(&s,x,y,comp,req_comp,*scale);
+   else
+   #endif
+   {
+      *scale = 0;
+      result = stbi_load_main(&s,x,y,comp,req_comp);
+   }
+   fclose(f);
+   return result;
+}
+
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    unsigned char *result;
@@ -1394,6 +1422,7 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale; // log2 of how much smaller than full size to decode, 0..3
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -1907,6 +1936,69 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced size IDCTs for scaled decoding. only the top-left n*n
+// coefficients are used and an n*n block is written, each pixel being the
+// low frequency part of the 8x8 block sampled at the centre of the pixels
+// it stands in for. this is jidctred's approach, costing a few multiplies
+// per pixel instead of a full IDCT followed by a downsample.
+#define stbi__rf(x)  stbi__f2f((x) * 0.5f)
+static const int stbi__idct_reduced_table[3][4][4] =
+{
+   { // 4x4, cos((2x+1)u pi/8)
+      { stbi__rf(0.707106781f), stbi__rf( 0.923879533f), stbi__rf( 0.707106781f), stbi__rf( 0.382683432f) },
+      { stbi__rf(0.707106781f), stbi__rf( 0.382683432f), stbi__rf(-0.707106781f), stbi__rf(-0.923879533f) },
+      { stbi__rf(0.707106781f), stbi__rf(-0.382683432f), stbi__rf(-0.707106781f), stbi__rf( 0.923879533f) },
+      { stbi__rf(0.707106781f), stbi__rf(-0.923879533f), stbi__rf( 0.707106781f), stbi__rf(-0.382683432f) },
+   },
+   { // 2x2, cos((2x+1)u pi/4)
+      { stbi__rf(0.707106781f), stbi__rf( 0.707106781f) },
+      { stbi__rf(0.707106781f), stbi__rf(-0.707106781f) },
+   },
+   { // 1x1, the DC term alone
+      { stbi__rf(0.707106781f) },
+   },
+};
+
+static void stbi__idct_reduced(stbi_uc *out, int out_stride, short data[64], int n, const int t[4][4])
+{
+   int i,j,k,tmp[4][4];
+   // rows, scaled back down to keep the columns in 32 bits
+   for (j=0; j < n; ++j) {
+      for (i=0; i < n; ++i) {
+         int sum = 0;
+         for (k=0; k < n; ++k)
+            sum += t[i][k] * data[j*8+k];
+         tmp[j][i] = (sum + 2048) >> 12;
+      }
+   }
+   // columns, with the +128 level shift
+   for (j=0; j < n; ++j, out += out_stride) {
+      for (i=0; i < n; ++i) {
+         int sum = 0;
+         for (k=0; k < n; ++k)
+            sum += t[j][k] * tmp[k][i];
+         out[i] = stbi__clamp(((sum + 2048) >> 12) + 128);
+      }
+   }
+}
+
+static void stbi__idct_block_4(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, 4, stbi__idct_reduced_table[0]);
+}
+
+static void stbi__idct_block_2(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, 2, stbi__idct_reduced_table[1]);
+}
+
+static void stbi__idct_block_1(stbi_uc *out, int out_stride, short data[64])
+{
+   // no multiplies needed: (dc/8) + 128
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2338,6 +2430,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          int i,j;
          STBI_SIMD_ALIGN(short, data[64]);
          int n = z->order[0];
+         int bs = 8 >> z->scale; // size of a decoded block
          // non-interleaved data, we just need to process one block at a time,
          // in trivial scanline order
          // number of blocks to do just depends on how many actual "pixels" this
@@ -2348,7 +2441,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2362,6 +2455,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          return 1;
       } else { // interleaved
          int i,j,k,x,y;
+         int bs = 8 >> z->scale;
          STBI_SIMD_ALIGN(short, data[64]);
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
@@ -2372,8 +2466,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*bs;
+                        int y2 = (j*z->img_comp[n].v + y)*bs;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
                         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
@@ -2466,6 +2560,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
    if (z->progressive) {
       // dequantize and idct the data
       int i,j,n;
+      int bs = 8 >> z->scale;
       for (n=0; n < z->s->img_n; ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
@@ -2473,7 +2568,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
             }
          }
       }
@@ -2636,9 +2731,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // to simplify generation, we'll allocate enough memory to decode
       // the bogus oversized data from using interleaved MCUs and their
       // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
-      // discard the extra data until colorspace conversion
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // discard the extra data until colorspace conversion. scaled decodes
+      // only keep (8>>scale)^2 pixels of each block
+      z->img_comp[i].w2 = (z->img_mcu_x * z->img_comp[i].h * 8) >> z->scale;
+      z->img_comp[i].h2 = (z->img_mcu_y * z->img_comp[i].v * 8) >> z->scale;
       z->img_comp[i].raw_data = stbi__malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
 
       if (z->img_comp[i].raw_data == NULL) {
@@ -2652,8 +2748,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       z->img_comp[i].linebuf = NULL;
       if (z->progressive) {
-         z->img_comp[i].coeff_w = (z->img_comp[i].w2 + 7) >> 3;
-         z->img_comp[i].coeff_h = (z->img_comp[i].h2 + 7) >> 3;
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
          z->img_comp[i].raw_coeff = STBI_MALLOC(z->img_comp[i].coeff_w * z->img_comp[i].coeff_h * 64 * sizeof(short) + 15);
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
       } else {
@@ -3200,6 +3296,17 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // the components were decoded scaled down, the output follows
+   if (z->scale) {
+      int k, round = (1 << z->scale) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale;
+      z->s->img_y = (z->s->img_y + round) >> z->scale;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + round) >> z->scale;
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> z->scale;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n;
 
@@ -3286,14 +3393,24 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    }
 }
 
-static unsigned char *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+// decode at 1/(1<<scale) of the full size, scale is 0..3
+static unsigned char *stbi__jpeg_load_scaled(stbi__context *s, int *x, int *y, int *comp, int req_comp, int scale)
 {
    stbi__jpeg j;
    j.s = s;
+   j.scale = scale;
    stbi__setup_jpeg(&j);
+   if (scale == 1) j.idct_block_kernel = stbi__idct_block_4;
+   else if (scale == 2) j.idct_block_kernel = stbi__idct_block_2;
+   else if (scale == 3) j.idct_block_kernel = stbi__idct_block_1;
    return load_jpeg_image(&j, x,y,comp,req_comp);
 }
 
+static unsigned char *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   return stbi__jpeg_load_scaled(s, x,y,comp,req_comp, 0);
+}
+
 static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
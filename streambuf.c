@@ -0,0 +1,200 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "glcaps.h"
+#include "streambuf.h"
+
+/* how long to wait on a fence, it should have passed long ago */
+#define FENCE_TIMEOUT_NS 1000000000ull
+
+/* name of a buffer target for messages */
+static const char *target_name(GLenum target)
+{
+	switch (target) {
+	case GL_ARRAY_BUFFER:
+		return "GL_ARRAY_BUFFER";
+	case GL_ELEMENT_ARRAY_BUFFER:
+		return "GL_ELEMENT_ARRAY_BUFFER";
+	case GL_PIXEL_UNPACK_BUFFER:
+		return "GL_PIXEL_UNPACK_BUFFER";
+	}
+	return "buffer";
+}
+
+/* true if buffer objects can be bound to target */
+static bool target_supported(GLenum target)
+{
+	if (target == GL_PIXEL_UNPACK_BUFFER)
+		return gl_has_version(2, 1) ||
+			gl_has_extension("GL_ARB_pixel_buffer_object");
+	return gl_has_version(1, 5);
+}
+
+/* create the buffer, -1 if buffer objects are not available. */
+int streambuf_init(struct streambuf *sb, GLenum target, size_t size)
+{
+	memset(sb, 0, sizeof(*sb));
+	if (!target_supported(target)) {
+		warn("%s buffer objects are not supported\n",
+			target_name(target));
+		return -1;
+	}
+	sb->target = target;
+	sb->size = size;
+	sb->use_map = gl_has_version(3, 0) ||
+		gl_has_extension("GL_ARB_map_buffer_range");
+	sb->use_sync = sb->use_map && (gl_has_version(3, 2) ||
+		gl_has_extension("GL_ARB_sync"));
+	if (!sb->use_map) {
+		sb->staging = malloc(size);
+		if (!sb->staging) {
+			error("Unable to allocate streaming buffer!\n");
+			return -1;
+		}
+	}
+	glGenBuffers(1, &sb->buffer);
+	glBindBuffer(target, sb->buffer);
+	glBufferData(target, size, NULL, GL_STREAM_DRAW);
+	glBindBuffer(target, 0);
+	debug("streaming %s: %zu bytes, %s, %s\n", target_name(target), size,
+		sb->use_map ? "unsynchronized map" : "glBufferSubData",
+		sb->use_sync ? "fences" : "orphaning");
+	return 0;
+}
+
+void streambuf_free(struct streambuf *sb)
+{
+	unsigned i;
+
+	for (i = 0; i < sb->num_fences; i++)
+		glDeleteSync(sb->fences[(sb->first_fence + i) %
+			STREAMBUF_FENCES].sync);
+	if (sb->buffer)
+		glDeleteBuffers(1, &sb->buffer);
+	free(sb->staging);
+	memset(sb, 0, sizeof(*sb));
+}
+
+/* retire the oldest fence, waiting for it if the GPU isn't there yet */
+static void fence_retire(struct streambuf *sb)
+{
+	unsigned i = sb->first_fence;
+	GLenum status = glClientWaitSync(sb->fences[i].sync,
+		GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+	if (status != GL_ALREADY_SIGNALED)
+		sb->waits++;
+	if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+		warn("streaming buffer fence did not signal\n");
+	glDeleteSync(sb->fences[i].sync);
+	sb->done = sb->fences[i].end;
+	sb->first_fence = (i + 1) % STREAMBUF_FENCES;
+	sb->num_fences--;
+}
+
+/* fresh storage, the driver keeps the old one until the GPU is done. */
+static void orphan(struct streambuf *sb)
+{
+	while (sb->num_fences) {
+		unsigned i = sb->first_fence;
+		glDeleteSync(sb->fences[i].sync);
+		sb->first_fence = (i + 1) % STREAMBUF_FENCES;
+		sb->num_fences--;
+	}
+	glBufferData(sb->target, sb->size, NULL, GL_STREAM_DRAW);
+	sb->orphans++;
+}
+
+/* reserve n bytes aligned to align (a power of 2) and bind the buffer.
+ * returns where to write them and sets offset to their place in the
+ * buffer, or NULL if n doesn't fit. must be followed by streambuf_unmap()
+ * before drawing or mapping again. */
+void *streambuf_map(struct streambuf *sb, size_t n, size_t align,
+	size_t *offset)
+{
+	if (!sb->buffer || sb->mapped || n > sb->size || !n)
+		return NULL;
+	glBindBuffer(sb->target, sb->buffer);
+
+	/* start is a position in an endless stream, the ring is that modulo
+	 * size. an allocation never straddles the end of the ring. */
+	uint64_t start = (sb->written + align - 1) & ~(uint64_t)(align - 1);
+	size_t pos = start % sb->size;
+	if (pos + n > sb->size) {
+		start += sb->size - pos;
+		pos = 0;
+	}
+	/* the bytes being replaced were written a whole ring ago */
+	if (start + n > sb->size) {
+		uint64_t need = start + n - sb->size;
+		if (!sb->use_sync) {
+			/* no fences, start over in new storage on every wrap */
+			if (need > sb->done) {
+				orphan(sb);
+				sb->done = start;
+			}
+		} else {
+			while (sb->done < need && sb->num_fences)
+				fence_retire(sb);
+			if (sb->done < need) {
+				/* this frame alone used up the ring */
+				orphan(sb);
+				sb->done = start;
+			}
+		}
+	}
+	sb->written = start + n;
+	sb->map_offset = pos;
+	sb->map_size = n;
+	sb->mapped = true;
+	*offset = pos;
+
+	if (!sb->use_map)
+		return sb->staging + pos;
+	void *p = glMapBufferRange(sb->target, pos, n, GL_MAP_WRITE_BIT |
+		GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	if (!p) {
+		error("Unable to map streaming buffer!\n");
+		sb->mapped = false;
+	}
+	return p;
+}
+
+/* finish writing the last allocation, the buffer stays bound. */
+void streambuf_unmap(struct streambuf *sb)
+{
+	if (!sb->mapped)
+		return;
+	if (sb->use_map) {
+		if (!glUnmapBuffer(sb->target))
+			warn("streaming buffer was lost while mapped\n");
+	} else {
+		glBufferSubData(sb->target, sb->map_offset, sb->map_size,
+			sb->staging + sb->map_offset);
+	}
+	sb->mapped = false;
+}
+
+/* call after the frame's draws, marks what they used. */
+void streambuf_frame_end(struct streambuf *sb)
+{
+	if (!sb->use_sync || !sb->buffer)
+		return;
+	/* nothing new to protect */
+	if (sb->num_fences && sb->fences[(sb->first_fence + sb->num_fences -
+		1) % STREAMBUF_FENCES].end == sb->written)
+		return;
+	if (sb->num_fences == STREAMBUF_FENCES)
+		fence_retire(sb);
+	unsigned i = (sb->first_fence + sb->num_fences) % STREAMBUF_FENCES;
+	sb->fences[i].sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	sb->fences[i].end = sb->written;
+	sb->num_fences++;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef STREAMBUF_H
+#define STREAMBUF_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* frames that can be in flight before an upload has to wait for one */
+#define STREAMBUF_FENCES 4
+
+/* a ring buffer for geometry that changes every frame.
+ * usage: p = streambuf_map(sb, n, align, &offset); write n bytes to p;
+ * streambuf_unmap(sb); then draw from offset in the bound buffer. */
+struct streambuf {
+	GLenum target; /* GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, ... */
+	GLuint buffer;
+	size_t size;
+	bool use_map; /* ARB_map_buffer_range, else staging + glBufferSubData */
+	bool use_sync; /* ARB_sync, else orphan the buffer when it wraps */
+	uint64_t written; /* total bytes handed out, ever */
+	uint64_t done; /* everything written before this is no longer used */
+	struct {
+		GLsync sync;
+		uint64_t end; /* written when the fence was placed */
+	} fences[STREAMBUF_FENCES];
+	unsigned first_fence, num_fences;
+	/* the current allocation */
+	unsigned char *staging; /* size bytes, only without use_map */
+	size_t map_offset, map_size;
+	bool mapped;
+	/* counters since streambuf_init() */
+	unsigned waits, orphans;
+};
+
+int streambuf_init(struct streambuf *sb, GLenum target, size_t size);
+void streambuf_free(struct streambuf *sb);
+void *streambuf_map(struct streambuf *sb, size_t n, size_t align,
+	size_t *offset);
+void streambuf_unmap(struct streambuf *sb);
+void streambuf_frame_end(struct streambuf *sb);
+#endif
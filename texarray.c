@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "glcaps.h"
+#include "glstate.h"
+#include "mipmap.h"
+#include "texarray.h"
+
+/* call on the GL thread */
+bool texarray_supported(void)
+{
+	return gl_has_version(3, 0) || gl_has_extension("GL_EXT_texture_array");
+}
+
+/* what a level of a 2D texture looks like */
+struct level_info {
+	GLint width, height, format, compressed, size;
+};
+
+static void level_info(GLint level, struct level_info *li)
+{
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH,
+		&li->width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT,
+		&li->height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level,
+		GL_TEXTURE_INTERNAL_FORMAT, &li->format);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED,
+		&li->compressed);
+	if (li->compressed)
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level,
+			GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &li->size);
+	else
+		li->size = li->width * li->height * 4;
+}
+
+/* how many levels a layout can have */
+#define MAX_LEVELS 32
+
+/* read the levels of a 2D texture, returns how many it has */
+static unsigned texture_layout(GLuint texture, struct level_info *levels)
+{
+	unsigned level;
+
+	glstate_bind_texture(GL_TEXTURE_2D, texture);
+	for (level = 0; level < MAX_LEVELS; level++) {
+		level_info(level, &levels[level]);
+		if (!levels[level].width)
+			break;
+		if (levels[level].width == 1 && levels[level].height == 1)
+			return level + 1;
+	}
+	return level;
+}
+
+/* true if texture b has the same layout as a, warns about how it differs
+ * if it doesn't. */
+static bool layout_match(const char *name_a, const struct level_info *a,
+	unsigned na, const char *name_b, const struct level_info *b,
+	unsigned nb)
+{
+	unsigned level;
+
+	if (a[0].width != b[0].width || a[0].height != b[0].height) {
+		warn("%s is %dx%d, not %dx%d like %s\n", name_b, b[0].width,
+			b[0].height, a[0].width, a[0].height, name_a);
+		return false;
+	}
+	if (a[0].format != b[0].format) {
+		warn("%s has format 0x%04x, not 0x%04x like %s\n", name_b,
+			b[0].format, a[0].format, name_a);
+		return false;
+	}
+	if (na != nb) {
+		warn("%s has %u mip levels, not %u like %s\n", name_b, nb, na,
+			name_a);
+		return false;
+	}
+	for (level = 0; level < na; level++) {
+		if (memcmp(&a[level], &b[level], sizeof(*a))) {
+			warn("%s differs from %s at mip level %u\n", name_b,
+				name_a, level);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* sampling state shared by both ways of packing */
+static void texarray_params(const struct texarray *ta)
+{
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAG_FILTER,
+		GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER,
+		ta->num_levels > 1 ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAX_LEVEL,
+		ta->num_levels - 1);
+}
+
+/* copy every level of each texture as it is, they share first's layout */
+static int pack_copy(struct texarray *ta, const GLuint *textures,
+	unsigned n, const struct level_info *first)
+{
+	unsigned i, level;
+
+	unsigned char *buf = malloc(first[0].size);
+	if (!buf) {
+		error("Unable to allocate texture array copy space!\n");
+		return -1;
+	}
+	ta->width = first[0].width;
+	ta->height = first[0].height;
+	ta->num_layers = n;
+	glGenTextures(1, &ta->id);
+	glstate_bind_texture(GL_TEXTURE_2D_ARRAY_EXT, ta->id);
+	for (level = 0; level < ta->num_levels; level++) {
+		const struct level_info *f = &first[level];
+		ta->bytes += (size_t)f->size * n;
+		if (f->compressed)
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY_EXT, level,
+				f->format, f->width, f->height, n, 0,
+				f->size * n, NULL);
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY_EXT, level, f->format,
+				f->width, f->height, n, 0, GL_RGBA,
+				GL_UNSIGNED_BYTE, NULL);
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (i = 0; i < n; i++) {
+		glstate_bind_texture(GL_TEXTURE_2D, textures[i]);
+		for (level = 0; level < ta->num_levels; level++) {
+			const struct level_info *f = &first[level];
+			if (f->compressed) {
+				glGetCompressedTexImage(GL_TEXTURE_2D, level, buf);
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT,
+					level, 0, 0, i, f->width, f->height, 1,
+					f->format, f->size, buf);
+			} else {
+				glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA,
+					GL_UNSIGNED_BYTE, buf);
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, level,
+					0, 0, i, f->width, f->height, 1, GL_RGBA,
+					GL_UNSIGNED_BYTE, buf);
+			}
+		}
+	}
+	free(buf);
+	return 0;
+}
+
+/* for textures that don't share a layout: level 0 of each is read back as
+ * RGBA, resized to width x height and given a new mip chain. max_size is
+ * the largest level 0 in bytes. */
+static int pack_rescaled(struct texarray *ta, const GLuint *textures,
+	unsigned n, int width, int height, size_t max_size)
+{
+	struct level_info li;
+	struct mipmap mm;
+	unsigned i, level;
+
+	unsigned char *src = malloc(max_size);
+	unsigned char *dst = malloc((size_t)width * height * 4);
+	if (!src || !dst) {
+		error("Unable to allocate texture array copy space!\n");
+		free(src);
+		free(dst);
+		return -1;
+	}
+	ta->width = width;
+	ta->height = height;
+	ta->num_layers = n;
+	glGenTextures(1, &ta->id);
+	glstate_bind_texture(GL_TEXTURE_2D_ARRAY_EXT, ta->id);
+	int w = width, h = height;
+	for (level = 0; ; level++) {
+		glTexImage3D(GL_TEXTURE_2D_ARRAY_EXT, level, GL_RGBA, w, h, n,
+			0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		ta->bytes += (size_t)w * h * 4 * n;
+		if (w == 1 && h == 1)
+			break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	ta->num_levels = level + 1;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (i = 0; i < n; i++) {
+		glstate_bind_texture(GL_TEXTURE_2D, textures[i]);
+		level_info(0, &li);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, src);
+		unsigned char *data = src;
+		if (li.width != width || li.height != height) {
+			mipmap_resize(src, li.width, li.height, dst, width,
+				height, 4);
+			data = dst;
+		}
+		if (mipmap_build(&mm, data, width, height, 4, true))
+			break;
+		glstate_bind_texture(GL_TEXTURE_2D_ARRAY_EXT, ta->id);
+		for (level = 0; level < mm.num_levels; level++)
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, level, 0, 0, i,
+				mm.level[level].width, mm.level[level].height,
+				1, GL_RGBA, GL_UNSIGNED_BYTE,
+				mm.level[level].data);
+		mipmap_free(&mm);
+	}
+	free(src);
+	free(dst);
+	return i < n ? -1 : 0;
+}
+
+/* copy n loaded 2D textures into the layers of a new array texture, layer i
+ * is textures[i] and names[i] is what to call it in messages. the pixels
+ * are read back from GL, so it works the same for decoded and compiled
+ * textures. if they don't all have the same size, format and mip levels,
+ * each is converted to RGBA at the largest size and mipped again. the 2D
+ * textures are left alone. */
+int texarray_pack(struct texarray *ta, const GLuint *textures,
+	const char *const *names, unsigned n)
+{
+	struct level_info first[MAX_LEVELS], li[MAX_LEVELS];
+	unsigned i, num;
+	bool same = true;
+
+	memset(ta, 0, sizeof(*ta));
+	if (!n)
+		return -1;
+
+	/* the first texture decides the layout, if they all share it */
+	ta->num_levels = texture_layout(textures[0], first);
+	if (!ta->num_levels) {
+		warn("%s has no image, not packing\n", names[0]);
+		return -1;
+	}
+	int width = first[0].width, height = first[0].height;
+	size_t max_size = (size_t)width * height * 4;
+	for (i = 1; i < n; i++) {
+		num = texture_layout(textures[i], li);
+		if (!num) {
+			warn("%s has no image, not packing\n", names[i]);
+			return -1;
+		}
+		if (!layout_match(names[0], first, ta->num_levels, names[i],
+			li, num))
+			same = false;
+		if (li[0].width > width)
+			width = li[0].width;
+		if (li[0].height > height)
+			height = li[0].height;
+		if ((size_t)li[0].width * li[0].height * 4 > max_size)
+			max_size = (size_t)li[0].width * li[0].height * 4;
+	}
+
+	int ret;
+	if (same) {
+		ret = pack_copy(ta, textures, n, first);
+	} else {
+		info("Converting %u textures to %dx%d RGBA to pack them\n", n,
+			width, height);
+		ret = pack_rescaled(ta, textures, n, width, height, max_size);
+	}
+	if (ret) {
+		texarray_free(ta);
+		return -1;
+	}
+	texarray_params(ta);
+	info("Packed %u textures into a %dx%d array, %zu KiB\n", n,
+		ta->width, ta->height, ta->bytes >> 10);
+	return 0;
+}
+
+void texarray_free(struct texarray *ta)
+{
+	if (ta->id)
+		glDeleteTextures(1, &ta->id);
+	memset(ta, 0, sizeof(*ta));
+}
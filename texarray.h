@@ -0,0 +1,23 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef TEXARRAY_H
+#define TEXARRAY_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* textures packed as the layers of one GL_TEXTURE_2D_ARRAY, so surfaces
+ * using any of them share a bind.
+ * unlike an atlas each layer keeps its own wrapping and mip chain. */
+struct texarray {
+	GLuint id; /* 0 if nothing was packed */
+	int width, height;
+	unsigned num_layers, num_levels;
+	size_t bytes; /* estimated GPU memory */
+};
+
+bool texarray_supported(void);
+int texarray_pack(struct texarray *ta, const GLuint *textures,
+	const char *const *names, unsigned n);
+void texarray_free(struct texarray *ta);
+#endif
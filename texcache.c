@@ -0,0 +1,714 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <SDL.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "grow.h"
+#include "glstate.h"
+#include "mipmap.h"
+#include "texture.h"
+#include "texfile.h"
+#include "threadpool.h"
+#include "streambuf.h"
+#include "texcache.h"
+
+/* the pixel buffer holds this many frames of upload budget */
+#define TEXCACHE_UPLOAD_FRAMES 4
+
+/* a decoded image or a compiled texture, whichever was found */
+struct texcache_stream {
+	bool compiled;
+	struct texture_image img;
+	struct texfile tf;
+};
+
+static void stream_free(struct texcache_stream *s)
+{
+	if (!s)
+		return;
+	if (s->compiled)
+		texfile_free(&s->tf);
+	else
+		texture_image_free(&s->img);
+	free(s);
+}
+
+/* the lock only exists once streaming has started */
+static void lock(struct texcache *tc)
+{
+	if (tc->lock)
+		SDL_LockMutex(tc->lock);
+}
+
+static void unlock(struct texcache *tc)
+{
+	if (tc->lock)
+		SDL_UnlockMutex(tc->lock);
+}
+
+void texcache_init(struct texcache *tc, size_t budget, struct threadpool *pool)
+{
+	memset(tc, 0, sizeof(*tc));
+	tc->budget = budget;
+	tc->pool = pool;
+	tc->lru_head = tc->lru_tail = -1;
+}
+
+void texcache_free(struct texcache *tc)
+{
+	unsigned i;
+
+	if (tc->loader) {
+		SDL_LockMutex(tc->lock);
+		tc->quit = true;
+		SDL_CondSignal(tc->wake);
+		SDL_UnlockMutex(tc->lock);
+		SDL_WaitThread(tc->loader, NULL);
+	}
+	if (tc->wake)
+		SDL_DestroyCond(tc->wake);
+	if (tc->lock)
+		SDL_DestroyMutex(tc->lock);
+	streambuf_free(&tc->pixels);
+	free(tc->uploads);
+	for (i = 0; i < tc->num_entries; i++) {
+		struct texcache_entry *e = &tc->entries[i];
+		if (e->id)
+			glDeleteTextures(1, &e->id);
+		stream_free(e->stream);
+		free(e->path);
+	}
+	free(tc->entries);
+	free(tc->hash);
+	memset(tc, 0, sizeof(*tc));
+	tc->lru_head = tc->lru_tail = -1;
+}
+
+/* FNV-1a */
+static uint32_t path_hash(const char *path)
+{
+	uint32_t h = 2166136261u;
+	while (*path) {
+		h ^= (unsigned char)*path++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int hash_find(const struct texcache *tc, const char *path)
+{
+	if (!tc->hash_size)
+		return -1;
+	unsigned mask = tc->hash_size - 1, i = path_hash(path) & mask;
+	for (; tc->hash[i] >= 0; i = (i + 1) & mask) {
+		if (!strcmp(tc->entries[tc->hash[i]].path, path))
+			return tc->hash[i];
+	}
+	return -1;
+}
+
+static void hash_insert(struct texcache *tc, int handle)
+{
+	unsigned mask = tc->hash_size - 1;
+	unsigned i = path_hash(tc->entries[handle].path) & mask;
+	while (tc->hash[i] >= 0)
+		i = (i + 1) & mask;
+	tc->hash[i] = handle;
+}
+
+/* keep the table at most half full */
+static int hash_grow(struct texcache *tc, unsigned count)
+{
+	unsigned size = tc->hash_size ? tc->hash_size : 16, i;
+
+	while (count * 2 > size)
+		size *= 2;
+	if (size == tc->hash_size)
+		return 0;
+	int *hash = malloc(size * sizeof(*hash));
+	if (!hash)
+		return -1;
+	free(tc->hash);
+	tc->hash = hash;
+	tc->hash_size = size;
+	for (i = 0; i < size; i++)
+		hash[i] = -1;
+	for (i = 0; i < tc->num_entries; i++)
+		hash_insert(tc, i);
+	return 0;
+}
+
+static void lru_remove(struct texcache *tc, int handle)
+{
+	struct texcache_entry *e = &tc->entries[handle];
+
+	if (e->lru_prev >= 0)
+		tc->entries[e->lru_prev].lru_next = e->lru_next;
+	else
+		tc->lru_head = e->lru_next;
+	if (e->lru_next >= 0)
+		tc->entries[e->lru_next].lru_prev = e->lru_prev;
+	else
+		tc->lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = -1;
+}
+
+static void lru_append(struct texcache *tc, int handle)
+{
+	struct texcache_entry *e = &tc->entries[handle];
+
+	e->lru_prev = tc->lru_tail;
+	e->lru_next = -1;
+	if (tc->lru_tail >= 0)
+		tc->entries[tc->lru_tail].lru_next = handle;
+	else
+		tc->lru_head = handle;
+	tc->lru_tail = handle;
+}
+
+/* drop unreferenced textures, least recently released first, until we are
+ * within the budget. */
+static void evict(struct texcache *tc)
+{
+	while (tc->bytes + tc->reserved > tc->budget && tc->lru_head >= 0) {
+		int handle = tc->lru_head;
+		struct texcache_entry *e = &tc->entries[handle];
+		lru_remove(tc, handle);
+		debug("texcache: evicting %s (%zu bytes)\n", e->path, e->bytes);
+		glDeleteTextures(1, &e->id);
+		e->id = 0;
+		lock(tc);
+		if (e->stream) {
+			stream_free(e->stream);
+			e->stream = NULL;
+			tc->num_streaming--;
+		}
+		unlock(tc);
+		tc->bytes -= e->bytes;
+		e->bytes = 0;
+		tc->evictions++;
+	}
+	if (tc->bytes + tc->reserved > tc->budget)
+		debug("texcache: %zu bytes in use, over the budget of %zu\n",
+			tc->bytes + tc->reserved, tc->budget);
+}
+
+/* bytes of GPU memory made from the cache's textures, such as a texture
+ * array they were copied into. they count against the budget as if they
+ * were resident. */
+void texcache_reserve(struct texcache *tc, size_t bytes)
+{
+	tc->reserved = bytes;
+	evict(tc);
+}
+
+/* take a reference to the texture at path, returns a handle or -1.
+ * a texture that isn't resident is loaded by the next texcache_load(). */
+int texcache_acquire(struct texcache *tc, const char *path)
+{
+	int handle = hash_find(tc, path);
+	if (handle >= 0) {
+		struct texcache_entry *e = &tc->entries[handle];
+		lock(tc);
+		if (!e->refs++ && e->id)
+			lru_remove(tc, handle);
+		if (e->id || e->pending || e->loading)
+			tc->hits++;
+		else if (!e->failed)
+			e->pending = true;
+		unlock(tc);
+		return handle;
+	}
+
+	/* the loader thread may be looking at the entries */
+	lock(tc);
+	int failed = hash_grow(tc, tc->num_entries + 1) ||
+		grow(&tc->entries, &tc->max_entries, tc->num_entries + 1,
+		sizeof(*tc->entries));
+	unlock(tc);
+	if (failed) {
+		error("Unable to allocate texture cache entry!\n");
+		return -1;
+	}
+	handle = tc->num_entries;
+	struct texcache_entry *e = &tc->entries[handle];
+	memset(e, 0, sizeof(*e));
+	e->path = strdup(path);
+	if (!e->path) {
+		error("Unable to allocate texture cache entry!\n");
+		return -1;
+	}
+	e->refs = 1;
+	e->pending = true;
+	e->lru_prev = e->lru_next = -1;
+	lock(tc);
+	tc->num_entries++;
+	unlock(tc);
+	hash_insert(tc, handle);
+	return handle;
+}
+
+/* give up a reference. the texture stays resident until the budget needs
+ * its memory. */
+void texcache_release(struct texcache *tc, int handle)
+{
+	if (handle < 0 || (unsigned)handle >= tc->num_entries)
+		return;
+	struct texcache_entry *e = &tc->entries[handle];
+	if (!e->refs) {
+		warn("texcache: %s released too many times\n", e->path);
+		return;
+	}
+	if (--e->refs)
+		return;
+	e->pending = false;
+	if (e->id) {
+		lru_append(tc, handle);
+		evict(tc);
+	}
+}
+
+/* GL name for a handle, 0 if it isn't loaded. safe from any thread while
+ * the GL thread isn't changing the cache. */
+GLuint texcache_id(const struct texcache *tc, int handle)
+{
+	if (handle < 0 || (unsigned)handle >= tc->num_entries)
+		return 0;
+	return tc->entries[handle].id;
+}
+
+/* GPU memory of a mip chain, drivers keep RGB as 4 bytes per pixel */
+static size_t texture_bytes(const struct texture_image *img)
+{
+	const struct mipmap *mm = &img->mipmap;
+	size_t total = 0;
+	unsigned i;
+
+	if (!mm->num_levels)
+		return (size_t)img->width * img->height * 4;
+	for (i = 0; i < mm->num_levels; i++)
+		total += (size_t)mm->level[i].width * mm->level[i].height * 4;
+	return total;
+}
+
+/* textures being decoded on the worker threads */
+struct load_jobs {
+	struct texcache *tc;
+	int *handles;
+	struct texture_image *images;
+	struct texfile *files; /* compiled textures, used instead if found */
+	bool *compiled;
+	int *results; /* of texture_decode() */
+	/* indexes of decoded images, in the order they finished */
+	unsigned *ready;
+	unsigned num_ready;
+	SDL_mutex *lock;
+	SDL_cond *cond;
+};
+
+static void decode_job(void *arg, unsigned index)
+{
+	struct load_jobs *jobs = arg;
+	const char *path = jobs->tc->entries[jobs->handles[index]].path;
+
+	if (!texfile_find(&jobs->files[index], path))
+		jobs->compiled[index] = true;
+	else
+		jobs->results[index] = texture_decode(&jobs->images[index],
+			path, false, true);
+	SDL_LockMutex(jobs->lock);
+	jobs->ready[jobs->num_ready++] = index;
+	SDL_CondSignal(jobs->cond);
+	SDL_UnlockMutex(jobs->lock);
+}
+
+/* a decoded image or a compiled texture, whichever the job loaded */
+static void upload(struct texcache *tc, int handle,
+	const struct texture_image *img, const struct texfile *tf)
+{
+	struct texcache_entry *e = &tc->entries[handle];
+
+	glGenTextures(1, &e->id);
+	glstate_bind_texture(GL_TEXTURE_2D, e->id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	if (tf) {
+		texfile_upload(tf);
+		e->width = tf->width;
+		e->height = tf->height;
+		e->bytes = texfile_bytes(tf);
+	} else {
+		texture_upload(img, -1, GL_RGBA, 0);
+		e->width = img->width;
+		e->height = img->height;
+		e->bytes = texture_bytes(img);
+	}
+	tc->bytes += e->bytes;
+	tc->loads++;
+	verbose("%s:texture=%dx%d %s bytes=%zu\n", e->path, e->width,
+		e->height, tf ? texfile_format_name(tf->format) : "decoded",
+		e->bytes);
+}
+
+/* the most recently drawn texture waiting to be decoded, -1 if there are
+ * none. called with the lock held. */
+static int next_to_load(const struct texcache *tc)
+{
+	int best = -1;
+	unsigned i;
+
+	for (i = 0; i < tc->num_entries; i++) {
+		const struct texcache_entry *e = &tc->entries[i];
+		if (e->loading && !e->stream && (best < 0 ||
+			e->priority > tc->entries[best].priority))
+			best = i;
+	}
+	return best;
+}
+
+/* decodes textures in the background, leaving the levels in the entry for
+ * texcache_update() to upload. */
+static int loader(void *arg)
+{
+	struct texcache *tc = arg;
+	int handle;
+
+	SDL_LockMutex(tc->lock);
+	for (;;) {
+		while (!tc->quit && (handle = next_to_load(tc)) < 0)
+			SDL_CondWait(tc->wake, tc->lock);
+		if (tc->quit)
+			break;
+		/* the path is never moved or freed while the thread runs */
+		const char *path = tc->entries[handle].path;
+		SDL_UnlockMutex(tc->lock);
+
+		struct texcache_stream *s = calloc(1, sizeof(*s));
+		if (s && !texfile_find(&s->tf, path)) {
+			s->compiled = true;
+		} else if (!s || texture_decode(&s->img, path, false, true)) {
+			free(s);
+			s = NULL;
+		}
+
+		SDL_LockMutex(tc->lock);
+		struct texcache_entry *e = &tc->entries[handle];
+		e->loading = false;
+		tc->num_loading--;
+		if (s) {
+			e->stream = s;
+			e->base_level = s->compiled ? s->tf.num_levels :
+				s->img.mipmap.num_levels;
+			tc->num_streaming++;
+		} else {
+			e->failed = true;
+		}
+	}
+	SDL_UnlockMutex(tc->lock);
+	return 0;
+}
+
+/* hand every texture acquired since the last call to the loader thread */
+static int stream_start(struct texcache *tc)
+{
+	unsigned i;
+
+	if (!tc->loader) {
+		/* PBOs, room for a few frames of uploads. without
+		 * map_buffer_range the levels would be copied into staging
+		 * and then again by glBufferSubData, so they are uploaded
+		 * straight from memory instead. */
+		if (streambuf_init(&tc->pixels, GL_PIXEL_UNPACK_BUFFER,
+			tc->upload_budget * TEXCACHE_UPLOAD_FRAMES))
+			memset(&tc->pixels, 0, sizeof(tc->pixels));
+		else if (!tc->pixels.use_map)
+			streambuf_free(&tc->pixels);
+		tc->lock = SDL_CreateMutex();
+		tc->wake = SDL_CreateCond();
+		if (tc->lock && tc->wake)
+			tc->loader = SDL_CreateThread(loader, "texcache", tc);
+		if (!tc->loader) {
+			error("Unable to start texture loader:%s\n",
+				SDL_GetError());
+			if (tc->wake)
+				SDL_DestroyCond(tc->wake);
+			if (tc->lock)
+				SDL_DestroyMutex(tc->lock);
+			tc->wake = NULL;
+			tc->lock = NULL;
+			/* load everything now instead */
+			tc->upload_budget = 0;
+			return texcache_load(tc);
+		}
+	}
+	SDL_LockMutex(tc->lock);
+	for (i = 0; i < tc->num_entries; i++) {
+		struct texcache_entry *e = &tc->entries[i];
+		if (!e->pending)
+			continue;
+		e->pending = false;
+		e->loading = true;
+		tc->num_loading++;
+	}
+	SDL_CondSignal(tc->wake);
+	SDL_UnlockMutex(tc->lock);
+	return 0;
+}
+
+/* note that a texture is being drawn this frame, it will be streamed in
+ * before ones that haven't been seen for a while. */
+void texcache_touch(struct texcache *tc, int handle, unsigned frame)
+{
+	if (handle >= 0 && (unsigned)handle < tc->num_entries)
+		tc->entries[handle].last_used = frame;
+}
+
+/* where a level of a stream is and how big it is */
+static void level_data(const struct texcache_stream *s, unsigned level,
+	const unsigned char **data, size_t *size)
+{
+	if (s->compiled) {
+		*data = s->tf.level[level].data;
+		*size = s->tf.level[level].size;
+	} else {
+		const struct mip_level *l = &s->img.mipmap.level[level];
+		*data = l->data;
+		*size = (size_t)l->width * l->height * 4;
+	}
+}
+
+/* copy one level into the mapped pixel buffer, called on the workers */
+static void copy_job(void *arg, unsigned index)
+{
+	const struct level_upload *up = (const struct level_upload *)arg + index;
+
+	memcpy(up->dst, up->src, up->size);
+}
+
+/* upload a level of a streaming texture from pixels, which is either the
+ * decoded data or an offset into the bound pixel unpack buffer. */
+static void stream_upload(struct texcache *tc, const struct level_upload *up,
+	const void *pixels)
+{
+	struct texcache_entry *e = &tc->entries[up->handle];
+	struct texcache_stream *s = e->stream;
+
+	if (!e->id) {
+		/* the smallest level, the texture can be drawn from now on */
+		glGenTextures(1, &e->id);
+		glstate_bind_texture(GL_TEXTURE_2D, e->id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, up->level);
+		e->width = s->compiled ? s->tf.width : s->img.width;
+		e->height = s->compiled ? s->tf.height : s->img.height;
+		tc->loads++;
+		if (!e->refs)
+			lru_append(tc, up->handle);
+	} else {
+		glstate_bind_texture(GL_TEXTURE_2D, e->id);
+	}
+	if (s->compiled)
+		texfile_upload_level(&s->tf, up->level, pixels);
+	else
+		mipmap_upload_level(&s->img.mipmap, up->level, GL_RGBA, pixels);
+	/* only the levels we have are sampled */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, up->level);
+	e->bytes += up->size;
+	tc->bytes += up->size;
+	if (!up->level) {
+		verbose("%s:texture=%dx%d bytes=%zu streamed\n", e->path,
+			e->width, e->height, e->bytes);
+		stream_free(s);
+		e->stream = NULL;
+		tc->num_streaming--;
+	}
+}
+
+/* pick the levels to upload this frame. textures drawn most recently go
+ * first, and the levels of each one smallest first, until the budget is
+ * used up. returns the total size. called with the lock held. */
+static size_t stream_plan(struct texcache *tc)
+{
+	size_t total = 0;
+	unsigned i;
+
+	tc->num_uploads = 0;
+	for (;;) {
+		int best = -1;
+		for (i = 0; i < tc->num_entries; i++) {
+			const struct texcache_entry *e = &tc->entries[i];
+			if (e->stream && e->base_level && (best < 0 ||
+				e->last_used > tc->entries[best].last_used))
+				best = i;
+		}
+		if (best < 0)
+			break;
+		struct texcache_entry *e = &tc->entries[best];
+		const unsigned char *data;
+		size_t size;
+		level_data(e->stream, e->base_level - 1, &data, &size);
+		/* at least one level per frame, however large */
+		if (tc->num_uploads && total + size > tc->upload_budget)
+			break;
+		if (grow(&tc->uploads, &tc->max_uploads, tc->num_uploads + 1,
+			sizeof(*tc->uploads)))
+			break;
+		struct level_upload *up = &tc->uploads[tc->num_uploads++];
+		up->handle = best;
+		up->level = --e->base_level;
+		up->src = data;
+		up->size = size;
+		up->dst = NULL;
+		total += size;
+	}
+	return total;
+}
+
+/* upload streamed levels for this frame, call once a frame on the GL
+ * thread. the levels are copied into a pixel unpack buffer by the thread
+ * pool, then each upload is a DMA the driver doesn't have to wait for.
+ * without pixel buffers that can be mapped, or for a level too large for
+ * ours, they are uploaded straight from memory. */
+void texcache_update(struct texcache *tc)
+{
+	size_t offset = 0;
+	unsigned char *p = NULL;
+	unsigned i;
+
+	if (!tc->loader)
+		return;
+	SDL_LockMutex(tc->lock);
+	for (i = 0; i < tc->num_entries; i++)
+		tc->entries[i].priority = tc->entries[i].last_used;
+	size_t total = stream_plan(tc);
+	if (total && tc->pixels.buffer)
+		p = streambuf_map(&tc->pixels, total, 64, &offset);
+	if (p) {
+		size_t pos = 0;
+		for (i = 0; i < tc->num_uploads; i++) {
+			tc->uploads[i].dst = p + pos;
+			pos += tc->uploads[i].size;
+		}
+		threadpool_run(tc->pool, tc->num_uploads, copy_job,
+			tc->uploads);
+		streambuf_unmap(&tc->pixels);
+	}
+	for (i = 0; i < tc->num_uploads; i++) {
+		const struct level_upload *up = &tc->uploads[i];
+		if (p)
+			stream_upload(tc, up,
+				(const GLvoid*)(offset + (up->dst - p)));
+		else
+			stream_upload(tc, up, up->src);
+	}
+	if (p) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		streambuf_frame_end(&tc->pixels);
+	}
+	SDL_UnlockMutex(tc->lock);
+	if (total)
+		evict(tc);
+}
+
+/* true while textures are still being decoded or uploaded */
+bool texcache_busy(struct texcache *tc)
+{
+	lock(tc);
+	bool busy = tc->num_loading || tc->num_streaming;
+	unlock(tc);
+	return busy;
+}
+
+/* load every texture acquired since the last call. decoding is spread over
+ * the thread pool and each texture is uploaded on this thread as soon as
+ * it is ready. returns -1 if any of them failed to load.
+ * when streaming it only starts the loader, and never fails. */
+int texcache_load(struct texcache *tc)
+{
+	unsigned i, n = 0;
+	int ret = 0;
+
+	if (tc->upload_budget)
+		return stream_start(tc);
+	for (i = 0; i < tc->num_entries; i++)
+		n += tc->entries[i].pending;
+	if (!n)
+		return 0;
+
+	struct load_jobs jobs = {
+		.tc = tc,
+		.handles = calloc(n, sizeof(*jobs.handles)),
+		.images = calloc(n, sizeof(*jobs.images)),
+		.files = calloc(n, sizeof(*jobs.files)),
+		.compiled = calloc(n, sizeof(*jobs.compiled)),
+		.results = calloc(n, sizeof(*jobs.results)),
+		.ready = calloc(n, sizeof(*jobs.ready)),
+		.lock = SDL_CreateMutex(),
+		.cond = SDL_CreateCond(),
+	};
+	if (!jobs.handles || !jobs.images || !jobs.files || !jobs.compiled ||
+		!jobs.results || !jobs.ready || !jobs.lock || !jobs.cond) {
+		error("Unable to allocate texture loading jobs!\n");
+		ret = -1;
+		goto out;
+	}
+	n = 0;
+	for (i = 0; i < tc->num_entries; i++) {
+		if (tc->entries[i].pending)
+			jobs.handles[n++] = i;
+	}
+
+	threadpool_start(tc->pool, n, decode_job, &jobs);
+	for (i = 0; i < n; i++) {
+		SDL_LockMutex(jobs.lock);
+		while (jobs.num_ready <= i)
+			SDL_CondWait(jobs.cond, jobs.lock);
+		unsigned k = jobs.ready[i];
+		SDL_UnlockMutex(jobs.lock);
+
+		int handle = jobs.handles[k];
+		struct texcache_entry *e = &tc->entries[handle];
+		e->pending = false;
+		if (jobs.results[k]) {
+			e->failed = true;
+			ret = -1;
+			continue;
+		}
+		if (jobs.compiled[k]) {
+			upload(tc, handle, NULL, &jobs.files[k]);
+			texfile_free(&jobs.files[k]);
+		} else {
+			upload(tc, handle, &jobs.images[k], NULL);
+			texture_image_free(&jobs.images[k]);
+		}
+	}
+	threadpool_wait(tc->pool);
+	evict(tc);
+
+out:
+	if (jobs.cond)
+		SDL_DestroyCond(jobs.cond);
+	if (jobs.lock)
+		SDL_DestroyMutex(jobs.lock);
+	free(jobs.ready);
+	free(jobs.results);
+	free(jobs.compiled);
+	free(jobs.files);
+	free(jobs.images);
+	free(jobs.handles);
+	return ret;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef TEXCACHE_H
+#define TEXCACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct threadpool;
+
+/* textures shared by path, with a limit on the GPU memory of the ones
+ * nobody holds. a handle stays valid until texcache_free(), its texture is
+ * resident while it has references. only use from the GL thread, except
+ * texcache_id() which can be called from anywhere.
+ *
+ * with an upload budget textures are streamed: a loader thread decodes them
+ * in the background, most recently drawn first, and texcache_update()
+ * uploads their mip levels smallest first, a few each frame.
+ * needs streambuf.h. */
+
+struct texcache_stream;
+
+/* a level picked to be uploaded this frame */
+struct level_upload {
+	int handle;
+	unsigned level;
+	const unsigned char *src;
+	size_t size;
+	unsigned char *dst; /* where it goes in the mapped pixel buffer */
+};
+struct texcache_entry {
+	char *path;
+	GLuint id; /* 0 when not resident */
+	unsigned refs;
+	size_t bytes; /* estimated GPU memory, 0 when not resident */
+	int width, height;
+	bool pending; /* waiting for texcache_load() */
+	bool loading; /* with the loader thread */
+	bool failed;
+	/* streaming, protected by texcache.lock */
+	struct texcache_stream *stream; /* decoded levels not uploaded yet */
+	unsigned base_level; /* smallest level number uploaded */
+	unsigned last_used; /* frame it was drawn, only for the GL thread */
+	unsigned priority; /* last_used as the loader thread sees it */
+	int lru_prev, lru_next; /* list of unreferenced resident entries */
+};
+
+struct texcache {
+	struct texcache_entry *entries;
+	unsigned num_entries, max_entries;
+	int *hash; /* entry index by path, -1 for empty */
+	unsigned hash_size;
+	int lru_head, lru_tail; /* least recently released first */
+	size_t bytes; /* resident, referenced or not */
+	size_t reserved; /* made from our textures elsewhere, counts too */
+	size_t budget;
+	struct threadpool *pool; /* decodes on the workers if not NULL */
+	unsigned loads, hits, evictions;
+	/* streaming, everything is loaded up front if upload_budget is 0 */
+	size_t upload_budget; /* bytes per frame */
+	struct SDL_Thread *loader;
+	struct SDL_mutex *lock;
+	struct SDL_cond *wake; /* a texture to load or quit */
+	unsigned num_loading; /* with the loader thread */
+	unsigned num_streaming; /* entries with a stream */
+	bool quit;
+	/* this frame's uploads, through pixels if it has a buffer */
+	struct level_upload *uploads;
+	unsigned num_uploads, max_uploads;
+	struct streambuf pixels;
+};
+
+void texcache_init(struct texcache *tc, size_t budget, struct threadpool *pool);
+void texcache_free(struct texcache *tc);
+int texcache_acquire(struct texcache *tc, const char *path);
+void texcache_release(struct texcache *tc, int handle);
+int texcache_load(struct texcache *tc);
+GLuint texcache_id(const struct texcache *tc, int handle);
+void texcache_touch(struct texcache *tc, int handle, unsigned frame);
+void texcache_update(struct texcache *tc);
+bool texcache_busy(struct texcache *tc);
+void texcache_reserve(struct texcache *tc, size_t bytes);
+#endif
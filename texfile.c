@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "glcaps.h"
+#include "dxt.h"
+#include "grow.h"
+#include "mipmap.h"
+#include "texfile.h"
+
+#define HEADER_SIZE 24
+#define LEVEL_HEADER_SIZE 12
+
+static const char *format_names[TEXFILE_FORMAT_MAX] = {
+	[TEXFILE_RGBA8] = "rgba",
+	[TEXFILE_DXT1] = "dxt1",
+	[TEXFILE_DXT5] = "dxt5",
+};
+
+/* set by texfile_init(), reading can't ask GL from other threads */
+static bool s3tc_supported;
+
+/* check which formats GL can take, call on the GL thread before reading
+ * anything. */
+void texfile_init(void)
+{
+	s3tc_supported = gl_has_version(1, 3) &&
+		gl_has_extension("GL_EXT_texture_compression_s3tc");
+	debug("S3TC textures %ssupported\n", s3tc_supported ? "" : "not ");
+}
+
+bool texfile_supported(enum texfile_format format)
+{
+	switch (format) {
+	case TEXFILE_RGBA8:
+		return true;
+	case TEXFILE_DXT1:
+	case TEXFILE_DXT5:
+		return s3tc_supported;
+	case TEXFILE_FORMAT_MAX:
+		break;
+	}
+	return false;
+}
+
+const char *texfile_format_name(enum texfile_format format)
+{
+	return format < TEXFILE_FORMAT_MAX ? format_names[format] : "unknown";
+}
+
+size_t texfile_level_size(enum texfile_format format, int width, int height)
+{
+	switch (format) {
+	case TEXFILE_RGBA8:
+		return (size_t)width * height * 4;
+	case TEXFILE_DXT1:
+		return dxt_size(width, height, false);
+	case TEXFILE_DXT5:
+		return dxt_size(width, height, true);
+	case TEXFILE_FORMAT_MAX:
+		break;
+	}
+	return 0;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* load a compiled texture. the levels point into one buffer holding the
+ * whole file, so reading is a single fread(). doesn't touch GL. */
+int texfile_read(struct texfile *tf, const char *filename)
+{
+	memset(tf, 0, sizeof(*tf));
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		return -1;
+	long len = -1;
+	if (!fseek(f, 0, SEEK_END))
+		len = ftell(f);
+	if (len < HEADER_SIZE || fseek(f, 0, SEEK_SET)) {
+		warn("%s:not a compiled texture\n", filename);
+		fclose(f);
+		return -1;
+	}
+	tf->storage = malloc(len);
+	if (!tf->storage || fread(tf->storage, 1, len, f) != (size_t)len) {
+		warn("%s:read error\n", filename);
+		fclose(f);
+		texfile_free(tf);
+		return -1;
+	}
+	fclose(f);
+
+	const unsigned char *p = tf->storage, *end = p + len;
+	if (memcmp(p, TEXFILE_MAGIC, 4) || get32(p + 4) != TEXFILE_VERSION)
+		goto bad;
+	tf->format = get32(p + 8);
+	tf->width = get32(p + 12);
+	tf->height = get32(p + 16);
+	tf->num_levels = get32(p + 20);
+	if (tf->format >= TEXFILE_FORMAT_MAX || !tf->num_levels ||
+		tf->num_levels > MIPMAP_MAX_LEVELS)
+		goto bad;
+	p += HEADER_SIZE;
+
+	unsigned i;
+	for (i = 0; i < tf->num_levels; i++) {
+		struct texfile_level *lev = &tf->level[i];
+		if (end - p < LEVEL_HEADER_SIZE)
+			goto bad;
+		lev->width = get32(p);
+		lev->height = get32(p + 4);
+		lev->size = get32(p + 8);
+		p += LEVEL_HEADER_SIZE;
+		if (lev->width <= 0 || lev->height <= 0 ||
+			lev->size != texfile_level_size(tf->format, lev->width,
+			lev->height) || (size_t)(end - p) < lev->size)
+			goto bad;
+		lev->data = (unsigned char*)p;
+		p += lev->size;
+	}
+	return 0;
+bad:
+	warn("%s:corrupt compiled texture\n", filename);
+	texfile_free(tf);
+	return -1;
+}
+
+/* read the compiled texture that hero-texc made for an image file, it has
+ * the same name with the extension replaced. fails quietly if there isn't
+ * one or GL can't use its format. */
+int texfile_find(struct texfile *tf, const char *image)
+{
+	char *filename = replace_ext(image, TEXFILE_EXT);
+	if (!filename)
+		return -1;
+
+	int ret = texfile_read(tf, filename);
+	if (!ret && !texfile_supported(tf->format)) {
+		debug("%s:%s is not supported\n", filename,
+			texfile_format_name(tf->format));
+		texfile_free(tf);
+		ret = -1;
+	}
+	free(filename);
+	return ret;
+}
+
+int texfile_write(const struct texfile *tf, const char *filename)
+{
+	unsigned char header[HEADER_SIZE];
+	unsigned i;
+
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		error("%s:unable to create\n", filename);
+		return -1;
+	}
+	memcpy(header, TEXFILE_MAGIC, 4);
+	put32(header + 4, TEXFILE_VERSION);
+	put32(header + 8, tf->format);
+	put32(header + 12, tf->width);
+	put32(header + 16, tf->height);
+	put32(header + 20, tf->num_levels);
+	bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+	for (i = 0; ok && i < tf->num_levels; i++) {
+		const struct texfile_level *lev = &tf->level[i];
+		put32(header, lev->width);
+		put32(header + 4, lev->height);
+		put32(header + 8, lev->size);
+		ok = fwrite(header, LEVEL_HEADER_SIZE, 1, f) == 1 &&
+			fwrite(lev->data, 1, lev->size, f) == lev->size;
+	}
+	if (fclose(f) || !ok) {
+		error("%s:write error\n", filename);
+		remove(filename);
+		return -1;
+	}
+	return 0;
+}
+
+/* GPU memory of every level */
+size_t texfile_bytes(const struct texfile *tf)
+{
+	size_t total = 0;
+	unsigned i;
+
+	for (i = 0; i < tf->num_levels; i++)
+		total += tf->level[i].size;
+	return total;
+}
+
+/* copy one level into the currently bound texture. pixels is normally
+ * the level's data, or an offset into a bound pixel unpack buffer. */
+void texfile_upload_level(const struct texfile *tf, unsigned level,
+	const void *pixels)
+{
+	const struct texfile_level *lev = &tf->level[level];
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (tf->format == TEXFILE_RGBA8)
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, lev->width,
+			lev->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	else
+		glCompressedTexImage2D(GL_TEXTURE_2D, level,
+			tf->format == TEXFILE_DXT1 ?
+			GL_COMPRESSED_RGB_S3TC_DXT1_EXT :
+			GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+			lev->width, lev->height, 0, lev->size, pixels);
+}
+
+/* copy every level into the currently bound texture */
+void texfile_upload(const struct texfile *tf)
+{
+	unsigned i;
+
+	for (i = 0; i < tf->num_levels; i++)
+		texfile_upload_level(tf, i, tf->level[i].data);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tf->num_levels - 1);
+}
+
+void texfile_free(struct texfile *tf)
+{
+	free(tf->storage);
+	memset(tf, 0, sizeof(*tf));
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef TEXFILE_H
+#define TEXFILE_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* a compiled texture made by hero-texc, with its mip chain already built.
+ * the file is little-endian:
+ *   "HTEX" version format width height num_levels (32 bits each)
+ * then for each level, largest first:
+ *   width height size (32 bits each) and size bytes of pixels */
+#define TEXFILE_MAGIC "HTEX"
+#define TEXFILE_VERSION 1
+#define TEXFILE_EXT ".htex"
+
+enum texfile_format {
+	TEXFILE_RGBA8,
+	TEXFILE_DXT1,
+	TEXFILE_DXT5,
+	TEXFILE_FORMAT_MAX
+};
+
+struct texfile_level {
+	int width, height;
+	size_t size;
+	unsigned char *data;
+};
+
+/* needs mipmap.h for MIPMAP_MAX_LEVELS */
+struct texfile {
+	enum texfile_format format;
+	int width, height;
+	unsigned num_levels;
+	struct texfile_level level[MIPMAP_MAX_LEVELS];
+	unsigned char *storage; /* the whole file when it was read */
+};
+
+void texfile_init(void);
+bool texfile_supported(enum texfile_format format);
+const char *texfile_format_name(enum texfile_format format);
+size_t texfile_level_size(enum texfile_format format, int width, int height);
+int texfile_read(struct texfile *tf, const char *filename);
+int texfile_find(struct texfile *tf, const char *image);
+int texfile_write(const struct texfile *tf, const char *filename);
+size_t texfile_bytes(const struct texfile *tf);
+void texfile_upload_level(const struct texfile *tf, unsigned level,
+	const void *pixels);
+void texfile_upload(const struct texfile *tf);
+void texfile_free(struct texfile *tf);
+#endif
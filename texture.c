@@ -4,17 +4,44 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glext.h>
-#include <GL/glu.h>
 #include "logging.h"
+#include "glcaps.h"
+#include "mipmap.h"
 #include "texture.h"
 
 /** Texture loading routines **/
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+/* set by texture_init(), decoding can't ask GL from other threads */
+static bool npot_supported;
+/* log2 of how much smaller than full size to decode images */
+static unsigned decode_scale;
+
+/* check what the GL can do with textures, call on the GL thread before
+ * decoding anything. */
+void texture_init(void)
+{
+	npot_supported = gl_has_version(2, 0) ||
+		gl_has_extension("GL_ARB_texture_non_power_of_two");
+	debug("NPOT textures %ssupported\n", npot_supported ? "" : "not ");
+}
+
+/* decode images at 1/2, 1/4 or 1/8 of their size (shift 1 to 3) to save
+ * memory. JPEGs are scaled while they are decoded, so they never exist at
+ * full size. anything else is decoded at full size and loses the largest
+ * levels of its mip chain instead. call before decoding anything. */
+void texture_set_scale(unsigned shift)
+{
+	decode_scale = shift > 3 ? 3 : shift;
+	if (decode_scale)
+		debug("Decoding textures at 1/%d scale\n", 1 << decode_scale);
+}
+
 /* load an image from a file, allocate a new texture, copy image into texture.
  * pass level=-1 to generate mipmaps, else LOD=level and must load mipmaps manually.
  * return width and height to info on the aspect ratio for NPOT textures.
@@ -33,30 +60,78 @@
  */
 int texture_load(const char *filename, GLint level, GLint internalFormat, int *width, int *height, GLint border, bool use_alpha)
 {
-	int w, h, comps;
-	unsigned char *data = stbi_load(filename, &w, &h, &comps, use_alpha ? 4 : 3);
-	if (!data) {
+	struct texture_image img;
+
+	if (texture_decode(&img, filename, use_alpha, level < 0))
+		return -1;
+	texture_upload(&img, level, internalFormat, border);
+	texture_image_free(&img);
+
+	if (width)
+		*width = img.width;
+	if (height)
+		*height = img.height;
+
+	return 0;
+}
+
+/* decode an image file into memory, and build its mip chain if asked.
+ * doesn't touch GL, so it can be used from any thread.
+ * stbi_failure_reason() is shared between threads, so the reason given
+ * for a failure can be another thread's. */
+int texture_decode(struct texture_image *img, const char *filename,
+	bool use_alpha, bool mipmaps)
+{
+	int comps, scale = decode_scale;
+
+	memset(img, 0, sizeof(*img));
+	img->filename = filename;
+	img->use_alpha = use_alpha;
+	/* mipmaps are built 4 bytes per pixel, the filters are faster */
+	img->comps = use_alpha || mipmaps ? 4 : 3;
+	img->data = stbi_load_scaled(filename, &img->width, &img->height,
+		&comps, img->comps, &scale);
+	if (!img->data) {
 		warn("%s:error loading:%s\n", filename, stbi_failure_reason());
 		return -1;
 	}
+	if (mipmaps && mipmap_build(&img->mipmap, img->data, img->width,
+		img->height, img->comps, npot_supported)) {
+		texture_image_free(img);
+		return -1;
+	}
+	/* the decoder couldn't scale it, drop levels to make up for it */
+	if (img->mipmap.num_levels && (unsigned)scale < decode_scale) {
+		mipmap_drop(&img->mipmap, decode_scale - scale);
+		img->width = img->mipmap.level[0].width;
+		img->height = img->mipmap.level[0].height;
+	}
+	return 0;
+}
 
-	verbose("%s:%d:loaded %dx%d\n", filename, level, w, h);
+/* copy a decoded image into the currently bound texture.
+ * pass level=-1 to upload the whole mip chain, which texture_decode()
+ * must have built. */
+void texture_upload(const struct texture_image *img, GLint level,
+	GLint internalFormat, GLint border)
+{
+	GLenum format = img->comps == 4 ? GL_RGBA : GL_RGB;
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	// TODO: What to do with not-power-of-2 textures?
-	if (level >= 0) {
-		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, border,
-			use_alpha ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, data);
-	} else {
-		gluBuild2DMipmaps(GL_TEXTURE_2D, internalFormat, w, h,
-			use_alpha ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, data);
-	}
-	stbi_image_free(data);
+	verbose("%s:%d:loaded %dx%d\n", img->filename, level, img->width,
+		img->height);
 
-	if (width)
-		*width = w;
-	if (height)
-		*height = h;
+	if (level < 0) {
+		mipmap_upload(&img->mipmap, internalFormat);
+		return;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, level, internalFormat, img->width,
+		img->height, border, format, GL_UNSIGNED_BYTE, img->data);
+}
 
-	return 0;
+void texture_image_free(struct texture_image *img)
+{
+	mipmap_free(&img->mipmap);
+	stbi_image_free(img->data);
+	img->data = NULL;
 }
@@ -3,6 +3,24 @@
  */
 #ifndef TEXTURE_H
 #define TEXTURE_H
+
+/* a decoded image waiting to be uploaded, needs mipmap.h */
+struct texture_image {
+	const char *filename;
+	unsigned char *data; /* RGB or RGBA, 8 bits per channel */
+	int width, height;
+	int comps; /* 3 or 4 */
+	bool use_alpha;
+	struct mipmap mipmap; /* num_levels is 0 if it wasn't built */
+};
+
+void texture_init(void);
+void texture_set_scale(unsigned shift);
 int texture_load(const char *filename, GLint level, GLint internalFormat,
 	int *width, int *height, GLint border, bool use_alpha);
+int texture_decode(struct texture_image *img, const char *filename,
+	bool use_alpha, bool mipmaps);
+void texture_upload(const struct texture_image *img, GLint level,
+	GLint internalFormat, GLint border);
+void texture_image_free(struct texture_image *img);
 #endif
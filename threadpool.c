@@ -0,0 +1,175 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include "logging.h"
+#include "threadpool.h"
+
+struct threadpool {
+	SDL_Thread **threads;
+	unsigned num_threads; /* workers, not counting the caller */
+	SDL_mutex *lock;
+	SDL_cond *wake; /* a new job or quit */
+	SDL_cond *done; /* a worker finished its part of the job */
+	/* the current job, protected by lock */
+	threadpool_func *func;
+	void *arg;
+	unsigned next, count; /* next index to hand out */
+	unsigned busy; /* workers inside the current job */
+	unsigned generation; /* changes for every job */
+	bool quit;
+};
+
+/* hand out indexes until the job runs dry. called with the lock held,
+ * returns with it held. */
+static void job_work(struct threadpool *pool)
+{
+	threadpool_func *func = pool->func;
+	void *arg = pool->arg;
+
+	while (pool->next < pool->count) {
+		unsigned index = pool->next++;
+		SDL_UnlockMutex(pool->lock);
+		func(arg, index);
+		SDL_LockMutex(pool->lock);
+	}
+}
+
+static int worker(void *p)
+{
+	struct threadpool *pool = p;
+	unsigned seen = 0;
+
+	SDL_LockMutex(pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->generation == seen)
+			SDL_CondWait(pool->wake, pool->lock);
+		if (pool->quit)
+			break;
+		seen = pool->generation;
+		pool->busy++;
+		job_work(pool);
+		pool->busy--;
+		SDL_CondSignal(pool->done);
+	}
+	SDL_UnlockMutex(pool->lock);
+	return 0;
+}
+
+/* start num_threads workers. 0 picks one less than the number of CPUs,
+ * since the thread calling threadpool_run() does its share of the work. */
+struct threadpool *threadpool_new(unsigned num_threads)
+{
+	struct threadpool *pool = calloc(1, sizeof(*pool));
+	unsigned i;
+
+	if (!pool)
+		return NULL;
+	if (!num_threads) {
+		int cpus = SDL_GetCPUCount();
+		num_threads = cpus > 1 ? cpus - 1 : 0;
+	}
+	pool->lock = SDL_CreateMutex();
+	pool->wake = SDL_CreateCond();
+	pool->done = SDL_CreateCond();
+	if (!pool->lock || !pool->wake || !pool->done) {
+		error("Unable to create thread pool:%s\n", SDL_GetError());
+		threadpool_free(pool);
+		return NULL;
+	}
+	if (num_threads) {
+		pool->threads = calloc(num_threads, sizeof(*pool->threads));
+		if (!pool->threads) {
+			threadpool_free(pool);
+			return NULL;
+		}
+	}
+	for (i = 0; i < num_threads; i++) {
+		pool->threads[i] = SDL_CreateThread(worker, "worker", pool);
+		if (!pool->threads[i]) {
+			warn("Unable to start worker thread:%s\n", SDL_GetError());
+			break;
+		}
+		pool->num_threads++;
+	}
+	debug("thread pool with %u workers\n", pool->num_threads);
+	return pool;
+}
+
+void threadpool_free(struct threadpool *pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+	if (pool->lock) {
+		SDL_LockMutex(pool->lock);
+		pool->quit = true;
+		SDL_CondBroadcast(pool->wake);
+		SDL_UnlockMutex(pool->lock);
+	}
+	for (i = 0; i < pool->num_threads; i++)
+		SDL_WaitThread(pool->threads[i], NULL);
+	free(pool->threads);
+	if (pool->done)
+		SDL_DestroyCond(pool->done);
+	if (pool->wake)
+		SDL_DestroyCond(pool->wake);
+	if (pool->lock)
+		SDL_DestroyMutex(pool->lock);
+	free(pool);
+}
+
+/* number of threads that can run a job, including the caller */
+unsigned threadpool_size(const struct threadpool *pool)
+{
+	return pool ? pool->num_threads + 1 : 1;
+}
+
+/* hand func(arg, i) for every i in [0, count) to the workers and return
+ * right away, the calling thread is free to do something else.
+ * must be followed by threadpool_wait() before the next job.
+ * with no workers everything runs on the calling thread, in order. */
+void threadpool_start(struct threadpool *pool, unsigned count,
+	threadpool_func *func, void *arg)
+{
+	unsigned i;
+
+	if (!pool || !pool->num_threads) {
+		for (i = 0; i < count; i++)
+			func(arg, i);
+		return;
+	}
+	SDL_LockMutex(pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->next = 0;
+	pool->count = count;
+	pool->generation++;
+	SDL_CondBroadcast(pool->wake);
+	SDL_UnlockMutex(pool->lock);
+}
+
+/* help with whatever is left of the job, then wait for it to finish */
+void threadpool_wait(struct threadpool *pool)
+{
+	if (!pool || !pool->num_threads)
+		return;
+	SDL_LockMutex(pool->lock);
+	job_work(pool);
+	/* no worker may still be holding on to this job once we return */
+	while (pool->busy)
+		SDL_CondWait(pool->done, pool->lock);
+	SDL_UnlockMutex(pool->lock);
+}
+
+/* call func(arg, i) for every i in [0, count), spread over the workers and
+ * the calling thread. returns once every call has finished. */
+void threadpool_run(struct threadpool *pool, unsigned count,
+	threadpool_func *func, void *arg)
+{
+	threadpool_start(pool, count, func, arg);
+	threadpool_wait(pool);
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/* called once for every index in [0, count) of a job */
+typedef void threadpool_func(void *arg, unsigned index);
+
+struct threadpool;
+
+struct threadpool *threadpool_new(unsigned num_threads);
+void threadpool_free(struct threadpool *pool);
+unsigned threadpool_size(const struct threadpool *pool);
+void threadpool_start(struct threadpool *pool, unsigned count,
+	threadpool_func *func, void *arg);
+void threadpool_wait(struct threadpool *pool);
+void threadpool_run(struct threadpool *pool, unsigned count,
+	threadpool_func *func, void *arg);
+#endif
@@ -0,0 +1,547 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <SDL.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "grow.h"
+#include "map.h"
+#include "worldmesh.h"
+#include "worldcache.h"
+
+/* about how many sectors go in a page */
+#define PAGE_SECTORS 64
+
+/* the center of each sector, NULL on error. *bounds gets their extent. */
+static float *sector_centers(const struct map *m, float bounds[4])
+{
+	float *c = malloc(2 * (m->num_sectors + 1) * sizeof(*c));
+	unsigned i, j;
+
+	bounds[0] = bounds[1] = INFINITY;
+	bounds[2] = bounds[3] = -INFINITY;
+	if (!c)
+		return NULL;
+	for (i = 0; i < m->num_sectors; i++) {
+		const struct map_sector *sec = map_sector(m, i);
+		float x = 0.0f, y = 0.0f;
+		for (j = 0; sec && j < sec->num_walls; j++) {
+			const struct map_vertex *v = map_wall_vertex(m, sec, j);
+			x += v->x;
+			y += v->y;
+		}
+		if (sec && sec->num_walls) {
+			x /= sec->num_walls;
+			y /= sec->num_walls;
+		}
+		c[i * 2] = x;
+		c[i * 2 + 1] = y;
+		bounds[0] = fminf(bounds[0], x);
+		bounds[1] = fminf(bounds[1], y);
+		bounds[2] = fmaxf(bounds[2], x);
+		bounds[3] = fmaxf(bounds[3], y);
+	}
+	return c;
+}
+
+/* cut the map into square tiles that hold about PAGE_SECTORS sectors each,
+ * the tiles with sectors in them become the pages. -1 on error. */
+static int pages_make(struct worldcache *wc)
+{
+	const struct map *m = wc->map;
+	unsigned n = m->num_sectors, i, tw, th;
+	float bounds[4];
+	float *centers = sector_centers(m, bounds);
+	uint32_t *tiles = NULL;
+
+	wc->sector_page = calloc(n + 1, sizeof(*wc->sector_page));
+	wc->sector_index = calloc(n + 1, sizeof(*wc->sector_index));
+	wc->sectors = calloc(n + 1, sizeof(*wc->sectors));
+	if (!centers || !wc->sector_page || !wc->sector_index || !wc->sectors)
+		goto fail;
+	float w = n ? bounds[2] - bounds[0] : 0.0f;
+	float h = n ? bounds[3] - bounds[1] : 0.0f;
+	float side = sqrtf(w * h * PAGE_SECTORS / (n ? n : 1));
+	if (!(side > 0.0f)) /* a line of sectors */
+		side = fmaxf(w, h) * PAGE_SECTORS / (n ? n : 1);
+	if (!(side > 0.0f))
+		side = 1.0f;
+	tw = w / side + 1;
+	th = h / side + 1;
+	tiles = calloc((size_t)tw * th + 1, sizeof(*tiles));
+	if (!tiles)
+		goto fail;
+
+	/* count the sectors of each tile */
+	for (i = 0; i < n; i++) {
+		unsigned tx = (centers[i * 2] - bounds[0]) / side;
+		unsigned ty = (centers[i * 2 + 1] - bounds[1]) / side;
+		if (tx >= tw)
+			tx = tw - 1;
+		if (ty >= th)
+			ty = th - 1;
+		wc->sector_page[i] = ty * tw + tx;
+		tiles[ty * tw + tx]++;
+	}
+	/* number the tiles that aren't empty */
+	for (i = 0; i < tw * th; i++) {
+		if (tiles[i])
+			wc->num_pages++;
+	}
+	wc->pages = calloc(wc->num_pages + 1, sizeof(*wc->pages));
+	wc->first = calloc(wc->num_pages + 1, sizeof(*wc->first));
+	if (!wc->pages || !wc->first)
+		goto fail;
+	unsigned p = 0, total = 0;
+	for (i = 0; i < tw * th; i++) {
+		if (!tiles[i])
+			continue;
+		wc->first[p] = total;
+		total += tiles[i];
+		tiles[i] = p++;
+	}
+	wc->first[p] = total;
+	for (i = 0; i < n; i++) {
+		p = tiles[wc->sector_page[i]];
+		wc->sector_page[i] = p;
+		wc->sector_index[i] = wc->pages[p].bytes++; /* count for now */
+		wc->sectors[wc->first[p] + wc->sector_index[i]] = i;
+	}
+	for (p = 0; p < wc->num_pages; p++) {
+		struct worldpage *page = &wc->pages[p];
+		page->bytes = 0;
+		page->lru_prev = page->lru_next = -1;
+	}
+	free(tiles);
+	free(centers);
+	return 0;
+fail:
+	error("Unable to allocate world pages!\n");
+	free(tiles);
+	free(centers);
+	return -1;
+}
+
+/* build the mesh of page p, NULL on error. doesn't touch GL. */
+static struct worldmesh *page_build(struct worldcache *wc, unsigned p)
+{
+	struct worldmesh *mesh = malloc(sizeof(*mesh));
+	unsigned i;
+
+	if (!mesh || worldmesh_init(mesh, wc->num_textures)) {
+		free(mesh);
+		return NULL;
+	}
+	for (i = wc->first[p]; i < wc->first[p + 1]; i++) {
+		if (wc->build(mesh, wc->sectors[i], wc->arg) ||
+			worldmesh_sector_end(mesh))
+			goto fail;
+	}
+	if (worldmesh_finish(mesh))
+		goto fail;
+	return mesh;
+fail:
+	worldmesh_free(mesh);
+	free(mesh);
+	return NULL;
+}
+
+/* a page has been built, called with the lock held */
+static void page_built(struct worldcache *wc, unsigned p,
+	struct worldmesh *mesh)
+{
+	struct worldpage *page = &wc->pages[p];
+
+	if (mesh && grow(&wc->built, &wc->max_built, wc->num_built + 1,
+		sizeof(*wc->built))) {
+		worldmesh_free(mesh);
+		free(mesh);
+		mesh = NULL;
+	}
+	if (mesh) {
+		page->mesh = mesh;
+		page->bytes = worldmesh_bytes(mesh);
+		page->state = PAGE_BUILT;
+		wc->bytes += page->bytes;
+		wc->built[wc->num_built++] = p;
+		wc->builds++;
+	} else {
+		error("Unable to build world page #%u\n", p);
+		page->failed = true;
+		page->state = PAGE_EMPTY;
+	}
+	if (wc->done)
+		SDL_CondBroadcast(wc->done);
+}
+
+/* the nearest page waiting to be built, -1 if there are none. called with
+ * the lock held. */
+static int next_to_build(const struct worldcache *wc)
+{
+	unsigned i;
+
+	for (i = 0; i < wc->num_wanted; i++) {
+		if (wc->pages[wc->wanted[i]].state == PAGE_QUEUED)
+			return wc->wanted[i];
+	}
+	return -1;
+}
+
+/* builds pages in the background, leaving them for worldcache_update() to
+ * upload */
+static int loader(void *arg)
+{
+	struct worldcache *wc = arg;
+	int p;
+
+	SDL_LockMutex(wc->lock);
+	for (;;) {
+		while (!wc->quit && (p = next_to_build(wc)) < 0)
+			SDL_CondWait(wc->wake, wc->lock);
+		if (wc->quit)
+			break;
+		wc->pages[p].state = PAGE_BUILDING;
+		SDL_UnlockMutex(wc->lock);
+
+		struct worldmesh *mesh = page_build(wc, p);
+
+		SDL_LockMutex(wc->lock);
+		page_built(wc, p, mesh);
+	}
+	SDL_UnlockMutex(wc->lock);
+	return 0;
+}
+
+/* reach is how many portals from the player's sector pages are wanted.
+ * budget is the bytes of pages to keep, including pages that are out of
+ * reach. upload_budget is the bytes uploaded each frame, with 0 pages are
+ * only built when they are drawn. -1 on error. */
+int worldcache_init(struct worldcache *wc, const struct map *map,
+	unsigned num_textures, unsigned reach, size_t budget,
+	size_t upload_budget, worldcache_build_func *build, void *arg)
+{
+	memset(wc, 0, sizeof(*wc));
+	wc->map = map;
+	wc->num_textures = num_textures;
+	wc->build = build;
+	wc->arg = arg;
+	wc->reach = reach;
+	wc->center = MAP_NONE;
+	wc->stamp = 1;
+	wc->budget = budget;
+	wc->upload_budget = upload_budget;
+	wc->lru_head = wc->lru_tail = -1;
+	wc->mark = calloc(map->num_sectors + 1, sizeof(*wc->mark));
+	if (!wc->mark || pages_make(wc)) {
+		worldcache_free(wc);
+		return -1;
+	}
+	if (upload_budget) {
+		wc->lock = SDL_CreateMutex();
+		wc->wake = SDL_CreateCond();
+		wc->done = SDL_CreateCond();
+		if (wc->lock && wc->wake && wc->done)
+			wc->loader = SDL_CreateThread(loader, "worldcache", wc);
+		if (!wc->loader) {
+			error("Unable to start world loader:%s\n",
+				SDL_GetError());
+			if (wc->done)
+				SDL_DestroyCond(wc->done);
+			if (wc->wake)
+				SDL_DestroyCond(wc->wake);
+			if (wc->lock)
+				SDL_DestroyMutex(wc->lock);
+			wc->done = wc->wake = NULL;
+			wc->lock = NULL;
+			/* build pages when they are drawn instead */
+			wc->upload_budget = 0;
+		}
+	}
+	debug("world pages: %u sectors in %u pages\n", map->num_sectors,
+		wc->num_pages);
+	return 0;
+}
+
+static void lru_remove(struct worldcache *wc, unsigned p)
+{
+	struct worldpage *page = &wc->pages[p];
+
+	if (page->lru_prev >= 0)
+		wc->pages[page->lru_prev].lru_next = page->lru_next;
+	else if (wc->lru_head == (int)p)
+		wc->lru_head = page->lru_next;
+	else
+		return; /* not in the list */
+	if (page->lru_next >= 0)
+		wc->pages[page->lru_next].lru_prev = page->lru_prev;
+	else
+		wc->lru_tail = page->lru_prev;
+	page->lru_prev = page->lru_next = -1;
+}
+
+static void lru_append(struct worldcache *wc, unsigned p)
+{
+	struct worldpage *page = &wc->pages[p];
+
+	page->lru_prev = wc->lru_tail;
+	page->lru_next = -1;
+	if (wc->lru_tail >= 0)
+		wc->pages[wc->lru_tail].lru_next = p;
+	else
+		wc->lru_head = p;
+	wc->lru_tail = p;
+}
+
+void worldcache_free(struct worldcache *wc)
+{
+	unsigned p;
+
+	if (wc->loader) {
+		SDL_LockMutex(wc->lock);
+		wc->quit = true;
+		SDL_CondSignal(wc->wake);
+		SDL_UnlockMutex(wc->lock);
+		SDL_WaitThread(wc->loader, NULL);
+		SDL_DestroyCond(wc->done);
+		SDL_DestroyCond(wc->wake);
+		SDL_DestroyMutex(wc->lock);
+	}
+	for (p = 0; wc->pages && p < wc->num_pages; p++) {
+		if (wc->pages[p].mesh) {
+			worldmesh_free(wc->pages[p].mesh);
+			free(wc->pages[p].mesh);
+		}
+	}
+	free(wc->pages);
+	free(wc->first);
+	free(wc->sectors);
+	free(wc->sector_page);
+	free(wc->sector_index);
+	free(wc->wanted);
+	free(wc->spare);
+	free(wc->mark);
+	free(wc->queue);
+	free(wc->built);
+	free(wc->drawn);
+	memset(wc, 0, sizeof(*wc));
+}
+
+static bool page_wanted(const struct worldcache *wc, unsigned p)
+{
+	return wc->pages[p].wanted == wc->stamp;
+}
+
+/* page p is within reach, d portals away. -1 on error. */
+static int page_want(struct worldcache *wc, unsigned p, unsigned d)
+{
+	struct worldpage *page = &wc->pages[p];
+
+	if (page_wanted(wc, p))
+		return 0;
+	if (grow(&wc->wanted, &wc->max_wanted, wc->num_wanted + 1,
+		sizeof(*wc->wanted)))
+		return -1;
+	wc->wanted[wc->num_wanted++] = p;
+	page->wanted = wc->stamp;
+	page->distance = d;
+	if (page->state == PAGE_RESIDENT)
+		lru_remove(wc, p);
+	else if (page->state == PAGE_EMPTY && !page->failed && wc->loader)
+		page->state = PAGE_QUEUED;
+	return 0;
+}
+
+/* the player is in sector, want the pages that are within reach of it by
+ * going through portals, nearest first. */
+void worldcache_center(struct worldcache *wc, unsigned sector)
+{
+	const struct map *m = wc->map;
+	unsigned i, j, num_queue = 0, old_wanted = wc->num_wanted;
+
+	if (sector == wc->center || sector >= m->num_sectors)
+		return;
+	if (wc->lock)
+		SDL_LockMutex(wc->lock);
+	wc->center = sector;
+	if (!++wc->stamp) {
+		memset(wc->mark, 0, m->num_sectors * sizeof(*wc->mark));
+		for (i = 0; i < wc->num_pages; i++)
+			wc->pages[i].wanted = 0;
+		wc->stamp = 1;
+	}
+	/* make the new list, the old one is in spare */
+	uint32_t *swap = wc->spare;
+	unsigned max_swap = wc->max_spare;
+	wc->spare = wc->wanted;
+	wc->max_spare = wc->max_wanted;
+	wc->wanted = swap;
+	wc->max_wanted = max_swap;
+	wc->num_wanted = 0;
+
+	/* breadth first, one level of portals at a time */
+	if (grow(&wc->queue, &wc->max_queue, 1, sizeof(*wc->queue)))
+		goto fail;
+	wc->queue[num_queue++] = sector;
+	wc->mark[sector] = wc->stamp;
+	unsigned level_end = num_queue, d = 0;
+	for (i = 0; i < num_queue; i++) {
+		if (i == level_end) {
+			level_end = num_queue;
+			d++;
+		}
+		unsigned cur = wc->queue[i];
+		if (page_want(wc, wc->sector_page[cur], d))
+			goto fail;
+		const struct map_sector *sec = map_sector(m, cur);
+		if (!sec || d >= wc->reach)
+			continue;
+		for (j = 0; j < sec->num_walls; j++) {
+			unsigned portal = map_wall_portal(m, sec, j);
+			if (portal >= m->num_sectors ||
+				wc->mark[portal] == wc->stamp)
+				continue;
+			if (grow(&wc->queue, &wc->max_queue, num_queue + 1,
+				sizeof(*wc->queue)))
+				goto fail;
+			wc->mark[portal] = wc->stamp;
+			wc->queue[num_queue++] = portal;
+		}
+	}
+	goto done;
+fail:
+	error("Unable to find the world pages in reach!\n");
+done:
+	/* pages that just went out of reach */
+	for (i = 0; i < old_wanted; i++) {
+		unsigned p = wc->spare[i];
+		struct worldpage *page = &wc->pages[p];
+		if (page_wanted(wc, p))
+			continue;
+		if (page->state == PAGE_QUEUED)
+			page->state = PAGE_EMPTY;
+		else if (page->state == PAGE_RESIDENT)
+			lru_append(wc, p);
+	}
+	if (wc->lock) {
+		SDL_CondSignal(wc->wake);
+		SDL_UnlockMutex(wc->lock);
+	}
+}
+
+/* called with the lock held */
+static void page_upload(struct worldcache *wc, unsigned p)
+{
+	struct worldpage *page = &wc->pages[p];
+	unsigned i;
+
+	for (i = 0; i < wc->num_built; i++) {
+		if (wc->built[i] == p)
+			break;
+	}
+	if (i < wc->num_built)
+		memmove(wc->built + i, wc->built + i + 1,
+			(--wc->num_built - i) * sizeof(*wc->built));
+	worldmesh_upload(page->mesh);
+	page->state = PAGE_RESIDENT;
+	wc->uploads++;
+	if (!page_wanted(wc, p))
+		lru_append(wc, p);
+}
+
+/* upload this frame's share of built pages, then evict pages that are out
+ * of reach while over the budget. */
+void worldcache_update(struct worldcache *wc)
+{
+	size_t uploaded = 0;
+
+	if (wc->lock)
+		SDL_LockMutex(wc->lock);
+	while (wc->num_built && (!uploaded || uploaded < wc->upload_budget)) {
+		unsigned p = wc->built[0];
+		page_upload(wc, p);
+		uploaded += wc->pages[p].bytes;
+	}
+	while (wc->bytes > wc->budget && wc->lru_head >= 0) {
+		unsigned p = wc->lru_head;
+		struct worldpage *page = &wc->pages[p];
+		lru_remove(wc, p);
+		worldmesh_free(page->mesh);
+		free(page->mesh);
+		page->mesh = NULL;
+		page->state = PAGE_EMPTY;
+		wc->bytes -= page->bytes;
+		page->bytes = 0;
+		wc->evictions++;
+	}
+	if (wc->lock)
+		SDL_UnlockMutex(wc->lock);
+}
+
+/* start a frame, nothing has been drawn yet */
+void worldcache_frame(struct worldcache *wc, unsigned frame)
+{
+	wc->frame = frame;
+	wc->num_drawn = 0;
+}
+
+/* page p has to be drawn now, build and upload it if the loader hasn't.
+ * -1 if it can't be. */
+static int page_stall(struct worldcache *wc, unsigned p)
+{
+	struct worldpage *page = &wc->pages[p];
+
+	if (wc->lock)
+		SDL_LockMutex(wc->lock);
+	wc->stalls++;
+	while (page->state == PAGE_BUILDING)
+		SDL_CondWait(wc->done, wc->lock);
+	if ((page->state == PAGE_EMPTY || page->state == PAGE_QUEUED) &&
+		!page->failed) {
+		page->state = PAGE_BUILDING;
+		if (wc->lock)
+			SDL_UnlockMutex(wc->lock);
+		struct worldmesh *mesh = page_build(wc, p);
+		if (wc->lock)
+			SDL_LockMutex(wc->lock);
+		page_built(wc, p, mesh);
+	}
+	if (page->state == PAGE_BUILT)
+		page_upload(wc, p);
+	if (wc->lock)
+		SDL_UnlockMutex(wc->lock);
+	return page->state == PAGE_RESIDENT ? 0 : -1;
+}
+
+/* the mesh that sector is drawn from, with the number of the sector in it
+ * in *index. the first time a mesh is used in a frame its visible set is
+ * reset and its page is added to drawn. NULL if there is none. */
+struct worldmesh *worldcache_mesh(struct worldcache *wc, unsigned sector,
+	unsigned *index)
+{
+	if (sector >= wc->map->num_sectors)
+		return NULL;
+	unsigned p = wc->sector_page[sector];
+	struct worldpage *page = &wc->pages[p];
+
+	*index = wc->sector_index[sector];
+	if (page->state != PAGE_RESIDENT && page_stall(wc, p))
+		return NULL;
+	if (page->frame != wc->frame) {
+		if (grow(&wc->drawn, &wc->max_drawn, wc->num_drawn + 1,
+			sizeof(*wc->drawn))) {
+			error("Unable to allocate drawn world pages!\n");
+			return NULL;
+		}
+		page->frame = wc->frame;
+		wc->drawn[wc->num_drawn++] = p;
+		worldmesh_visible_reset(page->mesh);
+	}
+	return page->mesh;
+}
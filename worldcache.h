@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef WORLDCACHE_H
+#define WORLDCACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct map;
+struct worldmesh;
+
+/* the world mesh split into pages of sectors that are near each other, so
+ * only the part of the map around the player has geometry. only use from
+ * the GL thread.
+ *
+ * a page is wanted while any of its sectors is within reach portals of the
+ * player's sector. a loader thread builds wanted pages in the background,
+ * fewest portals away first, and worldcache_update() uploads a few of them
+ * each frame. pages that aren't wanted any more stay resident until the
+ * budget runs out, least recently wanted go first. a page that has to be
+ * drawn before it has arrived is built on the spot.
+ * needs worldmesh.h. */
+
+/* add the surfaces of a sector to mesh, called on the loader thread */
+typedef int worldcache_build_func(struct worldmesh *mesh, unsigned sector,
+	void *arg);
+
+enum page_state {
+	PAGE_EMPTY,
+	PAGE_QUEUED, /* wanted, waiting for the loader */
+	PAGE_BUILDING, /* the loader or a stall is building it */
+	PAGE_BUILT, /* in memory, waiting to be uploaded */
+	PAGE_RESIDENT,
+};
+
+struct worldpage {
+	struct worldmesh *mesh; /* NULL unless built or resident */
+	enum page_state state; /* protected by worldcache.lock */
+	unsigned distance; /* portals away, only while wanted */
+	uint32_t wanted; /* worldcache.stamp while it is wanted */
+	bool failed; /* couldn't be built, don't try again */
+	unsigned frame; /* last frame it was drawn */
+	size_t bytes; /* memory used by mesh */
+	int lru_prev, lru_next; /* resident pages that aren't wanted */
+};
+
+struct worldcache {
+	const struct map *map;
+	unsigned num_textures;
+	worldcache_build_func *build;
+	void *arg;
+	/* sectors of page p are sectors[first[p]] to sectors[first[p + 1]],
+	 * each one is numbered by its place in that list in the page's mesh */
+	struct worldpage *pages;
+	unsigned num_pages;
+	uint32_t *first, *sectors;
+	uint32_t *sector_page, *sector_index; /* by sector number */
+	/* pages within reach of center, protected by lock */
+	unsigned reach, center;
+	uint32_t *wanted; /* nearest first */
+	unsigned num_wanted, max_wanted;
+	uint32_t *spare; /* the last wanted list, while making a new one */
+	unsigned max_spare;
+	/* breadth first search of the portals around center */
+	uint32_t *mark; /* stamp of the last search that reached a sector */
+	uint32_t stamp;
+	uint32_t *queue;
+	unsigned max_queue;
+	/* built pages waiting to be uploaded */
+	uint32_t *built;
+	unsigned num_built, max_built;
+	/* pages that were drawn this frame */
+	uint32_t *drawn;
+	unsigned num_drawn, max_drawn;
+	unsigned frame;
+	int lru_head, lru_tail; /* least recently wanted first */
+	size_t bytes; /* built and resident pages */
+	size_t budget;
+	size_t upload_budget; /* bytes per frame, 0 for no loader thread */
+	struct SDL_Thread *loader;
+	struct SDL_mutex *lock;
+	struct SDL_cond *wake; /* a page to build or quit */
+	struct SDL_cond *done; /* a page was built */
+	bool quit;
+	unsigned builds, uploads, evictions, stalls;
+};
+
+int worldcache_init(struct worldcache *wc, const struct map *map,
+	unsigned num_textures, unsigned reach, size_t budget,
+	size_t upload_budget, worldcache_build_func *build, void *arg);
+void worldcache_free(struct worldcache *wc);
+void worldcache_center(struct worldcache *wc, unsigned sector);
+void worldcache_update(struct worldcache *wc);
+void worldcache_frame(struct worldcache *wc, unsigned frame);
+struct worldmesh *worldcache_mesh(struct worldcache *wc, unsigned sector,
+	unsigned *index);
+#endif
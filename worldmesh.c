@@ -0,0 +1,341 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "logging.h"
+#include "grow.h"
+#include "glcaps.h"
+#include "worldmesh.h"
+
+int worldmesh_init(struct worldmesh *wm, unsigned num_textures)
+{
+	memset(wm, 0, sizeof(*wm));
+	wm->num_textures = num_textures;
+	wm->lists = calloc(num_textures, sizeof(*wm->lists));
+	if (!wm->lists || grow(&wm->sector_ranges, &wm->max_sector_ranges, 1,
+		sizeof(*wm->sector_ranges))) {
+		error("Unable to allocate world mesh!\n");
+		worldmesh_free(wm);
+		return -1;
+	}
+	wm->sector_ranges[0] = 0;
+	return 0;
+}
+
+static void lists_free(struct worldmesh *wm)
+{
+	unsigned i;
+
+	if (!wm->lists)
+		return;
+	for (i = 0; i < wm->num_textures; i++)
+		free(wm->lists[i].indices);
+	free(wm->lists);
+	wm->lists = NULL;
+}
+
+void worldmesh_free(struct worldmesh *wm)
+{
+	if (wm->vertex_buffer)
+		glDeleteBuffers(1, &wm->vertex_buffer);
+	if (wm->index_buffer)
+		glDeleteBuffers(1, &wm->index_buffer);
+	lists_free(wm);
+	free(wm->vertices);
+	free(wm->indices);
+	free(wm->ranges);
+	free(wm->sector_ranges);
+	free(wm->visible);
+	free(wm->counts);
+	free(wm->offsets);
+	free(wm->batches);
+	memset(wm, 0, sizeof(*wm));
+}
+
+/* add a vertex to the sector being built, returns its index or -1. */
+long worldmesh_vertex(struct worldmesh *wm, const GLfloat position[3],
+	const GLfloat normal[3], const GLfloat texcoord[3])
+{
+	unsigned n = wm->num_vertices;
+
+	if (grow(&wm->vertices, &wm->max_vertices, n + 1,
+		sizeof(*wm->vertices))) {
+		error("Unable to allocate world vertex!\n");
+		return -1;
+	}
+	struct worldmesh_vertex *v = &wm->vertices[n];
+	memcpy(v->position, position, sizeof(v->position));
+	memcpy(v->normal, normal, sizeof(v->normal));
+	memcpy(v->texcoord, texcoord, sizeof(v->texcoord));
+	wm->num_vertices = n + 1;
+	return n;
+}
+
+/* add a counter-clockwise triangle drawn with texture slot texture */
+int worldmesh_triangle(struct worldmesh *wm, unsigned texture, GLuint a,
+	GLuint b, GLuint c)
+{
+	if (texture >= wm->num_textures)
+		return -1;
+	struct worldmesh_list *list = &wm->lists[texture];
+	if (grow(&list->indices, &list->max, list->num + 3,
+		sizeof(*list->indices))) {
+		error("Unable to allocate world triangle!\n");
+		return -1;
+	}
+	list->indices[list->num++] = a;
+	list->indices[list->num++] = b;
+	list->indices[list->num++] = c;
+	return 0;
+}
+
+/* the triangles added since the last call belong to the next sector */
+int worldmesh_sector_end(struct worldmesh *wm)
+{
+	unsigned t;
+
+	for (t = 0; t < wm->num_textures; t++) {
+		struct worldmesh_list *list = &wm->lists[t];
+		if (list->num == list->start)
+			continue;
+		if (grow(&wm->ranges, &wm->max_ranges, wm->num_ranges + 1,
+			sizeof(*wm->ranges)))
+			goto fail;
+		/* first is within the texture until worldmesh_finish() */
+		wm->ranges[wm->num_ranges++] = (struct worldmesh_range){
+			t, list->start, list->num - list->start,
+		};
+		list->start = list->num;
+	}
+	if (grow(&wm->sector_ranges, &wm->max_sector_ranges,
+		wm->num_sectors + 2, sizeof(*wm->sector_ranges)))
+		goto fail;
+	wm->sector_ranges[++wm->num_sectors] = wm->num_ranges;
+	return 0;
+fail:
+	error("Unable to allocate world sector ranges!\n");
+	return -1;
+}
+
+/* put the indices of every texture one after another, no more sectors can
+ * be added. doesn't touch GL, so it can be done on any thread. */
+int worldmesh_finish(struct worldmesh *wm)
+{
+	unsigned t, i, total = 0;
+	unsigned *base = malloc((wm->num_textures + 1) * sizeof(*base));
+
+	for (t = 0; base && t < wm->num_textures; t++) {
+		base[t] = total;
+		total += wm->lists[t].num;
+	}
+	wm->indices = malloc((total ? total : 1) * sizeof(*wm->indices));
+	if (!base || !wm->indices) {
+		error("Unable to allocate world indices!\n");
+		free(base);
+		return -1;
+	}
+	for (t = 0; t < wm->num_textures; t++) {
+		if (wm->lists[t].num)
+			memcpy(wm->indices + base[t], wm->lists[t].indices,
+				wm->lists[t].num * sizeof(*wm->indices));
+	}
+	for (i = 0; i < wm->num_ranges; i++)
+		wm->ranges[i].first += base[wm->ranges[i].texture];
+	wm->num_indices = total;
+	free(base);
+	lists_free(wm);
+	return 0;
+}
+
+/* move a finished mesh to buffer objects if they are available, otherwise
+ * it is drawn from client memory. */
+void worldmesh_upload(struct worldmesh *wm)
+{
+	if (gl_has_version(1, 5)) {
+		glGenBuffers(1, &wm->vertex_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, wm->vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER,
+			wm->num_vertices * sizeof(*wm->vertices), wm->vertices,
+			GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glGenBuffers(1, &wm->index_buffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, wm->index_buffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			wm->num_indices * sizeof(*wm->indices), wm->indices,
+			GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		free(wm->vertices);
+		wm->vertices = NULL;
+		free(wm->indices);
+		wm->indices = NULL;
+	}
+}
+
+/* bytes of memory the mesh uses, on the GPU once it is uploaded */
+size_t worldmesh_bytes(const struct worldmesh *wm)
+{
+	return wm->num_vertices * sizeof(*wm->vertices) +
+		wm->num_indices * sizeof(*wm->indices) +
+		wm->num_ranges * sizeof(*wm->ranges) +
+		(wm->num_sectors + 1) * sizeof(*wm->sector_ranges);
+}
+
+/* the ranges of sector n, NULL if it has none */
+const struct worldmesh_range *worldmesh_sector(const struct worldmesh *wm,
+	unsigned n, unsigned *num_ranges)
+{
+	*num_ranges = 0;
+	if (n >= wm->num_sectors)
+		return NULL;
+	*num_ranges = wm->sector_ranges[n + 1] - wm->sector_ranges[n];
+	return wm->ranges + wm->sector_ranges[n];
+}
+
+void worldmesh_visible_reset(struct worldmesh *wm)
+{
+	wm->num_visible = 0;
+}
+
+/* sector n is visible this frame. add sectors roughly front to back, they
+ * are drawn in that order within a batch. */
+int worldmesh_visible_add(struct worldmesh *wm, unsigned n, unsigned group)
+{
+	unsigned i, num;
+
+	if (n >= wm->num_sectors)
+		return 0;
+	num = wm->sector_ranges[n + 1] - wm->sector_ranges[n];
+	if (grow(&wm->visible, &wm->max_visible, wm->num_visible + num,
+		sizeof(*wm->visible))) {
+		error("Unable to allocate visible world ranges!\n");
+		return -1;
+	}
+	for (i = 0; i < num; i++) {
+		struct worldmesh_visible *v = &wm->visible[wm->num_visible];
+		v->order = wm->num_visible++;
+		v->range = wm->sector_ranges[n] + i;
+		v->group = group;
+	}
+	return 0;
+}
+
+/* where index first is, for glMultiDrawElements() */
+static const GLvoid *index_offset(const struct worldmesh *wm, GLuint first)
+{
+	return (const GLvoid*)((uintptr_t)wm->indices +
+		first * sizeof(*wm->indices));
+}
+
+static int visible_cmp(const void *a, const void *b)
+{
+	const struct worldmesh_visible *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* sort the visible ranges by texture then group, keeping the order they
+ * were added in, and batch them. when layered every texture is drawn
+ * together and only the groups split them. ranges that follow on from the
+ * one before are merged. */
+int worldmesh_visible_end(struct worldmesh *wm, bool layered)
+{
+	unsigned i, n = wm->num_visible;
+	struct worldmesh_batch *batch = NULL;
+
+	wm->num_batched = 0;
+	wm->num_batches = 0;
+	if (grow(&wm->counts, &wm->max_counts, n, sizeof(*wm->counts)) ||
+		grow(&wm->offsets, &wm->max_offsets, n, sizeof(*wm->offsets)) ||
+		grow(&wm->batches, &wm->max_batches, n,
+		sizeof(*wm->batches))) {
+		error("Unable to allocate world draw ranges!\n");
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		struct worldmesh_visible *v = &wm->visible[i];
+		uint64_t texture = layered ? 0 : wm->ranges[v->range].texture;
+		v->key = texture << 32 | v->group;
+	}
+	qsort(wm->visible, n, sizeof(*wm->visible), visible_cmp);
+	for (i = 0; i < n; i++) {
+		const struct worldmesh_visible *v = &wm->visible[i];
+		const struct worldmesh_range *r = &wm->ranges[v->range];
+		const GLvoid *offset = index_offset(wm, r->first);
+		unsigned k = wm->num_batched;
+
+		if (!batch || (!layered && batch->texture != r->texture) ||
+			batch->group != v->group) {
+			batch = &wm->batches[wm->num_batches++];
+			batch->texture = layered ? WORLDMESH_ALL : r->texture;
+			batch->group = v->group;
+			batch->counts = wm->counts + k;
+			batch->offsets = wm->offsets + k;
+			batch->num = 0;
+		} else if ((uintptr_t)wm->offsets[k - 1] + wm->counts[k - 1] *
+			sizeof(*wm->indices) == (uintptr_t)offset) {
+			wm->counts[k - 1] += r->count;
+			continue;
+		}
+		wm->counts[k] = r->count;
+		wm->offsets[k] = offset;
+		wm->num_batched = k + 1;
+		batch->num++;
+	}
+	return 0;
+}
+
+/* the batches made by worldmesh_visible_end(), in texture then group
+ * order */
+const struct worldmesh_batch *worldmesh_batches(const struct worldmesh *wm,
+	unsigned *num_batches)
+{
+	*num_batches = wm->num_batches;
+	return wm->batches;
+}
+
+/* where the field at offset of the first vertex is, for the gl*Pointer()
+ * calls. vertices is NULL once they are in vertex_buffer. */
+static const GLvoid *vertex_field(const struct worldmesh *wm, size_t offset)
+{
+	return (const GLvoid*)((uintptr_t)wm->vertices + offset);
+}
+
+/* set up the vertex arrays, the ranges can be drawn until unbind */
+void worldmesh_bind(const struct worldmesh *wm)
+{
+	const GLsizei stride = sizeof(*wm->vertices);
+
+	if (wm->vertex_buffer) {
+		glBindBuffer(GL_ARRAY_BUFFER, wm->vertex_buffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, wm->index_buffer);
+	}
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, stride, vertex_field(wm,
+		offsetof(struct worldmesh_vertex, position)));
+	glNormalPointer(GL_FLOAT, stride, vertex_field(wm,
+		offsetof(struct worldmesh_vertex, normal)));
+	glTexCoordPointer(3, GL_FLOAT, stride, vertex_field(wm,
+		offsetof(struct worldmesh_vertex, texcoord)));
+}
+
+void worldmesh_unbind(const struct worldmesh *wm)
+{
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	if (wm->vertex_buffer) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
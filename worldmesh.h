@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2015 Jon Mayo <jon@rm-f.net>
+ */
+#ifndef WORLDMESH_H
+#define WORLDMESH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* every static surface of the map in one vertex buffer and one index
+ * buffer. the triangles are grouped by texture, then by sector, so the
+ * visible part of a texture is a list of index ranges that is drawn with
+ * one glMultiDrawElements() no matter how many sectors are in it.
+ * usage: worldmesh_init(); for each sector worldmesh_vertex() and
+ * worldmesh_triangle() then worldmesh_sector_end(); worldmesh_finish();
+ * worldmesh_upload(). only the upload, drawing and freeing need GL.
+ * every frame: worldmesh_visible_reset(); worldmesh_visible_add() for each
+ * visible sector; worldmesh_visible_end(); then draw worldmesh_batches()
+ * between worldmesh_bind() and worldmesh_unbind().
+ * sectors can be put in groups that are never batched together, such as
+ * the sectors that share a scissor box. */
+
+#define WORLDMESH_ALL (~0u) /* every texture, for a layered texture */
+
+struct worldmesh_vertex {
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat texcoord[3]; /* the third is the layer in a texture array */
+};
+
+/* triangles of one sector that use one texture */
+struct worldmesh_range {
+	unsigned texture;
+	GLuint first, count; /* in the index buffer */
+};
+
+/* a visible range waiting to be batched */
+struct worldmesh_visible {
+	uint64_t key; /* texture and group, made when sorting */
+	unsigned order; /* keeps the order they were added in */
+	unsigned range, group;
+};
+
+/* visible ranges of one group that are drawn together */
+struct worldmesh_batch {
+	unsigned texture; /* texture slot, or WORLDMESH_ALL when layered */
+	unsigned group;
+	const GLsizei *counts;
+	const GLvoid *const *offsets;
+	GLsizei num;
+};
+
+struct worldmesh {
+	GLuint vertex_buffer, index_buffer; /* 0 to draw from client memory */
+	struct worldmesh_vertex *vertices;
+	unsigned num_vertices, max_vertices;
+	GLuint *indices; /* NULL once it is in index_buffer */
+	unsigned num_indices;
+	unsigned num_textures;
+	/* indices of each texture while building, concatenated by finish */
+	struct worldmesh_list {
+		GLuint *indices;
+		unsigned num, max;
+		unsigned start; /* where the current sector began */
+	} *lists;
+	/* sector n owns ranges[sector_ranges[n]] to ranges[sector_ranges[n + 1]] */
+	struct worldmesh_range *ranges;
+	unsigned num_ranges, max_ranges;
+	unsigned *sector_ranges;
+	unsigned num_sectors, max_sector_ranges;
+	/* ranges of the visible sectors */
+	struct worldmesh_visible *visible;
+	unsigned num_visible, max_visible;
+	/* the same ranges sorted by texture and group, merged where they
+	 * follow on from each other, then split into batches */
+	GLsizei *counts;
+	const GLvoid **offsets;
+	unsigned num_batched, max_counts, max_offsets;
+	struct worldmesh_batch *batches;
+	unsigned num_batches, max_batches;
+};
+
+int worldmesh_init(struct worldmesh *wm, unsigned num_textures);
+void worldmesh_free(struct worldmesh *wm);
+long worldmesh_vertex(struct worldmesh *wm, const GLfloat position[3],
+	const GLfloat normal[3], const GLfloat texcoord[3]);
+int worldmesh_triangle(struct worldmesh *wm, unsigned texture, GLuint a,
+	GLuint b, GLuint c);
+int worldmesh_sector_end(struct worldmesh *wm);
+int worldmesh_finish(struct worldmesh *wm);
+void worldmesh_upload(struct worldmesh *wm);
+size_t worldmesh_bytes(const struct worldmesh *wm);
+const struct worldmesh_range *worldmesh_sector(const struct worldmesh *wm,
+	unsigned n, unsigned *num_ranges);
+void worldmesh_visible_reset(struct worldmesh *wm);
+int worldmesh_visible_add(struct worldmesh *wm, unsigned n, unsigned group);
+int worldmesh_visible_end(struct worldmesh *wm, bool layered);
+const struct worldmesh_batch *worldmesh_batches(const struct worldmesh *wm,
+	unsigned *num_batches);
+void worldmesh_bind(const struct worldmesh *wm);
+void worldmesh_unbind(const struct worldmesh *wm);
+#endif